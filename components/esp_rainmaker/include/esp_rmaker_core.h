@@ -211,6 +211,9 @@ typedef struct {
  * The callback should call the esp_rmaker_param_update_and_report() API if the new value is to be set
  * and reported back.
  *
+ * @note For string, object and array values, val.s points directly into the received request and
+ * is valid only till the callback returns. Make a copy if it is required later.
+ *
  * @param[in] device Device handle.
  * @param[in] param Parameter handle.
  * @param[in] param Pointer to \ref esp_rmaker_param_val_t. Use appropriate elements as per the value type.
@@ -762,6 +765,54 @@ esp_err_t esp_rmaker_param_add_valid_str_list(const esp_rmaker_param_t *param, c
  */
 esp_err_t esp_rmaker_param_add_array_max_count(const esp_rmaker_param_t *param, int count);
 
+/** Time series data compression types */
+typedef enum {
+    /** Every value is recorded */
+    RMAKER_TS_COMPRESSION_NONE = 0,
+    /** A value is recorded only if it differs from the last recorded one by more than the deviation */
+    RMAKER_TS_COMPRESSION_DEADBAND,
+    /** Swinging door trending. A value is recorded only if the values since the last recorded one cannot be
+     * linearly interpolated, within the deviation, between it and the latest value. */
+    RMAKER_TS_COMPRESSION_SWINGING_DOOR,
+} esp_rmaker_ts_compression_type_t;
+
+/** Time series data compression configuration */
+typedef struct {
+    /** Compression type */
+    esp_rmaker_ts_compression_type_t type;
+    /** Maximum absolute deviation which is considered insignificant */
+    float deviation;
+    /** Maximum interval (in seconds) between recorded values. A value is recorded regardless of the deviation,
+     * if these many seconds have passed since the last recorded one. 0 for no limit. */
+    uint32_t max_interval;
+} esp_rmaker_param_ts_compression_t;
+
+/** Add time series data compression for a parameter
+ *
+ * By default, every update to a parameter with PROP_FLAG_TIME_SERIES, using esp_rmaker_param_update_and_report()
+ * or esp_rmaker_param_update_and_notify(), is recorded as time series data. This can be used to record only the
+ * values which carry information, for an integer/float parameter. It should be called after
+ * esp_rmaker_param_create(), before any updates.
+ * Eg.
+ * esp_rmaker_param_ts_compression_t compression = {
+ *     .type = RMAKER_TS_COMPRESSION_SWINGING_DOOR,
+ *     .deviation = 0.5,
+ *     .max_interval = 900,
+ * };
+ * esp_rmaker_param_add_ts_compression(temperature_param, &compression);
+ *
+ * @note The last value received for swinging door trending is held till it is known whether it needs to be
+ * recorded. So, it gets reported only after the next value which cannot be interpolated, or after max_interval.
+ *
+ * @param[in] param Parameter handle.
+ * @param[in] config Pointer to the compression configuration. Contents are copied internally.
+ *
+ * @return ESP_OK on success.
+ * return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_add_ts_compression(const esp_rmaker_param_t *param,
+        const esp_rmaker_param_ts_compression_t *config);
+
 
 /* Update a parameter
  *
@@ -791,6 +842,10 @@ esp_err_t esp_rmaker_param_update(const esp_rmaker_param_t *param, esp_rmaker_pa
  * Calling this API will update the parameter and report it to ESP RainMaker cloud.
  * This should be used whenever there is any local change.
  *
+ * @note If CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE is enabled, the report is deferred and
+ * all the parameter updates within CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE_WINDOW are reported
+ * together. Use esp_rmaker_param_report_flush() if the change needs to be reported immediately.
+ *
  * @param[in] param Parameter handle.
  * @param[in] val New value of the parameter.
  *
@@ -799,6 +854,18 @@ esp_err_t esp_rmaker_param_update(const esp_rmaker_param_t *param, esp_rmaker_pa
  */
 esp_err_t esp_rmaker_param_update_and_report(const esp_rmaker_param_t *param, esp_rmaker_param_val_t val);
 
+/** Report all the pending parameter updates
+ *
+ * This reports all the parameters which have been updated (using esp_rmaker_param_update()
+ * or esp_rmaker_param_update_and_report()) but not yet reported, in a single message.
+ * If CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE is enabled, this can be used to bypass the
+ * coalescing window for latency critical parameters.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_report_flush(void);
+
 /** Update and notify a parameter
  *
  * Calling this API will update the parameter and report it to ESP RainMaker cloud similar to
@@ -834,7 +901,7 @@ esp_err_t esp_rmaker_param_update_and_notify(const esp_rmaker_param_t *param, es
  * @param[in] alert_str NULL terminated pre-formatted alert string.
  *     Maximum length can be ESP_RMAKER_MAX_ALERT_LEN, excluding NULL character.
  *
- * @return ESP_OK on success.
+ * @return ESP_OK on success, including the alert having been queued for want of the MQTT budget.
  * @return error in case of failure.
  */
 esp_err_t esp_rmaker_raise_alert(const char *alert_str);
@@ -870,6 +937,76 @@ char *esp_rmaker_param_get_type(const esp_rmaker_param_t *param);
  */
 esp_rmaker_param_val_t *esp_rmaker_param_get_val(esp_rmaker_param_t *param);
 
+/** Persistent parameters' statistics */
+typedef struct {
+    /** Number of updates to parameters with PROP_FLAG_PERSIST */
+    uint32_t updates;
+    /** Number of parameter values written to NVS */
+    uint32_t writes;
+    /** Number of NVS commits, i.e. flash write transactions */
+    uint32_t commits;
+} esp_rmaker_param_persist_stats_t;
+
+/** Write pending parameter values to NVS
+ *
+ * Values of parameters with PROP_FLAG_PERSIST are written to NVS after CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY.
+ * This API can be used to write all the pending values immediately. This is done internally before a restart.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_persist_flush(void);
+
+/** Get the persistent parameters' statistics
+ *
+ * @param[out] stats Pointer to a \ref esp_rmaker_param_persist_stats_t structure to be filled.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_persist_get_stats(esp_rmaker_param_persist_stats_t *stats);
+
+/** Time series data statistics */
+typedef struct {
+    /** Number of samples recorded for params with PROP_FLAG_TIME_SERIES */
+    uint32_t samples;
+    /** Number of samples reported to the cloud */
+    uint32_t records;
+    /** Number of samples dropped since they could not be reported (or stored in flash) before the buffer got full */
+    uint32_t dropped;
+    /** Number of samples stored in flash, to be reported later, with CONFIG_ESP_RMAKER_TS_SPILL */
+    uint32_t spilled;
+    /** Number of entries in flash yet to be reported, with CONFIG_ESP_RMAKER_TS_SPILL */
+    uint32_t spill_pending;
+    /** Number of MQTT publishes used for reporting the samples */
+    uint32_t publishes;
+    /** Number of values not recorded because of the compression set by esp_rmaker_param_add_ts_compression() */
+    uint32_t compressed;
+} esp_rmaker_param_ts_stats_t;
+
+/** Report pending time series data
+ *
+ * With CONFIG_ESP_RMAKER_TS_BATCH, the values of parameters with PROP_FLAG_TIME_SERIES are buffered and reported
+ * together, once the buffer of any parameter has CONFIG_ESP_RMAKER_TS_BATCH_RECORDS samples or the oldest sample
+ * is CONFIG_ESP_RMAKER_TS_BATCH_MAX_AGE seconds old. This API can be used to report all the pending samples
+ * immediately. This is done internally before a restart.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_ts_flush(void);
+
+/** Get the time series data statistics
+ *
+ * @note The statistics, other than the compressed count, are maintained only with CONFIG_ESP_RMAKER_TS_BATCH.
+ *
+ * @param[out] stats Pointer to a \ref esp_rmaker_param_ts_stats_t structure to be filled.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_param_ts_get_stats(esp_rmaker_param_ts_stats_t *stats);
+
 /** Report the node details to the cloud
  *
  * This API reports node details i.e. the node configuration and values of all the parameters to the ESP RainMaker cloud.
@@ -879,6 +1016,9 @@ esp_rmaker_param_val_t *esp_rmaker_param_get_val(esp_rmaker_param_t *param);
  * @note Please use this API only if you need to create or delete devices after esp_rmaker_start() has already
  * been called, for use cases like bridges or hubs.
  *
+ * @note The node configuration is reported even if CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED is enabled
+ * and it has not changed since it was last reported.
+ *
  * @return ESP_OK if the node details are successfully queued to be published.
  * @return error in case of failure.
  */
@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Number of buckets in a metric histogram.
+ *
+ * Bucket 0 counts the values less than the base of the histogram, and each subsequent bucket covers
+ * twice the range of the earlier one, ie. <2*base, <4*base and so on. The last bucket counts all the larger ones.
+ */
+#define RMAKER_METRIC_HIST_BUCKETS  8
+
+/** Handle for a metric */
+typedef struct esp_rmaker_metric esp_rmaker_metric_t;
+
+/** Register a counter
+ *
+ * Counters are reported as the total of all the values added since boot.
+ *
+ * @note The metrics APIs accept NULL handles and do nothing in that case, so that instrumentation
+ * need not check for registration failures, or for CONFIG_ESP_RMAKER_METRICS being disabled.
+ *
+ * @param[in] name Name of the metric, reported as is. It should remain valid, and so typically is a string literal.
+ *
+ * @return Handle for the counter on success. If a counter with the same name exists, its handle is returned.
+ * @return NULL in case of failure, like the registry being full, or a metric of another type having the same name.
+ */
+esp_rmaker_metric_t *esp_rmaker_metric_counter(const char *name);
+
+/** Register a gauge
+ *
+ * Gauges are reported with the value last set.
+ *
+ * @param[in] name Name of the metric. It should remain valid.
+ *
+ * @return Handle for the gauge on success. If a gauge with the same name exists, its handle is returned.
+ * @return NULL in case of failure, like a metric of another type having the same name.
+ */
+esp_rmaker_metric_t *esp_rmaker_metric_gauge(const char *name);
+
+/** Register a histogram
+ *
+ * Histograms are reported with the count of values in each bucket (as per \ref RMAKER_METRIC_HIST_BUCKETS)
+ * and the sum of all the values, since boot.
+ *
+ * @param[in] name Name of the metric. It should remain valid.
+ * @param[in] base Upper bound (exclusive) of the first bucket. Should be non zero.
+ *
+ * @return Handle for the histogram on success. If a histogram with the same name exists, its handle is returned.
+ * @return NULL in case of failure, like a metric of another type having the same name.
+ */
+esp_rmaker_metric_t *esp_rmaker_metric_histogram(const char *name, uint32_t base);
+
+/** Add to a counter
+ *
+ * @param[in] metric Counter handle.
+ * @param[in] val Value to be added.
+ */
+void esp_rmaker_metric_add(esp_rmaker_metric_t *metric, uint32_t val);
+
+/** Set a gauge
+ *
+ * @param[in] metric Gauge handle.
+ * @param[in] val New value.
+ */
+void esp_rmaker_metric_set(esp_rmaker_metric_t *metric, int32_t val);
+
+/** Record a value in a histogram
+ *
+ * @param[in] metric Histogram handle.
+ * @param[in] val Value to be recorded.
+ */
+void esp_rmaker_metric_observe(esp_rmaker_metric_t *metric, uint32_t val);
+
+/** Get all the metrics in the format in which they are reported
+ *
+ * {"rmaker_metrics":{"v":1,"up":<uptime in seconds>,"c":{"<counter>":<total>,...},"g":{"<gauge>":<value>,...},
+ * "h":{"<histogram>":{"b":<base>,"s":<sum>,"n":[<bucket counts>]},...}}}
+ *
+ * @return Pointer to a NULL terminated JSON string on success, which should be freed by the caller.
+ * @return NULL in case of failure.
+ */
+char *esp_rmaker_metrics_get_json(void);
+
+/** Report the metrics now
+ *
+ * The metrics are otherwise reported periodically, as per CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL,
+ * on the diagnostics topic (node/<node_id>/diagnostics/from-node).
+ *
+ * @return ESP_OK on success, including the report having been queued for want of the MQTT budget.
+ * @return ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_RMAKER_METRICS is not enabled.
+ * @return error in case of any other failure.
+ */
+esp_err_t esp_rmaker_metrics_report(void);
+
+#ifdef __cplusplus
+}
+#endif
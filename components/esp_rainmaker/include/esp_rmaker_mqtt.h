@@ -16,6 +16,11 @@
 #include <esp_err.h>
 #include <esp_rmaker_mqtt_glue.h>
 
+/* Returned by esp_rmaker_mqtt_publish_with_prio() for queued messages. Defined here for older IDF versions. */
+#ifndef ESP_ERR_NOT_FINISHED
+#define ESP_ERR_NOT_FINISHED    0x10C
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -90,6 +95,69 @@ esp_err_t esp_rmaker_mqtt_subscribe(const char *topic, esp_rmaker_mqtt_subscribe
  * @return error in case of any error.
  */
 esp_err_t esp_rmaker_mqtt_unsubscribe(const char *topic);
+
+/** Subscribe to an MQTT topic of the node
+ *
+ * Registers the callback for the topic node/<node_id>/<topic_suffix> in the RainMaker dispatch table.
+ * The suffix can have the MQTT wildcards "+" and "#". A message matching multiple suffixes is passed to
+ * all their callbacks. Registering again for the same suffix replaces the callback.
+ *
+ * With CONFIG_ESP_RMAKER_MQTT_NODE_WILDCARD_SUBSCRIBE, only node/<node_id>/# is subscribed to on the broker,
+ * irrespective of the number of topics. Else, each topic is subscribed to separately.
+ *
+ * @param[in] topic_suffix The topic suffix, after node/<node_id>/.
+ * @param[in] cb The callback to be invoked when a message is received on a matching topic.
+ * @param[in] qos Quality of Service for the Subscription.
+ * @param[in] priv_data Optional private data to be passed to the callback
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_rmaker_mqtt_node_subscribe(const char *topic_suffix, esp_rmaker_mqtt_subscribe_cb_t cb,
+        uint8_t qos, void *priv_data);
+
+/** Unsubscribe from an MQTT topic of the node
+ *
+ * @param[in] topic_suffix The topic suffix used for esp_rmaker_mqtt_node_subscribe().
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_FOUND if there was no such subscription.
+ * @return error in case of any other error.
+ */
+esp_err_t esp_rmaker_mqtt_node_unsubscribe(const char *topic_suffix);
+
+/** Statistics of an MQTT topic handler registered using esp_rmaker_mqtt_node_subscribe() */
+typedef struct {
+    /** Number of messages handled */
+    uint32_t messages;
+    /** Total time spent in the callback */
+    uint64_t total_us;
+    /** Maximum time spent in the callback for a message */
+    uint32_t max_us;
+} esp_rmaker_mqtt_handler_stats_t;
+
+/** Callback for esp_rmaker_mqtt_get_handler_stats()
+ *
+ * @param[in] topic_suffix The topic suffix of the handler.
+ * @param[in] stats Statistics of the handler.
+ * @param[in] priv_data Private data passed to esp_rmaker_mqtt_get_handler_stats().
+ */
+typedef void (*esp_rmaker_mqtt_handler_stats_cb_t)(const char *topic_suffix,
+        const esp_rmaker_mqtt_handler_stats_t *stats, void *priv_data);
+
+/** Get the statistics of the MQTT topic handlers
+ *
+ * @param[in] cb Callback invoked with the statistics of each topic suffix ever subscribed to using
+ * esp_rmaker_mqtt_node_subscribe(). It should not (un)subscribe.
+ * @param[in] priv_data Optional private data to be passed to the callback.
+ * @param[out] unmatched Optional pointer to get the number of messages which did not match any handler.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_STATE if nothing has been subscribed to yet.
+ * @return error in case of any other error.
+ */
+esp_err_t esp_rmaker_mqtt_get_handler_stats(esp_rmaker_mqtt_handler_stats_cb_t cb, void *priv_data,
+        uint32_t *unmatched);
 esp_err_t esp_rmaker_mqtt_setup(esp_rmaker_mqtt_config_t mqtt_config);
 
 /** Creates appropriate MQTT Topic String based on CONFIG_ESP_RMAKER_MQTT_USE_BASIC_INGEST_TOPICS
@@ -100,6 +168,137 @@ esp_err_t esp_rmaker_mqtt_setup(esp_rmaker_mqtt_config_t mqtt_config);
 */
 void esp_rmaker_create_mqtt_topic(char *buf, size_t buf_size, const char *topic_suffix, const char *rule);
 
+/** Priority classes of outgoing MQTT messages, highest first */
+typedef enum {
+    /** Alerts and notifications */
+    RMAKER_MQTT_PRIO_ALERT = 0,
+    /** OTA status and fetch requests */
+    RMAKER_MQTT_PRIO_OTA,
+    /** Command responses */
+    RMAKER_MQTT_PRIO_CMD_RESP,
+    /** Parameter reports and node configuration */
+    RMAKER_MQTT_PRIO_PARAMS,
+    /** Time series data */
+    RMAKER_MQTT_PRIO_TS,
+    /** Number of priority classes. Not to be used as a priority. */
+    RMAKER_MQTT_PRIO_MAX,
+} esp_rmaker_mqtt_prio_t;
+
+/** Publish MQTT Message with the given priority
+ *
+ * Same as esp_rmaker_mqtt_publish(), except that if the MQTT budget is not available, or messages of
+ * higher or same priority are already waiting, the message is copied to an internal queue instead of
+ * being dropped. Queued messages get published, highest priority first, as the budget revives.
+ * If the queue is full, the oldest messages of the lowest priority, not higher than this one, are dropped
+ * to make room. Messages are not queued while MQTT is disconnected.
+ *
+ * @note The queue is available only with CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE. Else, this is the same as
+ * esp_rmaker_mqtt_publish().
+ *
+ * @param[in] topic The MQTT topic on which the message should be published.
+ * @param[in] data Data to be published
+ * @param[in] data_len Length of the data
+ * @param[in] qos Quality of Service for the Publish.
+ * @param[in] prio Priority class of the message.
+ *
+ * @return ESP_OK if the message was handed over to the MQTT client, as with esp_rmaker_mqtt_publish().
+ * @return ESP_ERR_NOT_FINISHED if the message was queued. It may still be dropped to make room for higher
+ * priority messages, or lost on a restart, and so callers which need the message to be delivered should
+ * not treat this as success.
+ * @return error in case of any error.
+ */
+esp_err_t esp_rmaker_mqtt_publish_with_prio(const char *topic, void *data, size_t data_len, uint8_t qos,
+        esp_rmaker_mqtt_prio_t prio);
+
+/** MQTT publish statistics of a priority class */
+typedef struct {
+    /** Number of messages published */
+    uint32_t published;
+    /** Number of messages which had to be queued */
+    uint32_t deferred;
+    /** Number of messages dropped, since the queue was full */
+    uint32_t dropped;
+    /** Number of messages currently in the queue */
+    uint32_t depth;
+    /** Maximum number of messages in the queue at any point */
+    uint32_t max_depth;
+    /** Average time (in milliseconds) spent in the queue by the deferred messages which got published */
+    uint32_t avg_latency_ms;
+    /** Maximum time (in milliseconds) spent in the queue by a message which got published */
+    uint32_t max_latency_ms;
+} esp_rmaker_mqtt_prio_stats_t;
+
+/** MQTT publish queue statistics */
+typedef struct {
+    /** Statistics per priority class */
+    esp_rmaker_mqtt_prio_stats_t prio[RMAKER_MQTT_PRIO_MAX];
+    /** Bytes currently used by the queue */
+    size_t queued_bytes;
+} esp_rmaker_mqtt_queue_stats_t;
+
+/** Get the MQTT publish queue statistics
+ *
+ * @param[out] stats Pointer to a \ref esp_rmaker_mqtt_queue_stats_t structure to be filled.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE is not enabled.
+ * @return error in case of any other failure.
+ */
+esp_err_t esp_rmaker_mqtt_get_queue_stats(esp_rmaker_mqtt_queue_stats_t *stats);
+
+/** Limit the MQTT budget of a priority class
+ *
+ * By default, all the messages use a common budget, as per the CONFIG_ESP_RMAKER_MQTT_*_BUDGET* configuration.
+ * This gives the messages of the class published using esp_rmaker_mqtt_publish_with_prio() a separate budget
+ * as well, so that they cannot use more than their share of the common budget. Both the budgets are consumed
+ * by such messages. The class budget revives every CONFIG_ESP_RMAKER_MQTT_BUDGET_REVIVE_PERIOD seconds, like
+ * the common budget.
+ *
+ * @param[in] prio Priority class.
+ * @param[in] max_budget Maximum (and initial) budget of the class. 0 to remove the limit.
+ * @param[in] revive_count Budget added per revive period.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_RMAKER_MQTT_ENABLE_BUDGETING is not enabled.
+ * @return error in case of any other failure.
+ */
+esp_err_t esp_rmaker_mqtt_set_class_budget(esp_rmaker_mqtt_prio_t prio, uint16_t max_budget, uint16_t revive_count);
+
+/** MQTT budget statistics of a bucket */
+typedef struct {
+    /** Budget currently available. 0 if not limited. */
+    uint32_t budget;
+    /** Maximum budget. 0 if not limited. */
+    uint32_t max_budget;
+    /** Number of messages published */
+    uint32_t messages;
+    /** Budget consumed by the published messages */
+    uint32_t consumed;
+    /** Number of messages which could not be published for lack of budget */
+    uint32_t rejected;
+} esp_rmaker_mqtt_bucket_stats_t;
+
+/** MQTT budget statistics */
+typedef struct {
+    /** Common budget, used by all the messages */
+    esp_rmaker_mqtt_bucket_stats_t total;
+    /** Budget of each priority class, as set by esp_rmaker_mqtt_set_class_budget() */
+    esp_rmaker_mqtt_bucket_stats_t prio[RMAKER_MQTT_PRIO_MAX];
+    /** Bytes of data per unit of budget as per CONFIG_ESP_RMAKER_MQTT_BUDGET_BYTES_PER_UNIT. 0 if every
+     * message costs 1. */
+    uint32_t bytes_per_unit;
+} esp_rmaker_mqtt_budget_stats_t;
+
+/** Get the MQTT budget statistics
+ *
+ * @param[out] stats Pointer to a \ref esp_rmaker_mqtt_budget_stats_t structure to be filled.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_RMAKER_MQTT_ENABLE_BUDGETING is not enabled.
+ * @return error in case of any other failure.
+ */
+esp_err_t esp_rmaker_mqtt_get_budget_stats(esp_rmaker_mqtt_budget_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_rmaker_work_queue.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Priority lanes for the RainMaker work
+ *
+ * The work in a higher priority lane is always picked before that in the lower ones. With
+ * CONFIG_ESP_RMAKER_WORK_LANES_SECOND_WORKER, the high priority lane is also served by a second
+ * worker on the other core, so that it does not have to wait for a long running job in the other lanes.
+ */
+typedef enum {
+    /** Time critical work, like triggering schedules */
+    RMAKER_WORK_LANE_HIGH = 0,
+    /** Regular work, like reporting params */
+    RMAKER_WORK_LANE_NORMAL,
+    /** Background work, like flash writes and time series data */
+    RMAKER_WORK_LANE_LOW,
+    /** Number of lanes */
+    RMAKER_WORK_LANE_MAX,
+} esp_rmaker_work_lane_t;
+
+/** Number of buckets in the work lane histograms.
+ *
+ * Bucket 0 counts the jobs which took less than 1ms, and each subsequent bucket covers 4 times the
+ * duration of the earlier one, ie. <4ms, <16ms and so on. The last bucket counts all the longer ones.
+ */
+#define RMAKER_WORK_HIST_BUCKETS    8
+
+/** Statistics of a work lane */
+typedef struct {
+    /** Number of jobs run */
+    uint32_t jobs;
+    /** Number of jobs dropped, since the lane was full */
+    uint32_t dropped;
+    /** Number of jobs currently waiting in the lane */
+    uint32_t depth;
+    /** Maximum time (in microseconds) spent by a job in the lane before it started running */
+    uint32_t max_wait_us;
+    /** Maximum time (in microseconds) taken by a job to run */
+    uint32_t max_run_us;
+    /** Histogram of the time spent by the jobs in the lane before running */
+    uint32_t wait_hist[RMAKER_WORK_HIST_BUCKETS];
+    /** Histogram of the time taken by the jobs to run */
+    uint32_t run_hist[RMAKER_WORK_HIST_BUCKETS];
+} esp_rmaker_work_lane_stats_t;
+
+/** Work lanes statistics */
+typedef struct {
+    /** Statistics per lane */
+    esp_rmaker_work_lane_stats_t lane[RMAKER_WORK_LANE_MAX];
+    /** Number of workers */
+    uint8_t workers;
+} esp_rmaker_work_lanes_stats_t;
+
+/** Add work to a priority lane
+ *
+ * This is similar to esp_rmaker_work_queue_add_task(), but the work is executed as per the lane's priority.
+ * Work added before RainMaker is started gets executed once it starts. Work in the same lane is executed
+ * in the order in which it was added. If CONFIG_ESP_RMAKER_WORK_LANES is disabled, this is the same as
+ * esp_rmaker_work_queue_add_task().
+ *
+ * @param[in] lane The lane for the work.
+ * @param[in] work_fn The function to be executed.
+ * @param[in] priv_data Private data to be passed to the work function.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_work_lane_add_task(esp_rmaker_work_lane_t lane, esp_rmaker_work_fn_t work_fn, void *priv_data);
+
+/** Get the work lanes statistics
+ *
+ * @param[out] stats Pointer to a \ref esp_rmaker_work_lanes_stats_t structure to be filled.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_RMAKER_WORK_LANES is not enabled.
+ * @return error in case of any other failure.
+ */
+esp_err_t esp_rmaker_work_lanes_get_stats(esp_rmaker_work_lanes_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
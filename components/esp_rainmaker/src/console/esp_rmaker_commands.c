@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <ctype.h>
@@ -33,11 +34,16 @@
 #include <wifi_provisioning/manager.h>
 
 #include <esp_rmaker_core.h>
+#include <esp_rmaker_mqtt.h>
 #include <esp_rmaker_user_mapping.h>
 #include <esp_rmaker_utils.h>
 #include <esp_rmaker_cmd_resp.h>
+#include <esp_rmaker_work_lanes.h>
+#include <esp_rmaker_metrics.h>
 
 #include <esp_rmaker_console_internal.h>
+#include "esp_rmaker_bench.h"
+#include "esp_rmaker_trace.h"
 
 static const char *TAG = "esp_rmaker_commands";
 
@@ -428,6 +434,330 @@ static void register_cmd_resp_command()
     esp_console_cmd_register(&cmd_resp_cmd);
 }
 
+static int persist_stats_cli_handler(int argc, char *argv[])
+{
+    if ((argc == 2) && (strcmp(argv[1], "flush") == 0)) {
+        esp_rmaker_param_persist_flush();
+    }
+    esp_rmaker_param_persist_stats_t stats;
+    esp_rmaker_param_persist_get_stats(&stats);
+    printf("%s: Persistent param updates: %"PRIu32", NVS writes: %"PRIu32", NVS commits: %"PRIu32"\n",
+            TAG, stats.updates, stats.writes, stats.commits);
+    return 0;
+}
+
+static void register_persist_stats_command()
+{
+    const esp_console_cmd_t persist_stats_cmd = {
+        .command = "persist-stats",
+        .help = "Get the NVS write statistics of persistent params. Usage: persist-stats [flush]",
+        .func = &persist_stats_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", persist_stats_cmd.command);
+    esp_console_cmd_register(&persist_stats_cmd);
+}
+
+static int ts_stats_cli_handler(int argc, char *argv[])
+{
+    if ((argc == 2) && (strcmp(argv[1], "flush") == 0)) {
+        esp_rmaker_param_ts_flush();
+    }
+    esp_rmaker_param_ts_stats_t stats;
+    esp_rmaker_param_ts_get_stats(&stats);
+    printf("%s: Time series samples: %"PRIu32", reported: %"PRIu32", dropped: %"PRIu32", publishes: %"PRIu32
+            ", stored in flash: %"PRIu32", pending in flash: %"PRIu32", compressed: %"PRIu32"\n",
+            TAG, stats.samples, stats.records, stats.dropped, stats.publishes, stats.spilled, stats.spill_pending,
+            stats.compressed);
+    return 0;
+}
+
+static void register_ts_stats_command()
+{
+    const esp_console_cmd_t ts_stats_cmd = {
+        .command = "ts-stats",
+        .help = "Get the time series data statistics. Usage: ts-stats [flush]",
+        .func = &ts_stats_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", ts_stats_cmd.command);
+    esp_console_cmd_register(&ts_stats_cmd);
+}
+
+static const char *mqtt_prio_names[RMAKER_MQTT_PRIO_MAX] = {"alert", "ota", "cmd_resp", "params", "ts"};
+
+static int mqtt_queue_cli_handler(int argc, char *argv[])
+{
+    esp_rmaker_mqtt_queue_stats_t stats;
+    if (esp_rmaker_mqtt_get_queue_stats(&stats) != ESP_OK) {
+        printf("%s: MQTT publish queue not enabled.\n", TAG);
+        return 0;
+    }
+    printf("%s: MQTT publish queue: %d bytes\n", TAG, stats.queued_bytes);
+    for (int i = 0; i < RMAKER_MQTT_PRIO_MAX; i++) {
+        esp_rmaker_mqtt_prio_stats_t *prio = &stats.prio[i];
+        printf("%s: %-8s published: %"PRIu32", deferred: %"PRIu32", dropped: %"PRIu32", depth: %"PRIu32
+                " (max %"PRIu32"), latency: avg %"PRIu32" ms, max %"PRIu32" ms\n", TAG, mqtt_prio_names[i],
+                prio->published, prio->deferred, prio->dropped, prio->depth, prio->max_depth,
+                prio->avg_latency_ms, prio->max_latency_ms);
+    }
+    return 0;
+}
+
+static void register_mqtt_queue_command()
+{
+    const esp_console_cmd_t mqtt_queue_cmd = {
+        .command = "mqtt-queue",
+        .help = "Get the MQTT publish queue statistics.",
+        .func = &mqtt_queue_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", mqtt_queue_cmd.command);
+    esp_console_cmd_register(&mqtt_queue_cmd);
+}
+
+static void print_mqtt_bucket_stats(const char *name, esp_rmaker_mqtt_bucket_stats_t *bucket)
+{
+    if (bucket->max_budget) {
+        printf("%s: %-8s budget: %"PRIu32"/%"PRIu32", ", TAG, name, bucket->budget, bucket->max_budget);
+    } else {
+        printf("%s: %-8s budget: unlimited, ", TAG, name);
+    }
+    printf("messages: %"PRIu32", consumed: %"PRIu32", rejected: %"PRIu32"\n",
+            bucket->messages, bucket->consumed, bucket->rejected);
+}
+
+static int mqtt_budget_cli_handler(int argc, char *argv[])
+{
+    if (argc == 4) {
+        int prio;
+        for (prio = 0; prio < RMAKER_MQTT_PRIO_MAX; prio++) {
+            if (strcmp(argv[1], mqtt_prio_names[prio]) == 0) {
+                break;
+            }
+        }
+        if (prio == RMAKER_MQTT_PRIO_MAX) {
+            printf("%s: Invalid class %s.\n", TAG, argv[1]);
+            return -1;
+        }
+        if (esp_rmaker_mqtt_set_class_budget(prio, atoi(argv[2]), atoi(argv[3])) != ESP_OK) {
+            printf("%s: Failed to set the budget of %s.\n", TAG, argv[1]);
+            return -1;
+        }
+    } else if (argc != 1) {
+        printf("%s: Incorrect arguments\n", TAG);
+        return 0;
+    }
+    esp_rmaker_mqtt_budget_stats_t stats;
+    if (esp_rmaker_mqtt_get_budget_stats(&stats) != ESP_OK) {
+        printf("%s: MQTT budgeting not enabled.\n", TAG);
+        return 0;
+    }
+    if (stats.bytes_per_unit) {
+        printf("%s: MQTT budget cost: 1 per %"PRIu32" bytes\n", TAG, stats.bytes_per_unit);
+    } else {
+        printf("%s: MQTT budget cost: 1 per message\n", TAG);
+    }
+    print_mqtt_bucket_stats("total", &stats.total);
+    for (int i = 0; i < RMAKER_MQTT_PRIO_MAX; i++) {
+        print_mqtt_bucket_stats(mqtt_prio_names[i], &stats.prio[i]);
+    }
+    return 0;
+}
+
+static void register_mqtt_budget_command()
+{
+    const esp_console_cmd_t mqtt_budget_cmd = {
+        .command = "mqtt-budget",
+        .help = "Get the MQTT budget statistics, or limit the budget of a class. "
+                "Usage: mqtt-budget [<alert|ota|cmd_resp|params|ts> <max_budget> <revive_count>]",
+        .func = &mqtt_budget_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", mqtt_budget_cmd.command);
+    esp_console_cmd_register(&mqtt_budget_cmd);
+}
+
+static void mqtt_handler_stats_cb(const char *topic_suffix, const esp_rmaker_mqtt_handler_stats_t *stats,
+        void *priv_data)
+{
+    printf("%s: %-24s messages: %"PRIu32", latency: avg %"PRIu32" us, max %"PRIu32" us\n", TAG, topic_suffix,
+            stats->messages, stats->messages ? (uint32_t)(stats->total_us / stats->messages) : 0, stats->max_us);
+}
+
+static int mqtt_handlers_cli_handler(int argc, char *argv[])
+{
+    uint32_t unmatched = 0;
+    if (esp_rmaker_mqtt_get_handler_stats(mqtt_handler_stats_cb, NULL, &unmatched) != ESP_OK) {
+        printf("%s: No MQTT topic handlers registered.\n", TAG);
+        return 0;
+    }
+    printf("%s: Unmatched messages: %"PRIu32"\n", TAG, unmatched);
+    return 0;
+}
+
+static void register_mqtt_handlers_command()
+{
+    const esp_console_cmd_t mqtt_handlers_cmd = {
+        .command = "mqtt-handlers",
+        .help = "Get the statistics of the inbound MQTT topic handlers.",
+        .func = &mqtt_handlers_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", mqtt_handlers_cmd.command);
+    esp_console_cmd_register(&mqtt_handlers_cmd);
+}
+
+static void print_work_hist(const char *name, const uint32_t *hist)
+{
+    static const char *bucket_names[RMAKER_WORK_HIST_BUCKETS] = {
+        "<1ms", "<4ms", "<16ms", "<64ms", "<256ms", "<1s", "<4s", ">=4s"
+    };
+    printf("%s:   %-5s", TAG, name);
+    for (int i = 0; i < RMAKER_WORK_HIST_BUCKETS; i++) {
+        printf(" %s: %"PRIu32, bucket_names[i], hist[i]);
+    }
+    printf("\n");
+}
+
+static int work_lanes_cli_handler(int argc, char *argv[])
+{
+    static const char *lane_names[RMAKER_WORK_LANE_MAX] = {"high", "normal", "low"};
+    esp_rmaker_work_lanes_stats_t stats;
+    if (esp_rmaker_work_lanes_get_stats(&stats) != ESP_OK) {
+        printf("%s: Work lanes not enabled.\n", TAG);
+        return 0;
+    }
+    printf("%s: Work lanes workers: %d\n", TAG, stats.workers);
+    for (int i = 0; i < RMAKER_WORK_LANE_MAX; i++) {
+        esp_rmaker_work_lane_stats_t *lane = &stats.lane[i];
+        printf("%s: %-6s jobs: %"PRIu32", dropped: %"PRIu32", depth: %"PRIu32", max wait: %"PRIu32" us"
+                ", max run: %"PRIu32" us\n", TAG, lane_names[i], lane->jobs, lane->dropped, lane->depth,
+                lane->max_wait_us, lane->max_run_us);
+        print_work_hist("wait", lane->wait_hist);
+        print_work_hist("run", lane->run_hist);
+    }
+    return 0;
+}
+
+static void register_work_lanes_command()
+{
+    const esp_console_cmd_t work_lanes_cmd = {
+        .command = "work-lanes",
+        .help = "Get the queue wait and run time statistics of the RainMaker work lanes.",
+        .func = &work_lanes_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", work_lanes_cmd.command);
+    esp_console_cmd_register(&work_lanes_cmd);
+}
+
+static int metrics_cli_handler(int argc, char *argv[])
+{
+    char *metrics = esp_rmaker_metrics_get_json();
+    if (!metrics) {
+        printf("%s: Failed to get the metrics.\n", TAG);
+        return 0;
+    }
+    printf("%s: %s\n", TAG, metrics);
+    free(metrics);
+    if ((argc == 2) && (strcmp(argv[1], "report") == 0)) {
+        esp_err_t err = esp_rmaker_metrics_report();
+        printf("%s: Metrics report %s.\n", TAG, (err == ESP_OK) ? "published" : "failed");
+    }
+    return 0;
+}
+
+static void register_metrics_command()
+{
+    const esp_console_cmd_t metrics_cmd = {
+        .command = "metrics",
+        .help = "Print the runtime metrics, optionally reporting them as well. Usage: metrics [report]",
+        .func = &metrics_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", metrics_cmd.command);
+    esp_console_cmd_register(&metrics_cmd);
+}
+
+static int rmaker_trace_cli_handler(int argc, char *argv[])
+{
+#ifdef CONFIG_ESP_RMAKER_TRACE
+    esp_rmaker_trace_dump((argc == 2) && (strcmp(argv[1], "clear") == 0));
+#else
+    printf("%s: To use this utility enable: ESP RainMaker Config --> Trace the set params path\n", TAG);
+#endif
+    return 0;
+}
+
+static void register_rmaker_trace_command()
+{
+    const esp_console_cmd_t rmaker_trace_cmd = {
+        .command = "rmaker-trace",
+        .help = "Print the set params trace events as CSV, optionally clearing them. Usage: rmaker-trace [clear]",
+        .func = &rmaker_trace_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", rmaker_trace_cmd.command);
+    esp_console_cmd_register(&rmaker_trace_cmd);
+}
+
+#ifdef CONFIG_ESP_RMAKER_BENCH
+static int codec_bench_cli_handler(int argc, char *argv[])
+{
+    int iterations = (argc == 2) ? atoi(argv[1]) : 100;
+    if (esp_rmaker_bench_codec(iterations) != ESP_OK) {
+        printf("%s: Codec benchmark failed.\n", TAG);
+    }
+    return 0;
+}
+
+static int ts_bench_cli_handler(int argc, char *argv[])
+{
+    int num_samples = (argc >= 2) ? atoi(argv[1]) : 0;
+    int iterations = (argc >= 3) ? atoi(argv[2]) : 100;
+    if (esp_rmaker_bench_ts(num_samples, iterations) != ESP_OK) {
+        printf("%s: Time series benchmark failed.\n", TAG);
+    }
+    return 0;
+}
+
+static void register_ts_bench_command()
+{
+    const esp_console_cmd_t ts_bench_cmd = {
+        .command = "ts-bench",
+        .help = "Compare the standard and compact time series encodings. Usage: ts-bench [samples] [iterations]",
+        .func = &ts_bench_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", ts_bench_cmd.command);
+    esp_console_cmd_register(&ts_bench_cmd);
+}
+
+static void register_codec_bench_command()
+{
+    const esp_console_cmd_t codec_bench_cmd = {
+        .command = "codec-bench",
+        .help = "Compare the encoding and decoding of the node's params. Usage: codec-bench [iterations]",
+        .func = &codec_bench_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", codec_bench_cmd.command);
+    esp_console_cmd_register(&codec_bench_cmd);
+}
+static int rmaker_bench_cli_handler(int argc, char *argv[])
+{
+    int iterations = (argc >= 2) ? atoi(argv[1]) : 100;
+    int num_devices = (argc >= 3) ? atoi(argv[2]) : 0;
+    int num_params = (argc >= 4) ? atoi(argv[3]) : 0;
+    if (esp_rmaker_bench_run(num_devices, num_params, iterations) != ESP_OK) {
+        printf("%s: Benchmark failed.\n", TAG);
+    }
+    return 0;
+}
+
+static void register_rmaker_bench_command()
+{
+    const esp_console_cmd_t rmaker_bench_cmd = {
+        .command = "rmaker-bench",
+        .help = "Benchmark params and node config handling on synthetic nodes. "
+                "Usage: rmaker-bench [iterations] [devices] [params]",
+        .func = &rmaker_bench_cli_handler,
+    };
+    ESP_LOGI(TAG, "Registering command: %s", rmaker_bench_cmd.command);
+    esp_console_cmd_register(&rmaker_bench_cmd);
+}
+#endif /* CONFIG_ESP_RMAKER_BENCH */
 
 void register_commands()
 {
@@ -438,4 +768,17 @@ void register_commands()
     register_wifi_prov();
     register_time_commands();
     register_cmd_resp_command();
+    register_persist_stats_command();
+    register_ts_stats_command();
+    register_mqtt_queue_command();
+    register_mqtt_budget_command();
+    register_mqtt_handlers_command();
+    register_work_lanes_command();
+    register_metrics_command();
+    register_rmaker_trace_command();
+#ifdef CONFIG_ESP_RMAKER_BENCH
+    register_codec_bench_command();
+    register_ts_bench_command();
+    register_rmaker_bench_command();
+#endif
 }
@@ -0,0 +1,403 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <json_generator.h>
+
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_standard_types.h>
+
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_bench.h"
+
+static const char *TAG = "esp_rmaker_bench";
+
+/* Synthetic node sizes for esp_rmaker_bench_run(), when not specified explicitly */
+static const int s_bench_devices[] = {1, 8, 64};
+static const int s_bench_params[] = {1, 10, 50};
+
+#ifdef CONFIG_ESP_RMAKER_BENCH_COUNT_ALLOCS
+static volatile bool s_bench_counting;
+static uint32_t s_bench_allocs;
+static size_t s_bench_alloc_bytes;
+
+/* Heap hooks, as provided by CONFIG_HEAP_USE_HOOKS. Allocations from other tasks, made while
+ * a benchmark is running, get counted as well.
+ */
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (s_bench_counting) {
+        s_bench_allocs++;
+        s_bench_alloc_bytes += size;
+    }
+}
+
+void esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif /* CONFIG_ESP_RMAKER_BENCH_COUNT_ALLOCS */
+
+typedef esp_err_t (*esp_rmaker_bench_fn_t)(_esp_rmaker_node_t *node, void *arg);
+
+typedef struct {
+    char *buf;
+    size_t buf_size;
+    size_t len;
+} esp_rmaker_bench_buf_t;
+
+static int s_bench_params_decoded;
+
+static void esp_rmaker_bench_write_param(_esp_rmaker_device_t *device, _esp_rmaker_param_t *param,
+        esp_rmaker_param_val_t val, esp_rmaker_req_src_t src)
+{
+    s_bench_params_decoded++;
+}
+
+static esp_err_t esp_rmaker_bench_encoding(_esp_rmaker_node_t *node, int iterations, bool cbor)
+{
+    /* The JSON size is sufficient for CBOR as well, except for a few bytes per object/array param */
+    size_t buf_size = esp_rmaker_params_json_size(node, 0) + 64;
+    char *buf = malloc(buf_size);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t len = 0;
+    esp_err_t err = ESP_OK;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; (i < iterations) && (err == ESP_OK); i++) {
+        len = buf_size;
+        err = esp_rmaker_populate_params(node, buf, &len, 0, false, cbor);
+    }
+    int64_t encode_time = esp_timer_get_time() - start;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to encode params.");
+        free(buf);
+        return err;
+    }
+    s_bench_params_decoded = 0;
+    start = esp_timer_get_time();
+    for (int i = 0; (i < iterations) && (err == ESP_OK); i++) {
+        err = esp_rmaker_params_decode(node, buf, len, ESP_RMAKER_REQ_SRC_LOCAL, esp_rmaker_bench_write_param);
+    }
+    int64_t decode_time = esp_timer_get_time() - start;
+    free(buf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to decode params.");
+        return err;
+    }
+    printf("%s: %-4s: %5d bytes, encode: %6"PRId64" us/op, decode: %6"PRId64" us/op, %d params/op\n",
+            TAG, cbor ? "CBOR" : "JSON", len, encode_time / iterations, decode_time / iterations,
+            s_bench_params_decoded / iterations);
+    return ESP_OK;
+}
+
+/* Runs the function for the given iterations and prints the time, and if enabled, the heap
+ * allocations per iteration. Nothing is printed for ESP_ERR_INVALID_STATE, which indicates
+ * that the feature being benchmarked is not enabled.
+ */
+static esp_err_t esp_rmaker_bench_measure(const char *label, _esp_rmaker_node_t *node, int iterations,
+        esp_rmaker_bench_fn_t fn, void *arg)
+{
+    esp_err_t err = ESP_OK;
+#ifdef CONFIG_ESP_RMAKER_BENCH_COUNT_ALLOCS
+    s_bench_allocs = 0;
+    s_bench_alloc_bytes = 0;
+    s_bench_counting = true;
+#endif
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; (i < iterations) && (err == ESP_OK); i++) {
+        err = fn(node, arg);
+    }
+    int64_t total_time = esp_timer_get_time() - start;
+#ifdef CONFIG_ESP_RMAKER_BENCH_COUNT_ALLOCS
+    s_bench_counting = false;
+#endif
+    if (err == ESP_ERR_INVALID_STATE) {
+        return err;
+    } else if (err != ESP_OK) {
+        printf("%s: %-24s failed (%d)\n", TAG, label, err);
+        return err;
+    }
+#ifdef CONFIG_ESP_RMAKER_BENCH_COUNT_ALLOCS
+    printf("%s: %-24s %10"PRId64" ns/op %6"PRIu32" allocs/op %8d B/op\n", TAG, label,
+            total_time * 1000 / iterations, s_bench_allocs / iterations, s_bench_alloc_bytes / iterations);
+#else
+    printf("%s: %-24s %10"PRId64" ns/op\n", TAG, label, total_time * 1000 / iterations);
+#endif
+    return ESP_OK;
+}
+
+static esp_err_t esp_rmaker_bench_populate(_esp_rmaker_node_t *node, void *arg)
+{
+    esp_rmaker_bench_buf_t *bench_buf = (esp_rmaker_bench_buf_t *)arg;
+    bench_buf->len = bench_buf->buf_size;
+    return esp_rmaker_populate_params(node, bench_buf->buf, &bench_buf->len, 0, false, false);
+}
+
+static esp_err_t esp_rmaker_bench_set_params(_esp_rmaker_node_t *node, void *arg)
+{
+    esp_rmaker_bench_buf_t *bench_buf = (esp_rmaker_bench_buf_t *)arg;
+    return esp_rmaker_params_decode(node, bench_buf->buf, bench_buf->len, ESP_RMAKER_REQ_SRC_LOCAL,
+            esp_rmaker_bench_write_param);
+}
+
+/* Same as esp_rmaker_get_node_config(), with the size calculation followed by allocation and generation */
+static esp_err_t esp_rmaker_bench_node_config(_esp_rmaker_node_t *node, void *arg)
+{
+    int req_size = esp_rmaker_node_config_populate(node, NULL, 0);
+    if (req_size < 0) {
+        return ESP_FAIL;
+    }
+    char *node_config = calloc(1, req_size);
+    if (!node_config) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = (esp_rmaker_node_config_populate(node, node_config, req_size) < 0) ? ESP_FAIL : ESP_OK;
+    free(node_config);
+    return err;
+}
+
+static void esp_rmaker_bench_node_delete(_esp_rmaker_node_t *node)
+{
+    esp_rmaker_node_delete((esp_rmaker_node_t *)node);
+    esp_rmaker_model_free(node);
+}
+
+/* Creates a node, independent of the actual node, with the given number of devices, each having
+ * the given number of params, cycling through all the value types.
+ */
+static _esp_rmaker_node_t *esp_rmaker_bench_node_create(int num_devices, int num_params)
+{
+    _esp_rmaker_node_t *node = esp_rmaker_model_calloc(1, sizeof(_esp_rmaker_node_t));
+    if (!node) {
+        return NULL;
+    }
+    node->node_id = esp_rmaker_get_node_id();
+    node->info = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_node_info_t));
+    if (!node->info) {
+        goto bench_node_err;
+    }
+    node->info->name = esp_rmaker_model_strdup("Bench");
+    node->info->type = esp_rmaker_model_strdup("Benchmark");
+    node->info->fw_version = esp_rmaker_model_strdup("1.0");
+    node->info->model = esp_rmaker_model_strdup("bench");
+    if (!node->info->name || !node->info->type || !node->info->fw_version || !node->info->model) {
+        goto bench_node_err;
+    }
+    char name[16];
+    for (int d = 0; d < num_devices; d++) {
+        snprintf(name, sizeof(name), "Device %d", d);
+        esp_rmaker_device_t *device = esp_rmaker_device_create(name, ESP_RMAKER_DEVICE_OTHER, NULL);
+        if (!device) {
+            goto bench_node_err;
+        }
+        if (esp_rmaker_node_add_device((esp_rmaker_node_t *)node, device) != ESP_OK) {
+            esp_rmaker_device_delete(device);
+            goto bench_node_err;
+        }
+        for (int p = 0; p < num_params; p++) {
+            esp_rmaker_param_val_t val;
+            switch (p % 4) {
+                case 0:
+                    val = esp_rmaker_bool(true);
+                    break;
+                case 1:
+                    val = esp_rmaker_int(p);
+                    break;
+                case 2:
+                    val = esp_rmaker_float(p * 1.5);
+                    break;
+                default:
+                    val = esp_rmaker_str("benchmark");
+                    break;
+            }
+            snprintf(name, sizeof(name), "Param %d", p);
+            esp_rmaker_param_t *param = esp_rmaker_param_create(name, NULL, val, PROP_FLAG_READ | PROP_FLAG_WRITE);
+            if (!param) {
+                goto bench_node_err;
+            }
+            if (esp_rmaker_device_add_param(device, param) != ESP_OK) {
+                esp_rmaker_param_delete(param);
+                goto bench_node_err;
+            }
+        }
+    }
+    return node;
+bench_node_err:
+    esp_rmaker_bench_node_delete(node);
+    return NULL;
+}
+
+static esp_err_t esp_rmaker_bench_node(int num_devices, int num_params, int iterations)
+{
+    char label[32];
+    _esp_rmaker_node_t *node = esp_rmaker_bench_node_create(num_devices, num_params);
+    if (!node) {
+        printf("%s: %d devices x %d params: skipped, out of memory\n", TAG, num_devices, num_params);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_rmaker_bench_buf_t bench_buf = {
+        .buf_size = esp_rmaker_params_json_size(node, 0),
+    };
+    bench_buf.buf = malloc(bench_buf.buf_size);
+    if (!bench_buf.buf) {
+        esp_rmaker_bench_node_delete(node);
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(label, sizeof(label), "populate %dx%d", num_devices, num_params);
+    esp_err_t err = esp_rmaker_bench_measure(label, node, iterations, esp_rmaker_bench_populate, &bench_buf);
+    if (err == ESP_OK) {
+        /* The output of the populate benchmark is the input for the set params benchmark */
+        snprintf(label, sizeof(label), "set_params %dx%d", num_devices, num_params);
+        err = esp_rmaker_bench_measure(label, node, iterations, esp_rmaker_bench_set_params, &bench_buf);
+    }
+    if (err == ESP_OK) {
+        snprintf(label, sizeof(label), "node_config %dx%d", num_devices, num_params);
+        err = esp_rmaker_bench_measure(label, node, iterations, esp_rmaker_bench_node_config, NULL);
+    }
+    free(bench_buf.buf);
+    esp_rmaker_bench_node_delete(node);
+    return err;
+}
+
+esp_err_t esp_rmaker_bench_run(int num_devices, int num_params, int iterations)
+{
+    if (iterations <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((num_devices > 0) && (num_params > 0)) {
+        esp_rmaker_bench_node(num_devices, num_params, iterations);
+    } else {
+        for (int d = 0; d < sizeof(s_bench_devices) / sizeof(s_bench_devices[0]); d++) {
+            for (int p = 0; p < sizeof(s_bench_params) / sizeof(s_bench_params[0]); p++) {
+                esp_rmaker_bench_node(s_bench_devices[d], s_bench_params[p], iterations);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_bench_codec(int iterations)
+{
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        ESP_LOGE(TAG, "Node not initialized.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (iterations <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_rmaker_bench_encoding(node, iterations, false);
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (err == ESP_OK) {
+        err = esp_rmaker_bench_encoding(node, iterations, true);
+    }
+#endif
+    return err;
+}
+
+typedef struct {
+    esp_rmaker_param_val_t *vals;
+    time_t *t;
+} esp_rmaker_bench_ts_t;
+
+static const esp_rmaker_param_val_t *esp_rmaker_bench_ts_get(void *priv, uint16_t index, time_t *t)
+{
+    esp_rmaker_bench_ts_t *ts = (esp_rmaker_bench_ts_t *)priv;
+    *t = ts->t[index];
+    return &ts->vals[index];
+}
+
+/* Encodes the samples as a complete ts_data document and returns its length, or -1 on failure */
+static int esp_rmaker_bench_ts_encode(esp_rmaker_bench_ts_t *ts, esp_rmaker_val_type_t type, uint16_t count,
+        bool compact, char *buf, size_t buf_size)
+{
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, buf, buf_size, NULL, NULL);
+    json_gen_start_object(&jstr);
+    json_gen_obj_set_string(&jstr, "ts_data_version", TS_DATA_VERSION);
+    json_gen_push_array(&jstr, "ts_data");
+    esp_rmaker_ts_encode_records(&jstr, "Sensor.Temperature", type, count, esp_rmaker_bench_ts_get, ts, compact);
+    json_gen_pop_array(&jstr);
+    if (json_gen_end_object(&jstr) < 0) {
+        return -1;
+    }
+    return json_gen_str_end(&jstr);
+}
+
+/* Returns the length of the document in len_out */
+static esp_err_t esp_rmaker_bench_ts_format(esp_rmaker_bench_ts_t *ts, esp_rmaker_val_type_t type, uint16_t count,
+        int iterations, bool compact, int *len_out)
+{
+    int len = esp_rmaker_bench_ts_encode(ts, type, count, compact, NULL, 0);
+    char *buf = (len > 0) ? malloc(len) : NULL;
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        esp_rmaker_bench_ts_encode(ts, type, count, compact, buf, len);
+    }
+    int64_t total_time = esp_timer_get_time() - start;
+    free(buf);
+    printf("%s: %-5s %-8s %4d samples: %6d bytes %7.2f B/sample %8"PRId64" ns/sample\n", TAG,
+            (type == RMAKER_VAL_TYPE_FLOAT) ? "float" : "int", compact ? "compact" : "standard", count,
+            len, (float)len / count, total_time * 1000 / ((int64_t)iterations * count));
+    *len_out = len;
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_bench_ts(int num_samples, int iterations)
+{
+    static const int s_bench_ts_samples[] = {2, 16, 64, 256};
+    if ((iterations <= 0) || (num_samples < 0) || (num_samples > UINT16_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int max_samples = num_samples ? num_samples : s_bench_ts_samples[sizeof(s_bench_ts_samples) / sizeof(int) - 1];
+    esp_rmaker_bench_ts_t ts = {
+        .vals = calloc(max_samples, sizeof(esp_rmaker_param_val_t)),
+        .t = calloc(max_samples, sizeof(time_t)),
+    };
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (!ts.vals || !ts.t) {
+        goto end;
+    }
+    /* A periodic sensor, sampled every minute with occasional jitter */
+    for (esp_rmaker_val_type_t type = RMAKER_VAL_TYPE_INTEGER; type <= RMAKER_VAL_TYPE_FLOAT; type++) {
+        for (int i = 0; i < max_samples; i++) {
+            ts.t[i] = 1650000000 + (i * 60) + ((i % 7 == 3) ? 1 : 0);
+            float val = 21.5 + 2 * sinf(i / 20.0);
+            ts.vals[i] = (type == RMAKER_VAL_TYPE_FLOAT) ? esp_rmaker_float(val) : esp_rmaker_int((int)(val * 10));
+        }
+        for (int c = 0; c < sizeof(s_bench_ts_samples) / sizeof(int); c++) {
+            int count = num_samples ? num_samples : s_bench_ts_samples[c];
+            int standard_len, compact_len;
+            if (((err = esp_rmaker_bench_ts_format(&ts, type, count, iterations, false, &standard_len)) != ESP_OK) ||
+                    ((err = esp_rmaker_bench_ts_format(&ts, type, count, iterations, true, &compact_len)) != ESP_OK)) {
+                goto end;
+            }
+            /* Sizes of the complete ts_data documents, as published, including the fixed overheads */
+            printf("%s: %-5s %4d samples: compact is %.1f%% of standard\n", TAG,
+                    (type == RMAKER_VAL_TYPE_FLOAT) ? "float" : "int", count, 100.0 * compact_len / standard_len);
+            if (num_samples) {
+                break;
+            }
+        }
+    }
+end:
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Time series encoding benchmark failed.");
+    }
+    free(ts.vals);
+    free(ts.t);
+    return err;
+}
@@ -0,0 +1,28 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <esp_err.h>
+
+/* Compares the JSON and CBOR encoding of the params of the current node, by encoding and
+ * decoding all of them the given number of times, and prints the time taken and size.
+ * Decoding is a dry run, which does not invoke the write callbacks.
+ */
+esp_err_t esp_rmaker_bench_codec(int iterations);
+
+/* Benchmarks the params reporting, set params and node config generation paths on synthetic
+ * nodes with num_devices devices having num_params params each.
+ * If either of these is 0, a set of predefined node sizes is used. Synthetic nodes which do not
+ * fit in the available memory are skipped.
+ */
+esp_err_t esp_rmaker_bench_run(int num_devices, int num_params, int iterations);
+
+/* Compares the standard and compact encodings of batched time series records, for synthetic
+ * integer and float samples of a sensor sampled every minute, and prints the bytes and time per
+ * sample, measured on the complete ts_data document. If num_samples is 0, a set of predefined
+ * batch sizes is used.
+ */
+esp_err_t esp_rmaker_bench_ts(int num_samples, int iterations);
@@ -0,0 +1,276 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <string.h>
+#include <math.h>
+
+#include "esp_rmaker_cbor.h"
+
+#define CBOR_MAX_NESTING    16
+
+static void esp_rmaker_cbor_enc_bytes(esp_rmaker_cbor_enc_t *enc, const void *data, size_t len)
+{
+    if (enc->buf && (enc->len + len <= enc->size)) {
+        memcpy(enc->buf + enc->len, data, len);
+    } else {
+        /* Once the buffer overflows, nothing more gets written, but the length is still tracked */
+        enc->size = 0;
+    }
+    enc->len += len;
+}
+
+static void esp_rmaker_cbor_enc_head(esp_rmaker_cbor_enc_t *enc, uint8_t major, uint64_t val)
+{
+    uint8_t head[9];
+    size_t head_len;
+    major <<= 5;
+    if (val < 24) {
+        head[0] = major | val;
+        head_len = 1;
+    } else if (val <= UINT8_MAX) {
+        head[0] = major | 24;
+        head[1] = val;
+        head_len = 2;
+    } else if (val <= UINT16_MAX) {
+        head[0] = major | 25;
+        head[1] = val >> 8;
+        head[2] = val;
+        head_len = 3;
+    } else if (val <= UINT32_MAX) {
+        head[0] = major | 26;
+        for (int i = 0; i < 4; i++) {
+            head[1 + i] = val >> (24 - 8 * i);
+        }
+        head_len = 5;
+    } else {
+        head[0] = major | 27;
+        for (int i = 0; i < 8; i++) {
+            head[1 + i] = val >> (56 - 8 * i);
+        }
+        head_len = 9;
+    }
+    esp_rmaker_cbor_enc_bytes(enc, head, head_len);
+}
+
+void esp_rmaker_cbor_enc_init(esp_rmaker_cbor_enc_t *enc, uint8_t *buf, size_t size)
+{
+    enc->buf = buf;
+    enc->size = buf ? size : 0;
+    enc->len = 0;
+}
+
+/* Maps are always encoded with indefinite length, so that the entries need not be counted upfront */
+void esp_rmaker_cbor_enc_map_start(esp_rmaker_cbor_enc_t *enc)
+{
+    uint8_t byte = (CBOR_MAJOR_MAP << 5) | CBOR_INDEFINITE;
+    esp_rmaker_cbor_enc_bytes(enc, &byte, 1);
+}
+
+void esp_rmaker_cbor_enc_map_end(esp_rmaker_cbor_enc_t *enc)
+{
+    uint8_t byte = CBOR_BREAK;
+    esp_rmaker_cbor_enc_bytes(enc, &byte, 1);
+}
+
+void esp_rmaker_cbor_enc_text(esp_rmaker_cbor_enc_t *enc, const char *str, size_t len)
+{
+    esp_rmaker_cbor_enc_head(enc, CBOR_MAJOR_TEXT, len);
+    esp_rmaker_cbor_enc_bytes(enc, str, len);
+}
+
+void esp_rmaker_cbor_enc_int(esp_rmaker_cbor_enc_t *enc, int64_t val)
+{
+    if (val >= 0) {
+        esp_rmaker_cbor_enc_head(enc, CBOR_MAJOR_UINT, val);
+    } else {
+        esp_rmaker_cbor_enc_head(enc, CBOR_MAJOR_NINT, -1 - val);
+    }
+}
+
+void esp_rmaker_cbor_enc_float(esp_rmaker_cbor_enc_t *enc, float val)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    uint8_t buf[5] = {
+        (CBOR_MAJOR_SIMPLE << 5) | CBOR_SIMPLE_FLOAT32,
+        bits >> 24, bits >> 16, bits >> 8, bits
+    };
+    esp_rmaker_cbor_enc_bytes(enc, buf, sizeof(buf));
+}
+
+void esp_rmaker_cbor_enc_bool(esp_rmaker_cbor_enc_t *enc, bool val)
+{
+    uint8_t byte = (CBOR_MAJOR_SIMPLE << 5) | (val ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE);
+    esp_rmaker_cbor_enc_bytes(enc, &byte, 1);
+}
+
+void esp_rmaker_cbor_enc_null(esp_rmaker_cbor_enc_t *enc)
+{
+    uint8_t byte = (CBOR_MAJOR_SIMPLE << 5) | CBOR_SIMPLE_NULL;
+    esp_rmaker_cbor_enc_bytes(enc, &byte, 1);
+}
+
+void esp_rmaker_cbor_enc_tag(esp_rmaker_cbor_enc_t *enc, uint64_t tag)
+{
+    esp_rmaker_cbor_enc_head(enc, CBOR_MAJOR_TAG, tag);
+}
+
+esp_err_t esp_rmaker_cbor_enc_finish(esp_rmaker_cbor_enc_t *enc)
+{
+    return (enc->buf && enc->size) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void esp_rmaker_cbor_dec_init(esp_rmaker_cbor_dec_t *dec, const uint8_t *buf, size_t len)
+{
+    dec->buf = buf;
+    dec->len = len;
+    dec->pos = 0;
+}
+
+static esp_err_t esp_rmaker_cbor_dec_uint(esp_rmaker_cbor_dec_t *dec, size_t size, uint64_t *val)
+{
+    if (size > dec->len - dec->pos) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *val = 0;
+    for (size_t i = 0; i < size; i++) {
+        *val = (*val << 8) | dec->buf[dec->pos++];
+    }
+    return ESP_OK;
+}
+
+static double esp_rmaker_cbor_half_to_double(uint16_t half)
+{
+    int exp = (half >> 10) & 0x1f;
+    int mant = half & 0x3ff;
+    double val;
+    if (exp == 0) {
+        val = ldexp(mant, -24);
+    } else if (exp != 31) {
+        val = ldexp(mant + 1024, exp - 25);
+    } else {
+        val = mant == 0 ? INFINITY : NAN;
+    }
+    return (half & 0x8000) ? -val : val;
+}
+
+esp_err_t esp_rmaker_cbor_dec_next(esp_rmaker_cbor_dec_t *dec, esp_rmaker_cbor_item_t *item)
+{
+    if (dec->pos >= dec->len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(item, 0, sizeof(esp_rmaker_cbor_item_t));
+    uint8_t byte = dec->buf[dec->pos++];
+    item->major = byte >> 5;
+    item->info = byte & 0x1f;
+    esp_err_t err = ESP_OK;
+    if (item->info < 24) {
+        item->val = item->info;
+    } else if (item->info <= 27) {
+        err = esp_rmaker_cbor_dec_uint(dec, 1 << (item->info - 24), &item->val);
+    } else if (item->info == CBOR_INDEFINITE) {
+        if ((item->major == CBOR_MAJOR_UINT) || (item->major == CBOR_MAJOR_NINT) || (item->major == CBOR_MAJOR_TAG)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        item->indefinite = true;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    switch (item->major) {
+        case CBOR_MAJOR_BYTES:
+        case CBOR_MAJOR_TEXT:
+            if (!item->indefinite) {
+                if (item->val > dec->len - dec->pos) {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                item->data = dec->buf + dec->pos;
+                dec->pos += item->val;
+            }
+            break;
+        case CBOR_MAJOR_SIMPLE:
+            if (item->info == CBOR_SIMPLE_FLOAT16) {
+                item->f = esp_rmaker_cbor_half_to_double(item->val);
+            } else if (item->info == CBOR_SIMPLE_FLOAT32) {
+                uint32_t bits = item->val;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                item->f = f;
+            } else if (item->info == CBOR_SIMPLE_FLOAT64) {
+                memcpy(&item->f, &item->val, sizeof(item->f));
+            }
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+bool esp_rmaker_cbor_dec_has_more(esp_rmaker_cbor_dec_t *dec, const esp_rmaker_cbor_item_t *container, uint64_t index)
+{
+    if (!container->indefinite) {
+        uint64_t count = (container->major == CBOR_MAJOR_MAP) ? container->val * 2 : container->val;
+        return index < count;
+    }
+    if (dec->pos >= dec->len) {
+        return false;
+    }
+    if (dec->buf[dec->pos] == CBOR_BREAK) {
+        dec->pos++;
+        return false;
+    }
+    return true;
+}
+
+static esp_err_t esp_rmaker_cbor_dec_skip_nested(esp_rmaker_cbor_dec_t *dec, const esp_rmaker_cbor_item_t *item, int depth)
+{
+    if (depth > CBOR_MAX_NESTING) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_rmaker_cbor_item_t child;
+    esp_err_t err = ESP_OK;
+    switch (item->major) {
+        case CBOR_MAJOR_BYTES:
+        case CBOR_MAJOR_TEXT:
+            /* Indefinite length strings are a sequence of definite length chunks */
+            if (item->indefinite) {
+                while (esp_rmaker_cbor_dec_has_more(dec, item, 0)) {
+                    if ((err = esp_rmaker_cbor_dec_next(dec, &child)) != ESP_OK) {
+                        return err;
+                    }
+                    if ((child.major != item->major) || child.indefinite) {
+                        return ESP_ERR_INVALID_ARG;
+                    }
+                }
+            }
+            break;
+        case CBOR_MAJOR_ARRAY:
+        case CBOR_MAJOR_MAP:
+            for (uint64_t i = 0; esp_rmaker_cbor_dec_has_more(dec, item, i); i++) {
+                if ((err = esp_rmaker_cbor_dec_next(dec, &child)) != ESP_OK) {
+                    return err;
+                }
+                if ((err = esp_rmaker_cbor_dec_skip_nested(dec, &child, depth + 1)) != ESP_OK) {
+                    return err;
+                }
+            }
+            break;
+        case CBOR_MAJOR_TAG:
+            if ((err = esp_rmaker_cbor_dec_next(dec, &child)) != ESP_OK) {
+                return err;
+            }
+            return esp_rmaker_cbor_dec_skip_nested(dec, &child, depth + 1);
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_cbor_dec_skip(esp_rmaker_cbor_dec_t *dec, const esp_rmaker_cbor_item_t *item)
+{
+    return esp_rmaker_cbor_dec_skip_nested(dec, item, 0);
+}
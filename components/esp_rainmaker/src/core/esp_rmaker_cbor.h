@@ -0,0 +1,87 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/* Minimal CBOR (RFC 8949) encoder and decoder, covering just what is required for the params
+ * i.e. maps, text strings, integers, floats, booleans, null and tags.
+ */
+
+#define CBOR_MAJOR_UINT         0
+#define CBOR_MAJOR_NINT         1
+#define CBOR_MAJOR_BYTES        2
+#define CBOR_MAJOR_TEXT         3
+#define CBOR_MAJOR_ARRAY        4
+#define CBOR_MAJOR_MAP          5
+#define CBOR_MAJOR_TAG          6
+#define CBOR_MAJOR_SIMPLE       7
+
+#define CBOR_SIMPLE_FALSE       20
+#define CBOR_SIMPLE_TRUE        21
+#define CBOR_SIMPLE_NULL        22
+#define CBOR_SIMPLE_FLOAT16     25
+#define CBOR_SIMPLE_FLOAT32     26
+#define CBOR_SIMPLE_FLOAT64     27
+#define CBOR_INDEFINITE         31
+#define CBOR_BREAK              0xff
+
+/* IANA registered tag for embedded JSON, used for object and array params */
+#define CBOR_TAG_EMBEDDED_JSON  262
+
+/* Returns true if the data looks like a CBOR map, as against a JSON object */
+#define CBOR_IS_MAP(byte)       (((uint8_t)(byte) >> 5) == CBOR_MAJOR_MAP)
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    /* Bytes required so far. Can be more than size, in which case only size bytes have been written */
+    size_t len;
+} esp_rmaker_cbor_enc_t;
+
+void esp_rmaker_cbor_enc_init(esp_rmaker_cbor_enc_t *enc, uint8_t *buf, size_t size);
+void esp_rmaker_cbor_enc_map_start(esp_rmaker_cbor_enc_t *enc);
+void esp_rmaker_cbor_enc_map_end(esp_rmaker_cbor_enc_t *enc);
+void esp_rmaker_cbor_enc_text(esp_rmaker_cbor_enc_t *enc, const char *str, size_t len);
+void esp_rmaker_cbor_enc_int(esp_rmaker_cbor_enc_t *enc, int64_t val);
+void esp_rmaker_cbor_enc_float(esp_rmaker_cbor_enc_t *enc, float val);
+void esp_rmaker_cbor_enc_bool(esp_rmaker_cbor_enc_t *enc, bool val);
+void esp_rmaker_cbor_enc_null(esp_rmaker_cbor_enc_t *enc);
+void esp_rmaker_cbor_enc_tag(esp_rmaker_cbor_enc_t *enc, uint64_t tag);
+/* Returns ESP_ERR_NO_MEM if the buffer was insufficient. enc->len is then the size required. */
+esp_err_t esp_rmaker_cbor_enc_finish(esp_rmaker_cbor_enc_t *enc);
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} esp_rmaker_cbor_dec_t;
+
+typedef struct {
+    uint8_t major;
+    /* The additional information in the initial byte */
+    uint8_t info;
+    /* Integer value, length of text/bytes, count of array/map entries or the tag */
+    uint64_t val;
+    bool indefinite;
+    /* Start of the contents, for definite length text and bytes */
+    const uint8_t *data;
+    /* Value, for floats */
+    double f;
+} esp_rmaker_cbor_item_t;
+
+void esp_rmaker_cbor_dec_init(esp_rmaker_cbor_dec_t *dec, const uint8_t *buf, size_t len);
+/* Reads the header of the next item. The contents of definite length text and bytes are consumed as well,
+ * but the entries of arrays/maps and the item following a tag are not.
+ */
+esp_err_t esp_rmaker_cbor_dec_next(esp_rmaker_cbor_dec_t *dec, esp_rmaker_cbor_item_t *item);
+/* Skips whatever of the item, as read by esp_rmaker_cbor_dec_next(), has not been consumed */
+esp_err_t esp_rmaker_cbor_dec_skip(esp_rmaker_cbor_dec_t *dec, const esp_rmaker_cbor_item_t *item);
+/* For iterating over arrays/maps. Returns true if there are more entries, consuming the break, if any. */
+bool esp_rmaker_cbor_dec_has_more(esp_rmaker_cbor_dec_t *dec, const esp_rmaker_cbor_item_t *container, uint64_t index);
@@ -36,19 +36,15 @@ esp_err_t esp_rmaker_test_cmd_resp(const void *cmd, size_t cmd_len, void *priv_d
         ESP_LOGE(TAG, "No command data to send.");
         return ESP_ERR_INVALID_ARG;
     }
-    char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-    snprintf(publish_topic, sizeof(publish_topic), "node/%s/%s", esp_rmaker_get_node_id(), TO_NODE_TOPIC_SUFFIX);
-    return esp_rmaker_mqtt_publish(publish_topic, (void *)cmd, cmd_len, RMAKER_MQTT_QOS1, NULL);
+    return esp_rmaker_mqtt_publish(esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_TO_NODE), (void *)cmd, cmd_len,
+            RMAKER_MQTT_QOS1, NULL);
 }
 
 static esp_err_t esp_rmaker_cmd_resp_test_enable(void)
 {
-    char subscribe_topic[100];
-    snprintf(subscribe_topic, sizeof(subscribe_topic), "node/%s/%s",
-                esp_rmaker_get_node_id(), CMD_RESP_TOPIC_SUFFIX);
-    esp_err_t err = esp_rmaker_mqtt_subscribe(subscribe_topic, esp_rmaker_resp_callback, RMAKER_MQTT_QOS1, NULL);
+    esp_err_t err = esp_rmaker_mqtt_node_subscribe(CMD_RESP_TOPIC_SUFFIX, esp_rmaker_resp_callback, RMAKER_MQTT_QOS1, NULL);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", subscribe_topic, err);
+        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", CMD_RESP_TOPIC_SUFFIX, err);
         return ESP_FAIL;
     }
     ESP_LOGI(TAG, "Command-Response test support enabled.");
@@ -74,9 +70,10 @@ static void esp_rmaker_cmd_callback(const char *topic, void *payload, size_t pay
      */
     if (esp_rmaker_cmd_response_handler(payload, payload_len, &output, &output_len) == ESP_OK) {
         if (output) {
-            char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-            esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), CMD_RESP_TOPIC_SUFFIX, CMD_RESP_TOPIC_RULE);
-            if (esp_rmaker_mqtt_publish(publish_topic, output, output_len, RMAKER_MQTT_QOS1, NULL) != ESP_OK) {
+            const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_CMD_RESP);
+            esp_err_t err = esp_rmaker_mqtt_publish_with_prio(publish_topic, output, output_len, RMAKER_MQTT_QOS1,
+                        RMAKER_MQTT_PRIO_CMD_RESP);
+            if ((err != ESP_OK) && (err != ESP_ERR_NOT_FINISHED)) {
                 ESP_LOGE(TAG, "Failed to publish reponse.");
             }
             free(output);
@@ -89,12 +86,9 @@ static void esp_rmaker_cmd_callback(const char *topic, void *payload, size_t pay
 esp_err_t esp_rmaker_cmd_response_enable(void)
 {
     ESP_LOGI(TAG, "Enabling Command-Response Module.");
-    char subscribe_topic[100];
-    snprintf(subscribe_topic, sizeof(subscribe_topic), "node/%s/%s",
-                esp_rmaker_get_node_id(), TO_NODE_TOPIC_SUFFIX);
-    esp_err_t err = esp_rmaker_mqtt_subscribe(subscribe_topic, esp_rmaker_cmd_callback, RMAKER_MQTT_QOS1, NULL);
+    esp_err_t err = esp_rmaker_mqtt_node_subscribe(TO_NODE_TOPIC_SUFFIX, esp_rmaker_cmd_callback, RMAKER_MQTT_QOS1, NULL);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", subscribe_topic, err);
+        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", TO_NODE_TOPIC_SUFFIX, err);
         return ESP_FAIL;
     }
 #ifdef CONFIG_ESP_RMAKER_CMD_RESP_TEST_ENABLE
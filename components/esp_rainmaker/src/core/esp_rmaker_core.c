@@ -29,7 +29,11 @@
 #include <esp_rmaker_user_mapping.h>
 #include <esp_rmaker_utils.h>
 #include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_model_lock.h"
+#include "esp_rmaker_metrics_internal.h"
 #include "esp_rmaker_mqtt.h"
+#include "esp_rmaker_mqtt_topics.h"
 #include "esp_rmaker_claim.h"
 #include "esp_rmaker_client_data.h"
 
@@ -129,6 +133,11 @@ esp_err_t esp_rmaker_change_node_id(char *node_id, size_t len)
         esp_rmaker_priv_data->node_id = new_node_id;
         _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
         node->node_id = new_node_id;
+        esp_rmaker_node_config_invalidate();
+        esp_err_t err = esp_rmaker_mqtt_topics_init(new_node_id);
+        if (err != ESP_OK) {
+            return err;
+        }
         ESP_LOGI(TAG, "New Node ID ----- %s", new_node_id);
         return ESP_OK;
     }
@@ -171,6 +180,7 @@ static esp_err_t esp_rmaker_deinit_priv_data(esp_rmaker_priv_data_t *rmaker_priv
         return ESP_ERR_INVALID_ARG;
     }
     esp_rmaker_work_queue_deinit();
+    esp_rmaker_work_lanes_deinit();
 #ifndef CONFIG_ESP_RMAKER_DISABLE_USER_MAPPING_PROV
     esp_rmaker_user_mapping_prov_deinit();
 #endif
@@ -186,6 +196,7 @@ static esp_err_t esp_rmaker_deinit_priv_data(esp_rmaker_priv_data_t *rmaker_priv
     if (rmaker_priv_data->node_id) {
         free(rmaker_priv_data->node_id);
     }
+    esp_rmaker_mqtt_topics_deinit();
     free(rmaker_priv_data);
     return ESP_OK;
 }
@@ -202,6 +213,7 @@ esp_err_t esp_rmaker_node_deinit(const esp_rmaker_node_t *node)
         return ESP_ERR_INVALID_STATE;
     }
     esp_rmaker_node_delete(node);
+    esp_rmaker_node_config_cache_free();
     esp_rmaker_priv_data->node = NULL;
     esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
     esp_rmaker_priv_data = NULL;
@@ -233,6 +245,8 @@ static esp_err_t esp_rmaker_report_node_config_and_state()
 
 static void __esp_rmaker_report_node_config_and_state(void *data)
 {
+    /* Explicitly requested, and so reported even if the node config is the same as the last reported one */
+    esp_rmaker_node_config_clear_hash();
     esp_rmaker_report_node_config_and_state();
 }
 
@@ -442,6 +456,9 @@ static esp_err_t esp_rmaker_init(const esp_rmaker_config_t *config, bool use_cla
         ESP_LOGE(TAG, "Failed to initialise storage");
         return ESP_FAIL;
     }
+    if ((esp_rmaker_model_lock_init() != ESP_OK) || (esp_rmaker_model_alloc_init() != ESP_OK)) {
+        return ESP_ERR_NO_MEM;
+    }
     esp_rmaker_priv_data = calloc(1, sizeof(esp_rmaker_priv_data_t));
     if (!esp_rmaker_priv_data) {
         ESP_LOGE(TAG, "Failed to allocate memory");
@@ -455,6 +472,11 @@ static esp_err_t esp_rmaker_init(const esp_rmaker_config_t *config, bool use_cla
         ESP_LOGE(TAG, "Failed to initialise Node Id. Please perform \"claiming\" using RainMaker CLI.");
         return ESP_ERR_NO_MEM;
     }
+    if (esp_rmaker_mqtt_topics_init(esp_rmaker_priv_data->node_id) != ESP_OK) {
+        esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
+        esp_rmaker_priv_data = NULL;
+        return ESP_ERR_NO_MEM;
+    }
 
     if (esp_rmaker_work_queue_init() != ESP_OK) {
         esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
@@ -462,6 +484,19 @@ static esp_err_t esp_rmaker_init(const esp_rmaker_config_t *config, bool use_cla
         ESP_LOGE(TAG, "ESP RainMaker Queue Creation Failed");
         return ESP_ERR_NO_MEM;
     }
+    if (esp_rmaker_work_lanes_init() != ESP_OK) {
+        esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
+        esp_rmaker_priv_data = NULL;
+        ESP_LOGE(TAG, "ESP RainMaker Work Lanes Creation Failed");
+        return ESP_ERR_NO_MEM;
+    }
+    if ((esp_rmaker_ts_batch_init() != ESP_OK) || (esp_rmaker_params_report_init() != ESP_OK)) {
+        esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
+        esp_rmaker_priv_data = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    /* Not fatal. The metrics are still maintained, if the periodic reporting could not be started */
+    esp_rmaker_metrics_init();
 #ifndef CONFIG_ESP_RMAKER_DISABLE_USER_MAPPING_PROV
     if (esp_rmaker_user_mapping_prov_init()) {
         esp_rmaker_deinit_priv_data(esp_rmaker_priv_data);
@@ -547,6 +582,8 @@ const esp_rmaker_node_t *esp_rmaker_get_node()
 esp_err_t esp_rmaker_start(void)
 {
     ESP_RMAKER_CHECK_HANDLE(ESP_ERR_INVALID_STATE);
+    /* The node data model is expected to have been created by now */
+    esp_rmaker_model_freeze();
     if (esp_rmaker_priv_data->enable_time_sync) {
         esp_rmaker_time_sync_init(NULL);
     }
@@ -555,6 +592,14 @@ esp_err_t esp_rmaker_start(void)
         ESP_LOGE(TAG, "Couldn't create RainMaker Work Queue task");
         return ESP_FAIL;
     }
+    if (esp_rmaker_work_lanes_start() != ESP_OK) {
+        ESP_LOGE(TAG, "Couldn't create RainMaker Work Lanes task");
+        return ESP_FAIL;
+    }
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+    /* Not fatal. Time series data just gets dropped instead of being stored, if the partition is unusable */
+    esp_rmaker_ts_spill_init();
+#endif
     ESP_ERROR_CHECK(esp_event_handler_register(RMAKER_COMMON_EVENT, ESP_EVENT_ANY_ID, &reset_event_handler, NULL));
     return ESP_OK;
 }
@@ -19,6 +19,8 @@
 #include <esp_rmaker_standard_types.h>
 
 #include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_model_lock.h"
 
 static const char *TAG = "esp_rmaker_device";
 
@@ -42,18 +44,20 @@ esp_err_t esp_rmaker_device_delete(const esp_rmaker_device_t *device)
             esp_rmaker_param_delete((esp_rmaker_param_t *)param);
             param = next_param;
         }
+        esp_rmaker_name_index_free(&_device->param_index);
+        if (_device->param_array) {
+            esp_rmaker_model_free(_device->param_array);
+        }
         if (_device->subtype) {
-            free(_device->subtype);
+            esp_rmaker_model_free(_device->subtype);
         }
         if (_device->model) {
-            free(_device->model);
+            esp_rmaker_model_free(_device->model);
         }
         if (_device->name) {
-            free(_device->name);
-        }
-        if (_device->type) {
-            free(_device->type);
+            esp_rmaker_model_free(_device->name);
         }
+        esp_rmaker_model_free(_device);
         return ESP_OK;
     }
     return ESP_ERR_INVALID_ARG;
@@ -65,18 +69,18 @@ static esp_rmaker_device_t *__esp_rmaker_device_create(const char *name, const c
         ESP_LOGE(TAG, "%s name is mandatory", is_service ? "Service":"Device");
         return NULL;
     }
-    _esp_rmaker_device_t *_device = calloc(1, sizeof(_esp_rmaker_device_t));
+    _esp_rmaker_device_t *_device = esp_rmaker_model_calloc(1, sizeof(_esp_rmaker_device_t));
     if (!_device) {
         ESP_LOGE(TAG, "Failed to allocate memory for %s %s", is_service ? "Service":"Device", name);
         return NULL;
     }
-    _device->name = strdup(name);
+    _device->name = esp_rmaker_model_strdup(name);
     if (!_device->name) {
         ESP_LOGE(TAG, "Failed to allocate memory for name for %s %s", is_service ? "Service":"Device", name);
         goto device_create_err;
     }
     if (type) {
-        _device->type = strdup(type);
+        _device->type = esp_rmaker_model_intern(type);
         if (!_device->type) {
             ESP_LOGE(TAG, "Failed to allocate memory for type for %s %s", is_service ? "Service":"Device", name);
             goto device_create_err;
@@ -101,15 +105,9 @@ esp_rmaker_device_t *esp_rmaker_service_create(const char *name, const char *typ
     return __esp_rmaker_device_create(name, type, priv, true);
 }
 
-esp_err_t esp_rmaker_device_add_param(const esp_rmaker_device_t *device, const esp_rmaker_param_t *param)
+/* Links the param into the device. Should be called with the model write lock held. */
+static esp_err_t __esp_rmaker_device_add_param(_esp_rmaker_device_t *_device, _esp_rmaker_param_t *_new_param)
 {
-    if (!device || !param) {
-        ESP_LOGE(TAG, "Device or Param handle cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
-    }
-    _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
-    _esp_rmaker_param_t *_new_param = (_esp_rmaker_param_t *)param;
-
     _esp_rmaker_param_t *_param = _device->params;
     while(_param) {
         if (strcmp(_param->name, _new_param->name) == 0) {
@@ -122,12 +120,58 @@ esp_err_t esp_rmaker_device_add_param(const esp_rmaker_device_t *device, const e
             break;
         }
     }
+    if (_device->param_count == _device->param_array_size) {
+        uint16_t new_size = _device->param_array_size ? _device->param_array_size * 2 : 4;
+        /* The model allocator has no realloc. The array is grown by doubling, so the arena space left
+         * behind by the older arrays is less than the size of the final one.
+         */
+        _esp_rmaker_param_t **new_array = esp_rmaker_model_calloc(new_size, sizeof(_esp_rmaker_param_t *));
+        if (!new_array) {
+            ESP_LOGE(TAG, "Failed to allocate memory for params of Device %s", _device->name);
+            return ESP_ERR_NO_MEM;
+        }
+        if (_device->param_array) {
+            memcpy(new_array, _device->param_array, _device->param_count * sizeof(_esp_rmaker_param_t *));
+            esp_rmaker_model_free(_device->param_array);
+        }
+        _device->param_array = new_array;
+        _device->param_array_size = new_size;
+    }
+    if (esp_rmaker_name_index_add(&_device->param_index, _new_param->name, _new_param) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to index parameter %s in Device %s", _new_param->name, _device->name);
+        return ESP_ERR_NO_MEM;
+    }
+    _device->param_array[_device->param_count++] = _new_param;
     _new_param->parent = _device;
     if (_param) {
         _param->next = _new_param;
     } else {
         _device->params = _new_param;
     }
+    _device->params_json_len += _new_param->json_len;
+    esp_rmaker_node_config_invalidate();
+    /* The param may have been updated even before it was added to the device */
+    if (_new_param->flags) {
+        esp_rmaker_device_mark_dirty(_device, _new_param->flags);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_device_add_param(const esp_rmaker_device_t *device, const esp_rmaker_param_t *param)
+{
+    if (!device || !param) {
+        ESP_LOGE(TAG, "Device or Param handle cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
+    _esp_rmaker_param_t *_new_param = (_esp_rmaker_param_t *)param;
+
+    esp_rmaker_model_wrlock();
+    esp_err_t err = __esp_rmaker_device_add_param(_device, _new_param);
+    esp_rmaker_model_wrunlock();
+    if (err != ESP_OK) {
+        return err;
+    }
     /* We check the stored value here, and not during param creation, because a parameter
      * in itself isn't unique. However, it is unique within a given device and hence can
      * be uniquely represented in storage only when added to a device.
@@ -136,13 +180,17 @@ esp_err_t esp_rmaker_device_add_param(const esp_rmaker_device_t *device, const e
     stored_val.type = _new_param->val.type;
     if (_new_param->prop_flags & PROP_FLAG_PERSIST) {
         if (esp_rmaker_param_get_stored_value(_new_param, &stored_val) == ESP_OK) {
+            esp_rmaker_model_wrlock();
             if ((_new_param->val.type == RMAKER_VAL_TYPE_STRING) || (_new_param->val.type == RMAKER_VAL_TYPE_OBJECT)
                     || (_new_param->val.type == RMAKER_VAL_TYPE_ARRAY)) {
                 if (_new_param->val.val.s) {
                     free(_new_param->val.val.s);
                 }
+                _new_param->val_buf_size = stored_val.val.s ? strlen(stored_val.val.s) + 1 : 0;
             }
             _new_param->val = stored_val;
+            esp_rmaker_param_update_json_len(_new_param);
+            esp_rmaker_model_wrunlock();
             /* The device callback should be invoked once with the stored value, so
              * that applications can do initialisations as required.
              */
@@ -158,13 +206,29 @@ esp_err_t esp_rmaker_device_add_param(const esp_rmaker_device_t *device, const e
                 }
             }
         } else {
+            esp_rmaker_model_wrlock();
             esp_rmaker_param_store_value(_new_param);
+            esp_rmaker_model_wrunlock();
         }
     }
     ESP_LOGD(TAG, "Param %s added in %s", _new_param->name, _device->name);
     return ESP_OK;
 }
 
+/* Track the device in the node's list of devices with pending param flags, so that
+ * reporting changed params need not walk through all the devices.
+ */
+void esp_rmaker_device_mark_dirty(_esp_rmaker_device_t *device, uint8_t flags)
+{
+    device->dirty_flags |= flags;
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)device->parent;
+    if (node && device->dirty_flags && !device->dirty_listed) {
+        device->next_dirty = node->dirty_devices;
+        node->dirty_devices = device;
+        device->dirty_listed = true;
+    }
+}
+
 /* Add a new Device Attribute */
 esp_err_t esp_rmaker_device_add_attribute(const esp_rmaker_device_t *device, const char *attr_name, const char *val)
 {
@@ -185,13 +249,13 @@ esp_err_t esp_rmaker_device_add_attribute(const esp_rmaker_device_t *device, con
             break;
         }
     }
-    esp_rmaker_attr_t *new_attr = calloc(1, sizeof(esp_rmaker_attr_t));
+    esp_rmaker_attr_t *new_attr = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_attr_t));
     if (!new_attr) {
         ESP_LOGE(TAG, "Failed to allocate memory for device attribute");
         return ESP_ERR_NO_MEM;
     }
-    new_attr->name = strdup(attr_name);
-    new_attr->value = strdup(val);
+    new_attr->name = esp_rmaker_model_strdup(attr_name);
+    new_attr->value = esp_rmaker_model_strdup(val);
     if (!new_attr->name || !new_attr->value) {
         ESP_LOGE(TAG, "Failed to allocate memory for device attribute name or value");
         esp_rmaker_attribute_delete(new_attr);
@@ -202,6 +266,7 @@ esp_err_t esp_rmaker_device_add_attribute(const esp_rmaker_device_t *device, con
     } else {
         _device->attributes = new_attr;
     }
+    esp_rmaker_node_config_invalidate();
     ESP_LOGD(TAG, "Device attribute %s.%s added", _device->name, attr_name);
     return ESP_OK;
 }
@@ -215,9 +280,10 @@ esp_err_t esp_rmaker_device_add_subtype(const esp_rmaker_device_t *device, const
     }
     _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
     if (_device->subtype) {
-        free(_device->subtype);
+        esp_rmaker_model_free(_device->subtype);
     }
-    if ((_device->subtype = strdup(subtype)) != NULL ){
+    if ((_device->subtype = esp_rmaker_model_strdup(subtype)) != NULL ){
+        esp_rmaker_node_config_invalidate();
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Failed to allocate memory for device subtype");
@@ -234,9 +300,10 @@ esp_err_t esp_rmaker_device_add_model(const esp_rmaker_device_t *device, const c
     }
     _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
     if (_device->model) {
-        free(_device->model);
+        esp_rmaker_model_free(_device->model);
     }
-    if ((_device->model = strdup(model)) != NULL ){
+    if ((_device->model = esp_rmaker_model_strdup(model)) != NULL ){
+        esp_rmaker_node_config_invalidate();
         return ESP_OK;
     } else {
         ESP_LOGE(TAG, "Failed to allocate memory for device model");
@@ -251,6 +318,7 @@ esp_err_t esp_rmaker_device_assign_primary_param(const esp_rmaker_device_t *devi
         return ESP_ERR_INVALID_ARG;
     }
     ((_esp_rmaker_device_t *)device)->primary = (_esp_rmaker_param_t *)param;
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -290,14 +358,18 @@ esp_rmaker_param_t *esp_rmaker_device_get_param_by_type(const esp_rmaker_device_
         ESP_LOGE(TAG, "Device handle or param type cannot be NULL");
         return NULL;
     }
-    _esp_rmaker_param_t *param = ((_esp_rmaker_device_t *)device)->params;
-    while(param) {
-        if (strcmp(param->type, param_type) == 0) {
-            break;
+    /* All param types are interned, and so can be compared by the pointers */
+    char *interned_type = esp_rmaker_model_intern_find(param_type);
+    if (!interned_type) {
+        return NULL;
+    }
+    _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
+    for (uint16_t i = 0; i < _device->param_count; i++) {
+        if (_device->param_array[i]->type == interned_type) {
+            return (esp_rmaker_param_t *)_device->param_array[i];
         }
-        param = param->next;
     }
-    return (esp_rmaker_param_t *)param;
+    return NULL;
 }
 
 esp_rmaker_param_t *esp_rmaker_device_get_param_by_name(const esp_rmaker_device_t *device, const char *param_name)
@@ -306,12 +378,6 @@ esp_rmaker_param_t *esp_rmaker_device_get_param_by_name(const esp_rmaker_device_
         ESP_LOGE(TAG, "Device handle or param name cannot be NULL");
         return NULL;
     }
-    _esp_rmaker_param_t *param = ((_esp_rmaker_device_t *)device)->params;
-    while(param) {
-        if (strcmp(param->name, param_name) == 0) {
-            break;
-        }
-        param = param->next;
-    }
-    return (esp_rmaker_param_t *)param;
+    return (esp_rmaker_param_t *)esp_rmaker_name_index_find(&((_esp_rmaker_device_t *)device)->param_index,
+            param_name, strlen(param_name));
 }
@@ -13,14 +13,18 @@
 // limitations under the License.
 #pragma once
 #include <stdint.h>
+#include <time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <json_generator.h>
 #include <esp_rmaker_core.h>
+#include "esp_rmaker_name_index.h"
 
 #define RMAKER_PARAM_FLAG_VALUE_CHANGE   (1 << 0)
 #define RMAKER_PARAM_FLAG_VALUE_NOTIFY   (1 << 1)
 #define ESP_RMAKER_NVS_PART_NAME            "nvs"
+#define TS_DATA_VERSION                     "2021-09-13"
+#define MAX_TS_DATA_PARAM_NAME              66 /* Time series data param name is of the format <device_name>.<param_name> */
 
 typedef enum {
     ESP_RMAKER_STATE_DEINIT = 0,
@@ -43,11 +47,25 @@ typedef struct {
 
 struct esp_rmaker_param {
     char *name;
+    /* Interned, and so shared by all params of the same type. Not to be freed. */
     char *type;
     uint8_t flags;
     uint8_t prop_flags;
+    /* Flags cleared by the last report of the parent device, used to restore them if that report failed */
+    uint8_t reported_flags;
+    /* Value updated, but not yet written to NVS */
+    bool persist_pending;
+    /* Time series samples yet to be reported, with CONFIG_ESP_RMAKER_TS_BATCH */
+    struct esp_rmaker_ts_ring *ts_ring;
+    /* Set by esp_rmaker_param_add_ts_compression() */
+    struct esp_rmaker_ts_compress *ts_compress;
+    /* Size of the param in the params JSON for its current value, including separators */
+    size_t json_len;
+    /* Interned, like the type */
     char *ui_type;
     esp_rmaker_param_val_t val;
+    /* Allocated size of val.val.s for string/object/array params, which is reused for updates if large enough */
+    size_t val_buf_size;
     esp_rmaker_param_bounds_t *bounds;
     esp_rmaker_param_valid_str_list_t *valid_str_list;
     struct esp_rmaker_device *parent;
@@ -65,6 +83,7 @@ typedef struct esp_rmaker_attr esp_rmaker_attr_t;
 
 struct esp_rmaker_device {
     char *name;
+    /* Interned, like the param types */
     char *type;
     char *subtype;
     char *model;
@@ -74,9 +93,29 @@ struct esp_rmaker_device {
     bool is_service;
     esp_rmaker_attr_t *attributes;
     _esp_rmaker_param_t *params;
+    /* Pointers to the params, in the same order as the linked list, so that walks need not chase the
+     * next pointers. The params themselves are allocated individually, since param handles are pointers
+     * to them, and so this costs a pointer per param.
+     */
+    _esp_rmaker_param_t **param_array;
+    uint16_t param_count;
+    uint16_t param_array_size;
+    /* Params indexed by name, for handling set params requests */
+    esp_rmaker_name_index_t param_index;
     _esp_rmaker_param_t *primary;
     const esp_rmaker_node_t *parent;
     struct esp_rmaker_device *next;
+    /* At least one param has persist_pending set */
+    bool persist_pending;
+    /* Logical OR of the RMAKER_PARAM_FLAG_* flags of all the params of this device */
+    uint8_t dirty_flags;
+    bool dirty_listed;
+    bool reported;
+    /* report_seq of the node when the params of this device were last reported */
+    uint32_t reported_seq;
+    struct esp_rmaker_device *next_dirty;
+    /* Sum of the json_len of all the params of this device */
+    size_t params_json_len;
 };
 typedef struct esp_rmaker_device _esp_rmaker_device_t;
 
@@ -85,6 +124,12 @@ typedef struct {
     esp_rmaker_node_info_t *info;
     esp_rmaker_attr_t *attributes;
     _esp_rmaker_device_t *devices;
+    /* Devices indexed by name, for handling set params requests */
+    esp_rmaker_name_index_t device_index;
+    /* Devices having at least one param with some RMAKER_PARAM_FLAG_* set */
+    _esp_rmaker_device_t *dirty_devices;
+    /* Incremented for every report of the changed params */
+    uint32_t report_seq;
 } _esp_rmaker_node_t;
 
 esp_rmaker_node_t *esp_rmaker_node_create(const char *name, const char *type);
@@ -95,15 +140,74 @@ esp_err_t esp_rmaker_report_node_config(void);
 esp_err_t esp_rmaker_report_node_state(void);
 _esp_rmaker_device_t *esp_rmaker_node_get_first_device(const esp_rmaker_node_t *node);
 esp_rmaker_attr_t *esp_rmaker_node_get_first_attribute(const esp_rmaker_node_t *node);
+void esp_rmaker_device_mark_dirty(_esp_rmaker_device_t *device, uint8_t flags);
+void esp_rmaker_param_update_json_len(_esp_rmaker_param_t *param);
 esp_err_t esp_rmaker_params_mqtt_init(void);
+esp_err_t esp_rmaker_params_report_init(void);
 esp_err_t esp_rmaker_param_get_stored_value(_esp_rmaker_param_t *param, esp_rmaker_param_val_t *val);
 esp_err_t esp_rmaker_param_store_value(_esp_rmaker_param_t *param);
+esp_err_t esp_rmaker_param_persist(_esp_rmaker_param_t *param);
+/* A time series sample, with the time (as per esp_timer_get_time()) at which it was taken */
+typedef struct {
+    esp_rmaker_param_val_t val;
+    int64_t at;
+} esp_rmaker_ts_sample_t;
+#define RMAKER_TS_RECORD_HELD       (1 << 0)
+#define RMAKER_TS_RECORD_CURRENT    (1 << 1)
+/* Returns a combination of RMAKER_TS_RECORD_* indicating which of the samples should be recorded, in that order.
+ * held is filled if RMAKER_TS_RECORD_HELD is set.
+ */
+uint8_t esp_rmaker_param_ts_compress(_esp_rmaker_param_t *param, int64_t now, esp_rmaker_ts_sample_t *held);
+uint32_t esp_rmaker_param_ts_compress_get_count(void);
+esp_err_t esp_rmaker_ts_batch_init(void);
+esp_err_t esp_rmaker_param_ts_record(_esp_rmaker_param_t *param, const esp_rmaker_ts_sample_t *sample);
+/* Returns the value of the index'th (oldest first) of a batch of records, along with its timestamp in t */
+typedef const esp_rmaker_param_val_t *(*esp_rmaker_ts_record_get_t)(void *priv, uint16_t index, time_t *t);
+/* Adds an entry with the given records of a param to a ts_data array. If compact is set, int/float/bool
+ * records are encoded with delta-of-delta timestamps and scaled integer value deltas, where possible.
+ */
+void esp_rmaker_ts_encode_records(json_gen_str_t *jptr, const char *name, esp_rmaker_val_type_t type,
+        uint16_t count, esp_rmaker_ts_record_get_t get, void *priv, bool compact);
+void esp_rmaker_param_ts_free(_esp_rmaker_param_t *param);
+esp_err_t esp_rmaker_ts_spill_init(void);
+/* Returns ESP_ERR_INVALID_SIZE if the data does not fit in a flash sector, for the caller to split it */
+esp_err_t esp_rmaker_ts_spill_write(const char *data, size_t len);
+/* Stores the records of a param, with timestamps (as returned by get) in seconds relative to a restart, for
+ * these to be converted and reported in the next boot, once the time is available. Returns ESP_ERR_INVALID_SIZE,
+ * like esp_rmaker_ts_spill_write(), if the records do not fit.
+ */
+esp_err_t esp_rmaker_ts_spill_write_uptime(const char *name, esp_rmaker_val_type_t type, uint16_t count,
+        esp_rmaker_ts_record_get_t get, void *priv);
+/* Drops the pending entries stored by esp_rmaker_ts_spill_write_uptime() before this boot */
+void esp_rmaker_ts_spill_expire_uptime(void);
+uint32_t esp_rmaker_ts_spill_get_pending(void);
+esp_err_t esp_rmaker_work_lanes_init(void);
+esp_err_t esp_rmaker_work_lanes_deinit(void);
+esp_err_t esp_rmaker_work_lanes_start(void);
 esp_err_t esp_rmaker_node_delete(const esp_rmaker_node_t *node);
 esp_err_t esp_rmaker_param_delete(const esp_rmaker_param_t *param);
 esp_err_t esp_rmaker_attribute_delete(esp_rmaker_attr_t *attr);
 char *esp_rmaker_get_node_config(void);
+/* To be called on any change in the model which affects the node config */
+void esp_rmaker_node_config_invalidate(void);
+void esp_rmaker_node_config_cache_free(void);
+/* Clears the hash of the last reported node config, so that it gets reported again even if unchanged */
+void esp_rmaker_node_config_clear_hash(void);
 char *esp_rmaker_get_node_params(void);
 esp_err_t esp_rmaker_handle_set_params(char *data, size_t data_len, esp_rmaker_req_src_t src);
+typedef void (*esp_rmaker_param_write_fn_t)(_esp_rmaker_device_t *device, _esp_rmaker_param_t *param,
+        esp_rmaker_param_val_t val, esp_rmaker_req_src_t src);
+/* Passes the params received in JSON or CBOR to write_fn. esp_rmaker_handle_set_params() uses
+ * esp_rmaker_device_write_param(), which invokes the device's write callback.
+ */
+esp_err_t esp_rmaker_params_decode(_esp_rmaker_node_t *node, char *data, size_t data_len,
+        esp_rmaker_req_src_t src, esp_rmaker_param_write_fn_t write_fn);
+void esp_rmaker_device_write_param(_esp_rmaker_device_t *device, _esp_rmaker_param_t *param,
+        esp_rmaker_param_val_t new_val, esp_rmaker_req_src_t src);
+size_t esp_rmaker_params_json_size(_esp_rmaker_node_t *node, uint8_t flags);
+esp_err_t esp_rmaker_populate_params(_esp_rmaker_node_t *node, char *buf, size_t *buf_len,
+        uint8_t flags, bool reset_flags, bool cbor);
+int esp_rmaker_node_config_populate(const _esp_rmaker_node_t *node, char *buf, size_t buf_size);
 esp_err_t esp_rmaker_user_mapping_prov_init(void);
 esp_err_t esp_rmaker_user_mapping_prov_deinit(void);
 esp_err_t esp_rmaker_user_node_mapping_init(void);
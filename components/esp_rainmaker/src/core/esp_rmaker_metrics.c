@@ -0,0 +1,311 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <json_generator.h>
+
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_mqtt.h>
+#include <esp_rmaker_work_lanes.h>
+#include <esp_rmaker_metrics.h>
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_metrics_internal.h"
+#include "esp_rmaker_mqtt_topics.h"
+
+static const char *TAG = "esp_rmaker_metrics";
+
+#ifdef CONFIG_ESP_RMAKER_METRICS
+
+#define METRICS_VERSION     1
+
+typedef enum {
+    RMAKER_METRIC_TYPE_COUNTER = 0,
+    RMAKER_METRIC_TYPE_GAUGE,
+    RMAKER_METRIC_TYPE_HISTOGRAM,
+} esp_rmaker_metric_type_t;
+
+/* The values are updated using atomics, so that instrumentation in the hot paths does not need any lock */
+struct esp_rmaker_metric {
+    const char *name;
+    esp_rmaker_metric_type_t type;
+    uint32_t base;
+    /* Total for counters, value for gauges and sum of the values for histograms */
+    _Atomic int32_t val;
+    _Atomic uint32_t hist[RMAKER_METRIC_HIST_BUCKETS];
+};
+
+/* Metrics are never unregistered. A metric is filled before s_metric_count covers it,
+ * so the readers can go through the registry without a lock.
+ */
+static esp_rmaker_metric_t s_metrics[CONFIG_ESP_RMAKER_METRICS_MAX];
+static _Atomic uint32_t s_metric_count;
+static portMUX_TYPE s_register_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_rmaker_metric_t *s_builtin[RMAKER_METRIC_BUILTIN_MAX];
+#if CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL > 0
+static TimerHandle_t s_report_timer;
+#endif
+
+static esp_rmaker_metric_t *esp_rmaker_metric_register(const char *name, esp_rmaker_metric_type_t type,
+        uint32_t base)
+{
+    if (!name) {
+        ESP_LOGE(TAG, "Metric name cannot be NULL.");
+        return NULL;
+    }
+    esp_rmaker_metric_t *metric = NULL;
+    bool type_mismatch = false;
+    portENTER_CRITICAL(&s_register_lock);
+    uint32_t count = atomic_load(&s_metric_count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(s_metrics[i].name, name) == 0) {
+            /* The names are the keys in the report, and so cannot be shared across types */
+            if (s_metrics[i].type == type) {
+                metric = &s_metrics[i];
+            } else {
+                type_mismatch = true;
+            }
+            break;
+        }
+    }
+    if (!metric && !type_mismatch && (count < CONFIG_ESP_RMAKER_METRICS_MAX)) {
+        metric = &s_metrics[count];
+        metric->name = name;
+        metric->type = type;
+        metric->base = base;
+        atomic_store(&s_metric_count, count + 1);
+    }
+    portEXIT_CRITICAL(&s_register_lock);
+    if (type_mismatch) {
+        ESP_LOGE(TAG, "Metric %s already registered with a different type.", name);
+    } else if (!metric) {
+        ESP_LOGE(TAG, "No room to register metric %s.", name);
+    }
+    return metric;
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_counter(const char *name)
+{
+    return esp_rmaker_metric_register(name, RMAKER_METRIC_TYPE_COUNTER, 0);
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_gauge(const char *name)
+{
+    return esp_rmaker_metric_register(name, RMAKER_METRIC_TYPE_GAUGE, 0);
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_histogram(const char *name, uint32_t base)
+{
+    if (base == 0) {
+        ESP_LOGE(TAG, "Histogram base cannot be 0.");
+        return NULL;
+    }
+    return esp_rmaker_metric_register(name, RMAKER_METRIC_TYPE_HISTOGRAM, base);
+}
+
+void esp_rmaker_metric_add(esp_rmaker_metric_t *metric, uint32_t val)
+{
+    if (metric) {
+        atomic_fetch_add(&metric->val, val);
+    }
+}
+
+void esp_rmaker_metric_set(esp_rmaker_metric_t *metric, int32_t val)
+{
+    if (metric) {
+        atomic_store(&metric->val, val);
+    }
+}
+
+void esp_rmaker_metric_observe(esp_rmaker_metric_t *metric, uint32_t val)
+{
+    if (!metric || !metric->base) {
+        return;
+    }
+    int bucket = 0;
+    uint64_t limit = metric->base;
+    while ((bucket < (RMAKER_METRIC_HIST_BUCKETS - 1)) && (val >= limit)) {
+        bucket++;
+        limit <<= 1;
+    }
+    atomic_fetch_add(&metric->hist[bucket], 1);
+    atomic_fetch_add(&metric->val, val);
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_builtin(esp_rmaker_metric_builtin_t id)
+{
+    return (id < RMAKER_METRIC_BUILTIN_MAX) ? s_builtin[id] : NULL;
+}
+
+static void esp_rmaker_metrics_populate_type(json_gen_str_t *jstr, esp_rmaker_metric_type_t type, const char *key)
+{
+    uint32_t count = atomic_load(&s_metric_count);
+    json_gen_push_object(jstr, (char *)key);
+    for (uint32_t i = 0; i < count; i++) {
+        esp_rmaker_metric_t *metric = &s_metrics[i];
+        if (metric->type != type) {
+            continue;
+        }
+        if (type == RMAKER_METRIC_TYPE_HISTOGRAM) {
+            json_gen_push_object(jstr, (char *)metric->name);
+            json_gen_obj_set_int(jstr, "b", metric->base);
+            json_gen_obj_set_int(jstr, "s", atomic_load(&metric->val));
+            json_gen_push_array(jstr, "n");
+            for (int j = 0; j < RMAKER_METRIC_HIST_BUCKETS; j++) {
+                json_gen_arr_set_int(jstr, atomic_load(&metric->hist[j]));
+            }
+            json_gen_pop_array(jstr);
+            json_gen_pop_object(jstr);
+        } else {
+            json_gen_obj_set_int(jstr, (char *)metric->name, atomic_load(&metric->val));
+        }
+    }
+    json_gen_pop_object(jstr);
+}
+
+static int esp_rmaker_metrics_populate(char *buf, size_t buf_size)
+{
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, buf, buf_size, NULL, NULL);
+    json_gen_start_object(&jstr);
+    json_gen_push_object(&jstr, "rmaker_metrics");
+    json_gen_obj_set_int(&jstr, "v", METRICS_VERSION);
+    json_gen_obj_set_int(&jstr, "up", (int)(esp_timer_get_time() / 1000000));
+    esp_rmaker_metrics_populate_type(&jstr, RMAKER_METRIC_TYPE_COUNTER, "c");
+    esp_rmaker_metrics_populate_type(&jstr, RMAKER_METRIC_TYPE_GAUGE, "g");
+    esp_rmaker_metrics_populate_type(&jstr, RMAKER_METRIC_TYPE_HISTOGRAM, "h");
+    json_gen_pop_object(&jstr);
+    if (json_gen_end_object(&jstr) < 0) {
+        return -1;
+    }
+    return json_gen_str_end(&jstr);
+}
+
+char *esp_rmaker_metrics_get_json(void)
+{
+    /* Setting buffer to NULL and size to 0 just to get the required buffer size */
+    int req_size = esp_rmaker_metrics_populate(NULL, 0);
+    if (req_size < 0) {
+        return NULL;
+    }
+    /* Some headroom, since the values may change between the two passes */
+    req_size += 32;
+    char *buf = calloc(1, req_size);
+    if (!buf) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for metrics.", req_size);
+        return NULL;
+    }
+    if (esp_rmaker_metrics_populate(buf, req_size) < 0) {
+        ESP_LOGE(TAG, "Failed to generate metrics JSON.");
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+esp_err_t esp_rmaker_metrics_report(void)
+{
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_DIAGNOSTICS);
+    if (!publish_topic || (esp_rmaker_get_state() != ESP_RMAKER_STATE_STARTED)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char *metrics = esp_rmaker_metrics_get_json();
+    if (!metrics) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGD(TAG, "Reporting metrics: %s", metrics);
+    esp_err_t err = esp_rmaker_mqtt_publish_with_prio(publish_topic, metrics, strlen(metrics), RMAKER_MQTT_QOS1,
+            RMAKER_MQTT_PRIO_TS);
+    free(metrics);
+    return (err == ESP_ERR_NOT_FINISHED) ? ESP_OK : err;
+}
+
+#if CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL > 0
+static void esp_rmaker_metrics_report_work_cb(void *priv_data)
+{
+    if (esp_rmaker_metrics_report() != ESP_OK) {
+        ESP_LOGD(TAG, "Metrics not reported.");
+    }
+}
+
+static void esp_rmaker_metrics_report_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_LOW, esp_rmaker_metrics_report_work_cb, NULL);
+}
+#endif /* CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL > 0 */
+
+esp_err_t esp_rmaker_metrics_init(void)
+{
+    if (!s_builtin[0]) {
+        s_builtin[RMAKER_METRIC_MQTT_PUBLISHES] = esp_rmaker_metric_counter("mqtt.pub");
+        s_builtin[RMAKER_METRIC_MQTT_PUBLISH_BYTES] = esp_rmaker_metric_histogram("mqtt.pub_bytes", 64);
+        s_builtin[RMAKER_METRIC_MQTT_BUDGET_DROPS] = esp_rmaker_metric_counter("mqtt.budget_drop");
+        s_builtin[RMAKER_METRIC_SET_PARAMS] = esp_rmaker_metric_counter("params.set");
+        s_builtin[RMAKER_METRIC_PARAMS_BUF_ALLOCS] = esp_rmaker_metric_counter("params.buf_alloc");
+        s_builtin[RMAKER_METRIC_NVS_WRITES] = esp_rmaker_metric_counter("nvs.write");
+        s_builtin[RMAKER_METRIC_WORK_DEPTH] = esp_rmaker_metric_gauge("work.depth");
+        s_builtin[RMAKER_METRIC_NODE_CONFIG_BUILDS] = esp_rmaker_metric_counter("config.build");
+    }
+#if CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL > 0
+    if (!s_report_timer) {
+        s_report_timer = xTimerCreate("metrics_tm", pdMS_TO_TICKS(CONFIG_ESP_RMAKER_METRICS_REPORT_INTERVAL * 1000),
+                pdTRUE, NULL, esp_rmaker_metrics_report_timer_cb);
+        if (!s_report_timer || (xTimerStart(s_report_timer, 0) != pdPASS)) {
+            ESP_LOGE(TAG, "Failed to start metrics report timer.");
+            return ESP_FAIL;
+        }
+    }
+#endif
+    return ESP_OK;
+}
+
+#else /* !CONFIG_ESP_RMAKER_METRICS */
+
+esp_rmaker_metric_t *esp_rmaker_metric_counter(const char *name)
+{
+    return NULL;
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_gauge(const char *name)
+{
+    return NULL;
+}
+
+esp_rmaker_metric_t *esp_rmaker_metric_histogram(const char *name, uint32_t base)
+{
+    return NULL;
+}
+
+void esp_rmaker_metric_add(esp_rmaker_metric_t *metric, uint32_t val)
+{
+}
+
+void esp_rmaker_metric_set(esp_rmaker_metric_t *metric, int32_t val)
+{
+}
+
+void esp_rmaker_metric_observe(esp_rmaker_metric_t *metric, uint32_t val)
+{
+}
+
+char *esp_rmaker_metrics_get_json(void)
+{
+    ESP_LOGE(TAG, "Metrics not enabled.");
+    return NULL;
+}
+
+esp_err_t esp_rmaker_metrics_report(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* CONFIG_ESP_RMAKER_METRICS */
@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <sdkconfig.h>
+#include <esp_err.h>
+#include <esp_rmaker_metrics.h>
+
+/* Metrics maintained by RainMaker itself */
+typedef enum {
+    /* Counter: MQTT messages published */
+    RMAKER_METRIC_MQTT_PUBLISHES = 0,
+    /* Histogram: Payload sizes of the MQTT messages published */
+    RMAKER_METRIC_MQTT_PUBLISH_BYTES,
+    /* Counter: MQTT messages dropped for want of budget (including from the publish queue) */
+    RMAKER_METRIC_MQTT_BUDGET_DROPS,
+    /* Counter: Set params requests received, from the cloud or locally */
+    RMAKER_METRIC_SET_PARAMS,
+    /* Counter: Allocations of params report buffers, other than reusing the existing one */
+    RMAKER_METRIC_PARAMS_BUF_ALLOCS,
+    /* Counter: Param values written to NVS */
+    RMAKER_METRIC_NVS_WRITES,
+    /* Gauge: Jobs waiting in the work lanes */
+    RMAKER_METRIC_WORK_DEPTH,
+    /* Counter: Node config regenerations, ie. reads which could not be served from the cache */
+    RMAKER_METRIC_NODE_CONFIG_BUILDS,
+    RMAKER_METRIC_BUILTIN_MAX,
+} esp_rmaker_metric_builtin_t;
+
+#ifdef CONFIG_ESP_RMAKER_METRICS
+/* Registers the built-in metrics and starts the periodic reporting */
+esp_err_t esp_rmaker_metrics_init(void);
+esp_rmaker_metric_t *esp_rmaker_metric_builtin(esp_rmaker_metric_builtin_t id);
+
+#define ESP_RMAKER_METRIC_ADD(id, val)      esp_rmaker_metric_add(esp_rmaker_metric_builtin(id), val)
+#define ESP_RMAKER_METRIC_SET(id, val)      esp_rmaker_metric_set(esp_rmaker_metric_builtin(id), val)
+#define ESP_RMAKER_METRIC_OBSERVE(id, val)  esp_rmaker_metric_observe(esp_rmaker_metric_builtin(id), val)
+#else
+static inline esp_err_t esp_rmaker_metrics_init(void)
+{
+    return ESP_OK;
+}
+#define ESP_RMAKER_METRIC_ADD(id, val)
+#define ESP_RMAKER_METRIC_SET(id, val)
+#define ESP_RMAKER_METRIC_OBSERVE(id, val)
+#endif /* CONFIG_ESP_RMAKER_METRICS */
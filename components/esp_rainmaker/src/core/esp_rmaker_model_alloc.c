@@ -0,0 +1,231 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_name_index.h"
+
+/* Approximate bookkeeping overhead of the ESP-IDF heap for every allocation.
+ * Used only for the memory report.
+ */
+#define MODEL_HEAP_BLOCK_OVERHEAD   8
+#define MODEL_ALIGN(size)           (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static const char *TAG = "esp_rmaker_model";
+
+typedef struct {
+    /* Allocations made for the model, and the total size requested for those */
+    size_t alloc_count;
+    size_t alloc_bytes;
+    /* Of the above, the ones served from the arena */
+    size_t arena_count;
+    size_t arena_bytes;
+    /* Strings interned, and the lookups which were served by an existing copy */
+    size_t intern_count;
+    size_t intern_hits;
+    size_t intern_saved_bytes;
+    bool frozen;
+} esp_rmaker_model_mem_stats_t;
+
+static esp_rmaker_model_mem_stats_t s_model_stats;
+static esp_rmaker_name_index_t s_intern_index;
+/* Protects the above and the arena. A lock of its own, and not the model lock, since the allocations
+ * are made by paths which may or may not be holding the model lock, which is not recursive.
+ */
+static SemaphoreHandle_t s_model_alloc_lock;
+
+static void esp_rmaker_model_alloc_lock(void)
+{
+    if (s_model_alloc_lock) {
+        xSemaphoreTake(s_model_alloc_lock, portMAX_DELAY);
+    }
+}
+
+static void esp_rmaker_model_alloc_unlock(void)
+{
+    if (s_model_alloc_lock) {
+        xSemaphoreGive(s_model_alloc_lock);
+    }
+}
+
+esp_err_t esp_rmaker_model_alloc_init(void)
+{
+    if (s_model_alloc_lock) {
+        return ESP_OK;
+    }
+    s_model_alloc_lock = xSemaphoreCreateMutex();
+    if (!s_model_alloc_lock) {
+        ESP_LOGE(TAG, "Failed to create model allocation lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ESP_RMAKER_MODEL_ARENA
+static uint8_t s_model_arena[CONFIG_ESP_RMAKER_MODEL_ARENA_SIZE] __attribute__((aligned(sizeof(void *))));
+static size_t s_model_arena_used;
+
+static bool esp_rmaker_model_in_arena(const void *ptr)
+{
+    return ((const uint8_t *)ptr >= s_model_arena) && ((const uint8_t *)ptr < s_model_arena + sizeof(s_model_arena));
+}
+
+static void *esp_rmaker_model_arena_alloc(size_t size)
+{
+    size_t aligned_size = MODEL_ALIGN(size);
+    if (s_model_stats.frozen || (aligned_size > sizeof(s_model_arena) - s_model_arena_used)) {
+        return NULL;
+    }
+    void *ptr = &s_model_arena[s_model_arena_used];
+    s_model_arena_used += aligned_size;
+    s_model_stats.arena_count++;
+    s_model_stats.arena_bytes += size;
+    /* The arena is in .bss and never reused, so it is already zeroed */
+    return ptr;
+}
+#endif /* CONFIG_ESP_RMAKER_MODEL_ARENA */
+
+/* Should be called with s_model_alloc_lock held */
+static void *__esp_rmaker_model_calloc(size_t n, size_t size)
+{
+    size_t total = n * size;
+    if (size && (total / size != n)) {
+        return NULL;
+    }
+    void *ptr = NULL;
+#ifdef CONFIG_ESP_RMAKER_MODEL_ARENA
+    ptr = esp_rmaker_model_arena_alloc(total);
+#endif
+    if (!ptr) {
+        ptr = calloc(1, total);
+        if (!ptr) {
+            return NULL;
+        }
+    }
+    s_model_stats.alloc_count++;
+    s_model_stats.alloc_bytes += total;
+    return ptr;
+}
+
+void *esp_rmaker_model_calloc(size_t n, size_t size)
+{
+    esp_rmaker_model_alloc_lock();
+    void *ptr = __esp_rmaker_model_calloc(n, size);
+    esp_rmaker_model_alloc_unlock();
+    return ptr;
+}
+
+/* Should be called with s_model_alloc_lock held */
+static char *__esp_rmaker_model_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *new_str = __esp_rmaker_model_calloc(1, len);
+    if (new_str) {
+        memcpy(new_str, str, len);
+    }
+    return new_str;
+}
+
+char *esp_rmaker_model_strdup(const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+    esp_rmaker_model_alloc_lock();
+    char *new_str = __esp_rmaker_model_strdup(str);
+    esp_rmaker_model_alloc_unlock();
+    return new_str;
+}
+
+void esp_rmaker_model_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+#ifdef CONFIG_ESP_RMAKER_MODEL_ARENA
+    /* Arena memory is not reclaimed. The model is typically created once and never deleted. */
+    if (esp_rmaker_model_in_arena(ptr)) {
+        return;
+    }
+#endif
+    free(ptr);
+}
+
+char *esp_rmaker_model_intern_find(const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+    esp_rmaker_model_alloc_lock();
+    char *interned = esp_rmaker_name_index_find(&s_intern_index, str, strlen(str));
+    esp_rmaker_model_alloc_unlock();
+    return interned;
+}
+
+char *esp_rmaker_model_intern(const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+    esp_rmaker_model_alloc_lock();
+    char *interned = esp_rmaker_name_index_find(&s_intern_index, str, strlen(str));
+    if (interned) {
+        s_model_stats.intern_hits++;
+        s_model_stats.intern_saved_bytes += strlen(str) + 1 + MODEL_HEAP_BLOCK_OVERHEAD;
+    } else {
+        interned = __esp_rmaker_model_strdup(str);
+        /* If it could not be added to the index, it is still usable, just not shared */
+        if (interned && (esp_rmaker_name_index_add(&s_intern_index, interned, interned) == ESP_OK)) {
+            s_model_stats.intern_count++;
+        }
+    }
+    esp_rmaker_model_alloc_unlock();
+    return interned;
+}
+
+/* Should be called with s_model_alloc_lock held */
+static void __esp_rmaker_model_print_mem_report(void)
+{
+    size_t heap_equivalent = s_model_stats.alloc_bytes + s_model_stats.alloc_count * MODEL_HEAP_BLOCK_OVERHEAD;
+    ESP_LOGI(TAG, "Model: %d allocations, %d bytes (~%d bytes if entirely on heap).",
+            s_model_stats.alloc_count, s_model_stats.alloc_bytes, heap_equivalent);
+    ESP_LOGI(TAG, "Interned %d strings, shared by %d more references, saving ~%d bytes.",
+            s_model_stats.intern_count, s_model_stats.intern_hits, s_model_stats.intern_saved_bytes);
+#ifdef CONFIG_ESP_RMAKER_MODEL_ARENA
+    size_t arena_heap_equivalent = s_model_stats.arena_bytes + s_model_stats.arena_count * MODEL_HEAP_BLOCK_OVERHEAD;
+    ESP_LOGI(TAG, "Arena: %d allocations in %d of %d bytes, saving ~%d bytes and %d heap blocks.",
+            s_model_stats.arena_count, s_model_arena_used, sizeof(s_model_arena),
+            arena_heap_equivalent > s_model_arena_used ? arena_heap_equivalent - s_model_arena_used : 0,
+            s_model_stats.arena_count);
+    if (s_model_stats.arena_count < s_model_stats.alloc_count) {
+        ESP_LOGW(TAG, "%d model allocations did not fit in the arena. Consider increasing CONFIG_ESP_RMAKER_MODEL_ARENA_SIZE.",
+                s_model_stats.alloc_count - s_model_stats.arena_count);
+    }
+#endif
+}
+
+void esp_rmaker_model_print_mem_report(void)
+{
+    esp_rmaker_model_alloc_lock();
+    __esp_rmaker_model_print_mem_report();
+    esp_rmaker_model_alloc_unlock();
+}
+
+void esp_rmaker_model_freeze(void)
+{
+    esp_rmaker_model_alloc_lock();
+    if (!s_model_stats.frozen) {
+        s_model_stats.frozen = true;
+        __esp_rmaker_model_print_mem_report();
+    }
+    esp_rmaker_model_alloc_unlock();
+}
@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+/* Allocators for the node/device/param model. If CONFIG_ESP_RMAKER_MODEL_ARENA is enabled,
+ * allocations made till esp_rmaker_model_freeze() are carved out of a single statically
+ * allocated arena, else (and once the arena is frozen or full) they fall back to the heap.
+ * esp_rmaker_model_free() handles memory from either of these.
+ *
+ * These can be called from any task once esp_rmaker_model_alloc_init() is done. Before that, there is no
+ * locking, since there is no concurrency during model creation.
+ */
+esp_err_t esp_rmaker_model_alloc_init(void);
+void *esp_rmaker_model_calloc(size_t n, size_t size);
+char *esp_rmaker_model_strdup(const char *str);
+void esp_rmaker_model_free(void *ptr);
+/* Returns a shared copy of the string, for strings like types, which repeat across the model.
+ * Interned strings are never freed.
+ */
+char *esp_rmaker_model_intern(const char *str);
+/* Returns the interned copy of the string, if it has been interned already, else NULL */
+char *esp_rmaker_model_intern_find(const char *str);
+/* Stops further allocations from the arena and prints the memory report */
+void esp_rmaker_model_freeze(void);
+void esp_rmaker_model_print_mem_report(void);
@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include "esp_rmaker_model_lock.h"
+
+static const char *TAG = "esp_rmaker_model_lock";
+
+/* Readers-preferred lock. The first reader takes the writer semaphore on behalf of all the readers,
+ * and the last one gives it back. Since that could be a different task, a binary semaphore is used,
+ * instead of a mutex.
+ */
+static SemaphoreHandle_t s_readers_lock;
+static SemaphoreHandle_t s_writer_sem;
+static int s_readers;
+
+esp_err_t esp_rmaker_model_lock_init(void)
+{
+    if (s_writer_sem) {
+        return ESP_OK;
+    }
+    s_readers_lock = xSemaphoreCreateMutex();
+    s_writer_sem = xSemaphoreCreateBinary();
+    if (!s_readers_lock || !s_writer_sem) {
+        ESP_LOGE(TAG, "Failed to create model lock.");
+        if (s_readers_lock) {
+            vSemaphoreDelete(s_readers_lock);
+            s_readers_lock = NULL;
+        }
+        if (s_writer_sem) {
+            vSemaphoreDelete(s_writer_sem);
+            s_writer_sem = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    /* Binary semaphores are created empty */
+    xSemaphoreGive(s_writer_sem);
+    return ESP_OK;
+}
+
+void esp_rmaker_model_rdlock(void)
+{
+    if (!s_writer_sem) {
+        return;
+    }
+    xSemaphoreTake(s_readers_lock, portMAX_DELAY);
+    if (++s_readers == 1) {
+        xSemaphoreTake(s_writer_sem, portMAX_DELAY);
+    }
+    xSemaphoreGive(s_readers_lock);
+}
+
+esp_err_t esp_rmaker_model_rdlock_timeout(uint32_t timeout_ms)
+{
+    if (!s_writer_sem) {
+        return ESP_OK;
+    }
+    TickType_t ticks = pdMS_TO_TICKS(timeout_ms);
+    if (xSemaphoreTake(s_readers_lock, ticks) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if ((s_readers == 0) && (xSemaphoreTake(s_writer_sem, ticks) != pdTRUE)) {
+        xSemaphoreGive(s_readers_lock);
+        return ESP_ERR_TIMEOUT;
+    }
+    s_readers++;
+    xSemaphoreGive(s_readers_lock);
+    return ESP_OK;
+}
+
+void esp_rmaker_model_rdunlock(void)
+{
+    if (!s_writer_sem) {
+        return;
+    }
+    xSemaphoreTake(s_readers_lock, portMAX_DELAY);
+    if (--s_readers == 0) {
+        xSemaphoreGive(s_writer_sem);
+    }
+    xSemaphoreGive(s_readers_lock);
+}
+
+void esp_rmaker_model_wrlock(void)
+{
+    if (s_writer_sem) {
+        xSemaphoreTake(s_writer_sem, portMAX_DELAY);
+    }
+}
+
+esp_err_t esp_rmaker_model_wrlock_timeout(uint32_t timeout_ms)
+{
+    if (s_writer_sem && (xSemaphoreTake(s_writer_sem, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void esp_rmaker_model_wrunlock(void)
+{
+    if (s_writer_sem) {
+        xSemaphoreGive(s_writer_sem);
+    }
+}
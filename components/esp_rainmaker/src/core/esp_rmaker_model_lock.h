@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <esp_err.h>
+
+/* Concurrency model of the node/device/param model
+ *
+ * The model is accessed by the application tasks (esp_rmaker_param_update() and friends), the RainMaker
+ * work queue (schedules, scenes, coalesced reports, persistence), the MQTT task (set params) and the local
+ * control server. All of these go through a single reader/writer lock:
+ *
+ * - Writers: anything that changes the structure (adding/removing devices and params), param values, or
+ *   the reporting state (RMAKER_PARAM_FLAG_* flags and the dirty devices list). Reporting the changed params
+ *   is a writer, since it resets the flags in the same pass.
+ * - Readers: generating the node config or the complete node state, and looking up devices/params for
+ *   set params requests.
+ *
+ * The lock is never held while calling out to the application (device write callbacks) or publishing
+ * over MQTT, so the callbacks can update and report params as usual. It is not recursive, and so must
+ * not be taken again by a task holding it. Handles to params and devices obtained from the model remain
+ * valid only till they are deleted, which the application should not do once RainMaker has started.
+ *
+ * Before esp_rmaker_model_lock_init(), these are no-ops, since there is no concurrency during model creation.
+ */
+esp_err_t esp_rmaker_model_lock_init(void);
+void esp_rmaker_model_rdlock(void);
+/* Like esp_rmaker_model_rdlock(), but gives up after the timeout, returning ESP_ERR_TIMEOUT */
+esp_err_t esp_rmaker_model_rdlock_timeout(uint32_t timeout_ms);
+void esp_rmaker_model_rdunlock(void);
+void esp_rmaker_model_wrlock(void);
+/* Like esp_rmaker_model_wrlock(), but gives up after the timeout, returning ESP_ERR_TIMEOUT. For paths like
+ * the shutdown handlers, which may run in the context of a task already holding the lock.
+ */
+esp_err_t esp_rmaker_model_wrlock_timeout(uint32_t timeout_ms);
+void esp_rmaker_model_wrunlock(void);
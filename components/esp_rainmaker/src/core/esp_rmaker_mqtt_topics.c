@@ -0,0 +1,86 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include "esp_rmaker_mqtt_topics.h"
+
+static const char *TAG = "esp_rmaker_mqtt_topics";
+
+typedef struct {
+    const char *suffix;
+    /* Basic Ingest rule. NULL for topics which are never published via Basic Ingest */
+    const char *rule;
+} esp_rmaker_topic_info_t;
+
+static const esp_rmaker_topic_info_t s_topic_info[RMAKER_TOPIC_MAX] = {
+    [RMAKER_TOPIC_USER_MAPPING] = {USER_MAPPING_TOPIC_SUFFIX, USER_MAPPING_TOPIC_RULE},
+    [RMAKER_TOPIC_PARAMS_LOCAL] = {NODE_PARAMS_LOCAL_TOPIC_SUFFIX, NODE_PARAMS_LOCAL_TOPIC_RULE},
+    [RMAKER_TOPIC_PARAMS_LOCAL_INIT] = {NODE_PARAMS_LOCAL_INIT_TOPIC_SUFFIX, NODE_PARAMS_LOCAL_INIT_RULE},
+    [RMAKER_TOPIC_ALERT] = {NODE_PARAMS_ALERT_TOPIC_SUFFIX, NODE_PARAMS_ALERT_TOPIC_RULE},
+    [RMAKER_TOPIC_TS_DATA] = {TIME_SERIES_DATA_TOPIC_SUFFIX, TIME_SERIES_DATA_TOPIC_RULE},
+    [RMAKER_TOPIC_NODE_CONFIG] = {NODE_CONFIG_TOPIC_SUFFIX, NODE_CONFIG_TOPIC_RULE},
+    [RMAKER_TOPIC_OTAFETCH] = {OTAFETCH_TOPIC_SUFFIX, OTAFETCH_TOPIC_RULE},
+    [RMAKER_TOPIC_OTASTATUS] = {OTASTATUS_TOPIC_SUFFIX, OTASTATUS_TOPIC_RULE},
+    [RMAKER_TOPIC_CMD_RESP] = {CMD_RESP_TOPIC_SUFFIX, CMD_RESP_TOPIC_RULE},
+    [RMAKER_TOPIC_DIAGNOSTICS] = {INSIGHTS_TOPIC_SUFFIX, INSIGHTS_TOPIC_RULE},
+    [RMAKER_TOPIC_TO_NODE] = {TO_NODE_TOPIC_SUFFIX, NULL},
+};
+
+/* All the topics, packed in a single allocation */
+static char *s_topics_buf;
+static const char *s_topics[RMAKER_TOPIC_MAX];
+
+static int esp_rmaker_mqtt_topic_format(char *buf, size_t buf_size, const char *node_id,
+        const esp_rmaker_topic_info_t *info)
+{
+#ifdef CONFIG_ESP_RMAKER_MQTT_USE_BASIC_INGEST_TOPICS
+    if (info->rule) {
+        return snprintf(buf, buf_size, "$aws/rules/%s/node/%s/%s", info->rule, node_id, info->suffix);
+    }
+#endif
+    return snprintf(buf, buf_size, "node/%s/%s", node_id, info->suffix);
+}
+
+esp_err_t esp_rmaker_mqtt_topics_init(const char *node_id)
+{
+    if (!node_id) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t size = 0;
+    for (int i = 0; i < RMAKER_TOPIC_MAX; i++) {
+        size += esp_rmaker_mqtt_topic_format(NULL, 0, node_id, &s_topic_info[i]) + 1;
+    }
+    char *buf = malloc(size);
+    if (!buf) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for MQTT topics.", size);
+        return ESP_ERR_NO_MEM;
+    }
+    char *topic = buf;
+    for (int i = 0; i < RMAKER_TOPIC_MAX; i++) {
+        s_topics[i] = topic;
+        topic += esp_rmaker_mqtt_topic_format(topic, buf + size - topic, node_id, &s_topic_info[i]) + 1;
+    }
+    /* The node id changes only while claiming, before MQTT is started. So, the earlier topics are not in use. */
+    free(s_topics_buf);
+    s_topics_buf = buf;
+    return ESP_OK;
+}
+
+void esp_rmaker_mqtt_topics_deinit(void)
+{
+    free(s_topics_buf);
+    s_topics_buf = NULL;
+    memset(s_topics, 0, sizeof(s_topics));
+}
+
+const char *esp_rmaker_get_mqtt_topic(esp_rmaker_topic_t topic)
+{
+    return (topic < RMAKER_TOPIC_MAX) ? s_topics[topic] : NULL;
+}
@@ -14,6 +14,7 @@
 #define OTASTATUS_TOPIC_RULE                    "esp_node_otastatus"
 #define TIME_SERIES_DATA_TOPIC_RULE             "esp_ts_ingest"
 #define CMD_RESP_TOPIC_RULE                     "esp_cmd_resp"
+#define INSIGHTS_TOPIC_RULE                     "insights_message_delivery"
 
 
 #define USER_MAPPING_TOPIC_SUFFIX               "user/mapping"
@@ -31,3 +32,29 @@
 #define INSIGHTS_TOPIC_SUFFIX                   "diagnostics/from-node"
 
 #define MQTT_TOPIC_BUFFER_SIZE 150
+
+#include <esp_err.h>
+
+/* Topics published to by RainMaker */
+typedef enum {
+    RMAKER_TOPIC_USER_MAPPING = 0,
+    RMAKER_TOPIC_PARAMS_LOCAL,
+    RMAKER_TOPIC_PARAMS_LOCAL_INIT,
+    RMAKER_TOPIC_ALERT,
+    RMAKER_TOPIC_TS_DATA,
+    RMAKER_TOPIC_NODE_CONFIG,
+    RMAKER_TOPIC_OTAFETCH,
+    RMAKER_TOPIC_OTASTATUS,
+    RMAKER_TOPIC_CMD_RESP,
+    RMAKER_TOPIC_DIAGNOSTICS,
+    RMAKER_TOPIC_TO_NODE,
+    RMAKER_TOPIC_MAX,
+} esp_rmaker_topic_t;
+
+/* Builds all the topics for the node id, as per CONFIG_ESP_RMAKER_MQTT_USE_BASIC_INGEST_TOPICS.
+ * Called again if the node id changes.
+ */
+esp_err_t esp_rmaker_mqtt_topics_init(const char *node_id);
+void esp_rmaker_mqtt_topics_deinit(void);
+/* Returns the topic string, which remains valid till the node id changes */
+const char *esp_rmaker_get_mqtt_topic(esp_rmaker_topic_t topic);
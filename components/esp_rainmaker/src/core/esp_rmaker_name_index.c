@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "esp_rmaker_name_index.h"
+
+#define NAME_INDEX_MIN_SIZE     8
+#define NAME_INDEX_MAX_SIZE     32768
+
+static const char *TAG = "esp_rmaker_name_index";
+
+/* FNV-1a */
+static uint32_t esp_rmaker_name_hash(const char *name, size_t name_len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name_len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void esp_rmaker_name_index_insert(esp_rmaker_name_index_entry_t *entries, uint16_t size,
+        const char *name, void *item)
+{
+    uint16_t slot = esp_rmaker_name_hash(name, strlen(name)) & (size - 1);
+    while (entries[slot].name) {
+        slot = (slot + 1) & (size - 1);
+    }
+    entries[slot].name = name;
+    entries[slot].item = item;
+}
+
+static esp_err_t esp_rmaker_name_index_resize(esp_rmaker_name_index_t *index, uint16_t new_size)
+{
+    esp_rmaker_name_index_entry_t *new_entries = calloc(new_size, sizeof(esp_rmaker_name_index_entry_t));
+    if (!new_entries) {
+        ESP_LOGE(TAG, "Failed to allocate %d slots for name index.", new_size);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint16_t i = 0; i < index->size; i++) {
+        if (index->entries[i].name) {
+            esp_rmaker_name_index_insert(new_entries, new_size, index->entries[i].name, index->entries[i].item);
+        }
+    }
+    free(index->entries);
+    index->entries = new_entries;
+    index->size = new_size;
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_name_index_add(esp_rmaker_name_index_t *index, const char *name, void *item)
+{
+    if (!index || !name) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Keeping the load factor at or below 1/2 so that the probe sequences stay short */
+    if ((index->count + 1) * 2 > index->size) {
+        if (index->size >= NAME_INDEX_MAX_SIZE) {
+            return ESP_ERR_NO_MEM;
+        }
+        uint16_t new_size = index->size ? index->size * 2 : NAME_INDEX_MIN_SIZE;
+        esp_err_t err = esp_rmaker_name_index_resize(index, new_size);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    esp_rmaker_name_index_insert(index->entries, index->size, name, item);
+    index->count++;
+    return ESP_OK;
+}
+
+void *esp_rmaker_name_index_find(const esp_rmaker_name_index_t *index, const char *name, size_t name_len)
+{
+    if (!index || !index->size || !name) {
+        return NULL;
+    }
+    uint16_t slot = esp_rmaker_name_hash(name, name_len) & (index->size - 1);
+    while (index->entries[slot].name) {
+        const char *entry_name = index->entries[slot].name;
+        if ((strncmp(entry_name, name, name_len) == 0) && (entry_name[name_len] == '\0')) {
+            return index->entries[slot].item;
+        }
+        slot = (slot + 1) & (index->size - 1);
+    }
+    return NULL;
+}
+
+esp_err_t esp_rmaker_name_index_remove(esp_rmaker_name_index_t *index, const char *name)
+{
+    if (!index || !index->size || !name) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t mask = index->size - 1;
+    uint16_t slot = esp_rmaker_name_hash(name, strlen(name)) & mask;
+    while (index->entries[slot].name) {
+        if (strcmp(index->entries[slot].name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (!index->entries[slot].name) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    index->entries[slot].name = NULL;
+    index->entries[slot].item = NULL;
+    index->count--;
+    /* Re-insert the rest of the cluster so that lookups do not stop at the freed slot */
+    slot = (slot + 1) & mask;
+    while (index->entries[slot].name) {
+        esp_rmaker_name_index_entry_t entry = index->entries[slot];
+        index->entries[slot].name = NULL;
+        index->entries[slot].item = NULL;
+        esp_rmaker_name_index_insert(index->entries, index->size, entry.name, entry.item);
+        slot = (slot + 1) & mask;
+    }
+    return ESP_OK;
+}
+
+void esp_rmaker_name_index_free(esp_rmaker_name_index_t *index)
+{
+    if (index) {
+        free(index->entries);
+        index->entries = NULL;
+        index->size = 0;
+        index->count = 0;
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+/* Open addressing hash table for looking up devices and params by name.
+ * The names are not copied, and so must stay valid as long as the items are in the index.
+ */
+typedef struct {
+    const char *name;
+    void *item;
+} esp_rmaker_name_index_entry_t;
+
+typedef struct {
+    /* Number of slots. Always 0 or a power of 2 */
+    uint16_t size;
+    uint16_t count;
+    esp_rmaker_name_index_entry_t *entries;
+} esp_rmaker_name_index_t;
+
+esp_err_t esp_rmaker_name_index_add(esp_rmaker_name_index_t *index, const char *name, void *item);
+esp_err_t esp_rmaker_name_index_remove(esp_rmaker_name_index_t *index, const char *name);
+/* The name need not be NULL terminated, so that keys can be looked up directly from a JSON payload */
+void *esp_rmaker_name_index_find(const esp_rmaker_name_index_t *index, const char *name, size_t name_len);
+void esp_rmaker_name_index_free(esp_rmaker_name_index_t *index);
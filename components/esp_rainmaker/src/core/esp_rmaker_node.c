@@ -20,6 +20,8 @@
 #include <esp_rmaker_core.h>
 
 #include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_model_lock.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
 #include <esp_app_desc.h>
@@ -31,21 +33,21 @@ static void esp_rmaker_node_info_free(esp_rmaker_node_info_t *info)
 {
     if (info) {
         if (info->name) {
-            free(info->name);
+            esp_rmaker_model_free(info->name);
         }
         if (info->type) {
-            free(info->type);
+            esp_rmaker_model_free(info->type);
         }
         if (info->model) {
-            free(info->model);
+            esp_rmaker_model_free(info->model);
         }
         if (info->fw_version) {
-            free(info->fw_version);
+            esp_rmaker_model_free(info->fw_version);
         }
         if (info->subtype) {
-            free(info->subtype);
+            esp_rmaker_model_free(info->subtype);
         }
-        free(info);
+        esp_rmaker_model_free(info);
     }
 }
 
@@ -53,12 +55,12 @@ esp_err_t esp_rmaker_attribute_delete(esp_rmaker_attr_t *attr)
 {
     if (attr) {
         if (attr->name) {
-            free(attr->name);
+            esp_rmaker_model_free(attr->name);
         }
         if (attr->value) {
-            free(attr->value);
+            esp_rmaker_model_free(attr->value);
         }
-        free(attr);
+        esp_rmaker_model_free(attr);
         return ESP_OK;
     }
     return ESP_ERR_INVALID_ARG;
@@ -81,6 +83,7 @@ esp_err_t esp_rmaker_node_delete(const esp_rmaker_node_t *node)
             esp_rmaker_device_delete((esp_rmaker_device_t *)device);
             device = next_device;
         }
+        esp_rmaker_name_index_free(&_node->device_index);
         /* Node ID is created in the context of esp_rmaker_init and just assigned
          * here. So, we would not free it here.
          */
@@ -90,6 +93,7 @@ esp_err_t esp_rmaker_node_delete(const esp_rmaker_node_t *node)
         if (_node->info) {
             esp_rmaker_node_info_free(_node->info);
         }
+        esp_rmaker_node_config_invalidate();
         return ESP_OK;
     }
     return ESP_ERR_INVALID_ARG;
@@ -106,7 +110,7 @@ esp_rmaker_node_t *esp_rmaker_node_create(const char *name, const char *type)
         ESP_LOGE(TAG, "Node Name and Type are mandatory.");
         return NULL;
     }
-    _esp_rmaker_node_t *node = calloc(1, sizeof(_esp_rmaker_node_t));
+    _esp_rmaker_node_t *node = esp_rmaker_model_calloc(1, sizeof(_esp_rmaker_node_t));
     if (!node) {
         ESP_LOGE(TAG, "Failed to allocate memory for node.");
         return NULL;
@@ -118,21 +122,21 @@ esp_rmaker_node_t *esp_rmaker_node_create(const char *name, const char *type)
     }
     ESP_LOGI(TAG, "Node ID ----- %s", node->node_id);
 
-    node->info = calloc(1, sizeof(esp_rmaker_node_info_t));
+    node->info = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_node_info_t));
     if (!node->info) {
         ESP_LOGE(TAG, "Failed to allocate memory for node info.");
         goto node_create_err;
     }
-    node->info->name = strdup(name);
-    node->info->type = strdup(type);
+    node->info->name = esp_rmaker_model_strdup(name);
+    node->info->type = esp_rmaker_model_strdup(type);
     const esp_app_desc_t *app_desc;
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
     app_desc = esp_app_get_description();
 #else
     app_desc = esp_ota_get_app_description();
 #endif
-    node->info->fw_version = strdup(app_desc->version);
-    node->info->model = strdup(app_desc->project_name);
+    node->info->fw_version = esp_rmaker_model_strdup(app_desc->version);
+    node->info->model = esp_rmaker_model_strdup(app_desc->project_name);
     if (!node->info->name || !node->info->type
             || !node->info->fw_version || !node->info->model) {
         ESP_LOGE(TAG, "Failed to allocate memory for node info.");
@@ -157,13 +161,14 @@ esp_err_t esp_rmaker_node_add_fw_version(const esp_rmaker_node_t *node, const ch
         return ESP_ERR_INVALID_ARG;
     }
     if (info->fw_version) {
-        free(info->fw_version);
+        esp_rmaker_model_free(info->fw_version);
     }
-    info->fw_version = strdup(fw_version);
+    info->fw_version = esp_rmaker_model_strdup(fw_version);
     if (!info->fw_version) {
         ESP_LOGE(TAG, "Failed to allocate memory for fw version.");
         return ESP_ERR_NO_MEM;
     }
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -179,13 +184,14 @@ esp_err_t esp_rmaker_node_add_model(const esp_rmaker_node_t *node, const char *m
         return ESP_ERR_INVALID_ARG;
     }
     if (info->model) {
-        free(info->model);
+        esp_rmaker_model_free(info->model);
     }
-    info->model = strdup(model);
+    info->model = esp_rmaker_model_strdup(model);
     if (!info->model) {
         ESP_LOGE(TAG, "Failed to allocate memory for node model.");
         return ESP_ERR_NO_MEM;
     }
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -201,13 +207,14 @@ esp_err_t esp_rmaker_node_add_subtype(const esp_rmaker_node_t *node, const char
         return ESP_ERR_INVALID_ARG;
     }
     if (info->subtype) {
-        free(info->subtype);
+        esp_rmaker_model_free(info->subtype);
     }
-    info->subtype = strdup(subtype);
+    info->subtype = esp_rmaker_model_strdup(subtype);
     if (!info->subtype) {
         ESP_LOGE(TAG, "Failed to allocate memory for node subtype.");
         return ESP_ERR_NO_MEM;
     }
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -225,13 +232,13 @@ esp_err_t esp_rmaker_node_add_attribute(const esp_rmaker_node_t *node, const cha
         }
         attr = attr->next;
     }
-    esp_rmaker_attr_t *new_attr = calloc(1, sizeof(esp_rmaker_attr_t));
+    esp_rmaker_attr_t *new_attr = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_attr_t));
     if (!new_attr) {
         ESP_LOGE(TAG, "Failed to create node attribute %s.", attr_name);
         return ESP_ERR_NO_MEM;
     }
-    new_attr->name = strdup(attr_name);
-    new_attr->value = strdup(value);
+    new_attr->name = esp_rmaker_model_strdup(attr_name);
+    new_attr->value = esp_rmaker_model_strdup(value);
     if (!new_attr->name || !new_attr->value) {
         ESP_LOGE(TAG, "Failed to allocate memory for name/value for attribute %s.", attr_name);
         esp_rmaker_attribute_delete(new_attr);
@@ -243,6 +250,7 @@ esp_err_t esp_rmaker_node_add_attribute(const esp_rmaker_node_t *node, const cha
     } else {
         ((_esp_rmaker_node_t *)node)->attributes = new_attr;
     }
+    esp_rmaker_node_config_invalidate();
     ESP_LOGI(TAG, "Node attribute %s created", attr_name);
     return ESP_OK;
 }
@@ -255,9 +263,11 @@ esp_err_t esp_rmaker_node_add_device(const esp_rmaker_node_t *node, const esp_rm
     }
     _esp_rmaker_node_t *_node = (_esp_rmaker_node_t *)node;
     _esp_rmaker_device_t *_new_device = (_esp_rmaker_device_t *)device;
+    esp_rmaker_model_wrlock();
     _esp_rmaker_device_t *_device = _node->devices;
     while(_device) {
         if (strcmp(_device->name, _new_device->name) == 0) {
+            esp_rmaker_model_wrunlock();
             ESP_LOGE(TAG, "%s with name %s already exists", _new_device->is_service ? "Service":"Device", _new_device->name);
             return ESP_ERR_INVALID_ARG;
         }
@@ -267,12 +277,20 @@ esp_err_t esp_rmaker_node_add_device(const esp_rmaker_node_t *node, const esp_rm
             break;
         }
     }
+    if (esp_rmaker_name_index_add(&_node->device_index, _new_device->name, _new_device) != ESP_OK) {
+        esp_rmaker_model_wrunlock();
+        ESP_LOGE(TAG, "Failed to index %s %s", _new_device->is_service ? "Service":"Device", _new_device->name);
+        return ESP_ERR_NO_MEM;
+    }
     if (_device) {
         _device->next = _new_device;
     } else {
         _node->devices = _new_device;
     }
     _new_device->parent = node;
+    esp_rmaker_device_mark_dirty(_new_device, 0);
+    esp_rmaker_node_config_invalidate();
+    esp_rmaker_model_wrunlock();
     return ESP_OK;
 }
 
@@ -285,6 +303,7 @@ esp_err_t esp_rmaker_node_remove_device(const esp_rmaker_node_t *node, const esp
     _esp_rmaker_node_t *_node = (_esp_rmaker_node_t *)node;
     _esp_rmaker_device_t *_device = (_esp_rmaker_device_t *)device;
 
+    esp_rmaker_model_wrlock();
     _esp_rmaker_device_t *tmp_device = _node->devices;
     _esp_rmaker_device_t *prev_device = NULL;
     while(tmp_device) {
@@ -295,15 +314,30 @@ esp_err_t esp_rmaker_node_remove_device(const esp_rmaker_node_t *node, const esp
         tmp_device = tmp_device->next;
     }
     if (!tmp_device) {
+         esp_rmaker_model_wrunlock();
          ESP_LOGE(TAG, "Device %s not found in node %s", _device->name, _node->info->name);
          return ESP_ERR_INVALID_ARG;
     }
+    esp_rmaker_name_index_remove(&_node->device_index, tmp_device->name);
     if (tmp_device == _node->devices) {
         _node->devices = tmp_device->next;
     } else {
         prev_device->next = tmp_device->next;
     }
+    if (tmp_device->dirty_listed) {
+        _esp_rmaker_device_t **dirty_device = &_node->dirty_devices;
+        while (*dirty_device && (*dirty_device != tmp_device)) {
+            dirty_device = &(*dirty_device)->next_dirty;
+        }
+        if (*dirty_device) {
+            *dirty_device = tmp_device->next_dirty;
+        }
+        tmp_device->next_dirty = NULL;
+        tmp_device->dirty_listed = false;
+    }
     tmp_device->parent = NULL;
+    esp_rmaker_node_config_invalidate();
+    esp_rmaker_model_wrunlock();
     return ESP_OK;
 }
 
@@ -13,13 +13,25 @@
 // limitations under the License.
 #include <sdkconfig.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <esp_log.h>
 #include <esp_ota_ops.h>
 #include <json_generator.h>
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+#include <nvs.h>
+#include <esp_event.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <mbedtls/version.h>
+#include <mbedtls/sha256.h>
+#include <esp_rmaker_common_events.h>
+#endif
 #include <esp_rmaker_core.h>
 #include "esp_rmaker_internal.h"
 #include "esp_rmaker_mqtt.h"
 #include "esp_rmaker_mqtt_topics.h"
+#include "esp_rmaker_model_lock.h"
+#include "esp_rmaker_metrics_internal.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
 #include <esp_app_desc.h>
@@ -28,11 +40,22 @@
 #define NODE_CONFIG_TOPIC_SUFFIX        "config"
 
 static const char *TAG = "esp_rmaker_node_config";
-static esp_err_t esp_rmaker_report_info(json_gen_str_t *jptr)
+
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+#define NODE_CONFIG_NVS_NAMESPACE       "rmaker_config"
+#define NODE_CONFIG_HASH_NVS_NAME       "sha256"
+#define NODE_CONFIG_HASH_LEN            32
+
+/* Hash of the node config being published, to be stored once the broker acknowledges it */
+static SemaphoreHandle_t s_hash_lock;
+static uint8_t s_pending_hash[NODE_CONFIG_HASH_LEN];
+static int s_pending_hash_msg_id = -1;
+#endif
+static esp_err_t esp_rmaker_report_info(const _esp_rmaker_node_t *node, json_gen_str_t *jptr)
 {
     /* TODO: Error handling */
-    esp_rmaker_node_info_t *info = esp_rmaker_node_get_info(esp_rmaker_get_node());
-    json_gen_obj_set_string(jptr, "node_id", esp_rmaker_get_node_id());
+    esp_rmaker_node_info_t *info = node->info;
+    json_gen_obj_set_string(jptr, "node_id", node->node_id);
     json_gen_obj_set_string(jptr, "config_version", ESP_RMAKER_CONFIG_VERSION);
     json_gen_push_object(jptr, "info");
     json_gen_obj_set_string(jptr, "name",  info->name);
@@ -51,6 +74,12 @@ static esp_err_t esp_rmaker_report_info(json_gen_str_t *jptr)
     json_gen_obj_set_string(jptr, "project_name", (char *)app_desc->project_name);
     json_gen_obj_set_string(jptr, "platform", CONFIG_IDF_TARGET);
     json_gen_pop_object(jptr);
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    json_gen_push_array(jptr, "param_encodings");
+    json_gen_arr_set_string(jptr, "json");
+    json_gen_arr_set_string(jptr, "cbor");
+    json_gen_pop_array(jptr);
+#endif
     return ESP_OK;
 }
 
@@ -62,9 +91,9 @@ static void esp_rmaker_report_attribute(esp_rmaker_attr_t *attr, json_gen_str_t
     json_gen_end_object(jptr);
 }
 
-static esp_err_t esp_rmaker_report_node_attributes(json_gen_str_t *jptr)
+static esp_err_t esp_rmaker_report_node_attributes(const _esp_rmaker_node_t *node, json_gen_str_t *jptr)
 {
-    esp_rmaker_attr_t *attr = esp_rmaker_node_get_first_attribute(esp_rmaker_get_node());
+    esp_rmaker_attr_t *attr = node->attributes;
     if (!attr) {
         return ESP_OK;
     }
@@ -183,9 +212,9 @@ static esp_err_t esp_rmaker_report_param_config(_esp_rmaker_param_t *param, json
     return ESP_OK;
 }
 
-static esp_err_t esp_rmaker_report_devices_or_services(json_gen_str_t *jptr, char *key)
+static esp_err_t esp_rmaker_report_devices_or_services(const _esp_rmaker_node_t *node, json_gen_str_t *jptr, char *key)
 {
-    _esp_rmaker_device_t *device = esp_rmaker_node_get_first_device(esp_rmaker_get_node());
+    _esp_rmaker_device_t *device = node->devices;
     if (!device) {
         return ESP_OK;
     }
@@ -236,43 +265,223 @@ static esp_err_t esp_rmaker_report_devices_or_services(json_gen_str_t *jptr, cha
     return ESP_OK;
 }
 
-int __esp_rmaker_get_node_config(char *buf, size_t buf_size)
+int esp_rmaker_node_config_populate(const _esp_rmaker_node_t *node, char *buf, size_t buf_size)
 {
+    if (!node || !node->info) {
+        return -1;
+    }
     json_gen_str_t jstr;
     json_gen_str_start(&jstr, buf, buf_size, NULL, NULL);
     json_gen_start_object(&jstr);
-    esp_rmaker_report_info(&jstr);
-    esp_rmaker_report_node_attributes(&jstr);
-    esp_rmaker_report_devices_or_services(&jstr, "devices");
-    esp_rmaker_report_devices_or_services(&jstr, "services");
+    esp_rmaker_report_info(node, &jstr);
+    esp_rmaker_report_node_attributes(node, &jstr);
+    esp_rmaker_report_devices_or_services(node, &jstr, "devices");
+    esp_rmaker_report_devices_or_services(node, &jstr, "services");
     if (json_gen_end_object(&jstr) < 0) {
         return -1;
     }
     return json_gen_str_end(&jstr);
 }
 
-char *esp_rmaker_get_node_config(void)
+int __esp_rmaker_get_node_config(char *buf, size_t buf_size)
+{
+    return esp_rmaker_node_config_populate((_esp_rmaker_node_t *)esp_rmaker_get_node(), buf, buf_size);
+}
+
+/* The node config changes only when the model is modified, and not when param values change. So, the
+ * serialized config is cached, and regenerated only after esp_rmaker_node_config_invalidate(). The cache
+ * is read under the model read lock and replaced only under the write lock, while the generation is bumped
+ * atomically, so that invalidation does not need any lock.
+ */
+static char *s_node_config_cache;
+static size_t s_node_config_cache_len;
+static uint32_t s_node_config_cache_gen;
+static atomic_uint s_node_config_gen = 1;
+
+void esp_rmaker_node_config_invalidate(void)
+{
+    atomic_fetch_add(&s_node_config_gen, 1);
+}
+
+void esp_rmaker_node_config_cache_free(void)
+{
+    esp_rmaker_model_wrlock();
+    if (s_node_config_cache) {
+        free(s_node_config_cache);
+        s_node_config_cache = NULL;
+    }
+    s_node_config_cache_len = 0;
+    s_node_config_cache_gen = 0;
+    esp_rmaker_model_wrunlock();
+}
+
+/* Returns a copy of the cached config, which the caller should free. If fresh_only is set, NULL is returned
+ * if the cache has been invalidated after it was generated.
+ */
+static char *esp_rmaker_node_config_cache_copy(bool fresh_only)
 {
+    if (!s_node_config_cache || (fresh_only && (s_node_config_cache_gen != atomic_load(&s_node_config_gen)))) {
+        return NULL;
+    }
+    char *node_config = malloc(s_node_config_cache_len);
+    if (node_config) {
+        memcpy(node_config, s_node_config_cache, s_node_config_cache_len);
+    }
+    return node_config;
+}
+
+/* Regenerates the cache. Should be called with the model write lock held. */
+static esp_err_t esp_rmaker_node_config_cache_build(void)
+{
+    /* Read the generation before generating, so that an invalidation in between causes a rebuild next time */
+    uint32_t gen = atomic_load(&s_node_config_gen);
     /* Setting buffer to NULL and size to 0 just to get the required buffer size */
     int req_size = __esp_rmaker_get_node_config(NULL, 0);
     if (req_size < 0) {
         ESP_LOGE(TAG, "Failed to get required size for Node config JSON.");
-        return NULL;
+        return ESP_FAIL;
     }
     char *node_config = calloc(1, req_size);
     if (!node_config) {
         ESP_LOGE(TAG, "Failed to allocate %d bytes for node config", req_size);
-        return NULL;
+        return ESP_ERR_NO_MEM;
     }
     if (__esp_rmaker_get_node_config(node_config, req_size) < 0) {
         free(node_config);
         ESP_LOGE(TAG, "Failed to generate Node config JSON.");
-        return NULL;
+        return ESP_FAIL;
+    }
+    if (s_node_config_cache) {
+        free(s_node_config_cache);
     }
+    s_node_config_cache = node_config;
+    s_node_config_cache_len = req_size;
+    s_node_config_cache_gen = gen;
+    ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_NODE_CONFIG_BUILDS, 1);
     ESP_LOGD(TAG, "Generated Node config of length %d", req_size);
+    return ESP_OK;
+}
+
+char *esp_rmaker_get_node_config(void)
+{
+    esp_rmaker_model_rdlock();
+    char *node_config = esp_rmaker_node_config_cache_copy(true);
+    esp_rmaker_model_rdunlock();
+    if (node_config) {
+        return node_config;
+    }
+    /* The cache is stale (or the copy failed). Some other task may have rebuilt it in between, and so,
+     * it is checked again under the write lock.
+     */
+    esp_rmaker_model_wrlock();
+    node_config = esp_rmaker_node_config_cache_copy(true);
+    if (!node_config && (esp_rmaker_node_config_cache_build() == ESP_OK)) {
+        /* Not checking the generation again, since the model may be invalidated during the build, by
+         * changes which do not take the lock, like adding bounds during initialisation.
+         */
+        node_config = esp_rmaker_node_config_cache_copy(false);
+    }
+    esp_rmaker_model_wrunlock();
+    if (!node_config) {
+        ESP_LOGE(TAG, "Failed to get Node config JSON.");
+    }
     return node_config;
 }
 
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+static esp_err_t esp_rmaker_node_config_hash(const char *node_config, uint8_t *hash)
+{
+#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
+    int ret = mbedtls_sha256_ret((const unsigned char *)node_config, strlen(node_config), hash, 0);
+#else
+    int ret = mbedtls_sha256((const unsigned char *)node_config, strlen(node_config), hash, 0);
+#endif
+    return (ret == 0) ? ESP_OK : ESP_FAIL;
+}
+
+/* Checks if the hash is the same as that of the node config last reported, as stored in NVS */
+static bool esp_rmaker_node_config_hash_matches(const uint8_t *hash)
+{
+    nvs_handle handle;
+    if (nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, NODE_CONFIG_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    uint8_t stored_hash[NODE_CONFIG_HASH_LEN];
+    size_t len = sizeof(stored_hash);
+    esp_err_t err = nvs_get_blob(handle, NODE_CONFIG_HASH_NVS_NAME, stored_hash, &len);
+    nvs_close(handle);
+    return (err == ESP_OK) && (len == sizeof(stored_hash)) && (memcmp(hash, stored_hash, len) == 0);
+}
+
+static void esp_rmaker_node_config_hash_store(const uint8_t *hash)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, NODE_CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NODE_CONFIG_HASH_NVS_NAME, hash, NODE_CONFIG_HASH_LEN);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the node config hash. Error %d", err);
+    }
+}
+
+static void esp_rmaker_node_config_event_handler(void* arg, esp_event_base_t event_base,
+                          int32_t event_id, void* event_data)
+{
+    int msg_id = *((int *)event_data);
+    if (xSemaphoreTake(s_hash_lock, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if ((s_pending_hash_msg_id >= 0) && (msg_id == s_pending_hash_msg_id)) {
+        esp_rmaker_node_config_hash_store(s_pending_hash);
+        s_pending_hash_msg_id = -1;
+    }
+    xSemaphoreGive(s_hash_lock);
+}
+
+static esp_err_t esp_rmaker_node_config_hash_init(void)
+{
+    if (s_hash_lock) {
+        return ESP_OK;
+    }
+    s_hash_lock = xSemaphoreCreateMutex();
+    if (!s_hash_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_PUBLISHED,
+            &esp_rmaker_node_config_event_handler, NULL);
+    if (err != ESP_OK) {
+        vSemaphoreDelete(s_hash_lock);
+        s_hash_lock = NULL;
+    }
+    return err;
+}
+#endif /* CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED */
+
+void esp_rmaker_node_config_clear_hash(void)
+{
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+    if (s_hash_lock) {
+        xSemaphoreTake(s_hash_lock, portMAX_DELAY);
+        s_pending_hash_msg_id = -1;
+    }
+    nvs_handle handle;
+    if (nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, NODE_CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_erase_key(handle, NODE_CONFIG_HASH_NVS_NAME) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (s_hash_lock) {
+        xSemaphoreGive(s_hash_lock);
+    }
+#endif
+}
+
 esp_err_t esp_rmaker_report_node_config()
 {
     char *publish_payload = esp_rmaker_get_node_config();
@@ -280,12 +489,41 @@ esp_err_t esp_rmaker_report_node_config()
         ESP_LOGE(TAG, "Could not get node configuration for reporting to cloud");
         return ESP_FAIL;
     }
-    char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-    esp_rmaker_create_mqtt_topic(publish_topic, MQTT_TOPIC_BUFFER_SIZE, NODE_CONFIG_TOPIC_SUFFIX, NODE_CONFIG_TOPIC_RULE);
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+    uint8_t hash[NODE_CONFIG_HASH_LEN];
+    bool hash_valid = (esp_rmaker_node_config_hash_init() == ESP_OK) &&
+            (esp_rmaker_node_config_hash(publish_payload, hash) == ESP_OK);
+    if (hash_valid && esp_rmaker_node_config_hash_matches(hash)) {
+        ESP_LOGI(TAG, "Node Configuration unchanged. Not reporting.");
+        free(publish_payload);
+        return ESP_OK;
+    }
+#endif
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_NODE_CONFIG);
     ESP_LOGI(TAG, "Reporting Node Configuration of length %d bytes.", strlen(publish_payload));
     ESP_LOGD(TAG, "%s", publish_payload);
+    int msg_id = -1;
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+    /* Held while publishing, so that the acknowledgement is not checked before the msg_id is known */
+    if (hash_valid) {
+        xSemaphoreTake(s_hash_lock, portMAX_DELAY);
+    }
+#endif
+    /* Not using the publish queue, since the node config should not get dropped to make room for others */
     esp_err_t ret = esp_rmaker_mqtt_publish(publish_topic, publish_payload, strlen(publish_payload),
-                        RMAKER_MQTT_QOS1, NULL);
+                        RMAKER_MQTT_QOS1, &msg_id);
+#ifdef CONFIG_ESP_RMAKER_NODE_CONFIG_SKIP_UNCHANGED
+    if (hash_valid) {
+        /* Stored only once the broker acknowledges the message, and not when it is just handed over
+         * to the MQTT client, which could still fail to send it.
+         */
+        if ((ret == ESP_OK) && (msg_id >= 0)) {
+            memcpy(s_pending_hash, hash, sizeof(s_pending_hash));
+            s_pending_hash_msg_id = msg_id;
+        }
+        xSemaphoreGive(s_hash_lock);
+    }
+#endif
     free(publish_payload);
     return ret;
 }
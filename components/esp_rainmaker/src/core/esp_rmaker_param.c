@@ -14,9 +14,17 @@
 #include <sdkconfig.h>
 #include <time.h>
 #include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_timer.h>
+#include <esp_event.h>
 #include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
 
 #include <json_parser.h>
 #include <json_generator.h>
@@ -25,23 +33,34 @@
 #include <esp_rmaker_standard_types.h>
 #include <esp_rmaker_mqtt.h>
 #include <esp_rmaker_utils.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
+#include <esp_rmaker_common_events.h>
 #include "esp_rmaker_mqtt_topics.h"
+#include "esp_rmaker_mqtt_queue.h"
 #include "esp_rmaker_internal.h"
-
-#define TS_DATA_VERSION                         "2021-09-13"
+#include "esp_rmaker_model_alloc.h"
+#include "esp_rmaker_model_lock.h"
+#include "esp_rmaker_trace.h"
+#include "esp_rmaker_metrics_internal.h"
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+#include "esp_rmaker_cbor.h"
+#endif
 
 #define ESP_RMAKER_ALERT_KEY                    "esp.alert.str"
 
-#define RMAKER_PARAMS_SIZE_MARGIN       50 /* To accommodate for changes in param values while creating JSON */
 #define RMAKER_ALERT_STR_MARGIN         25 /* To accommodate rest of the alert payload {"esp.alert.str":""}  */
-#define MAX_TS_DATA_PARAM_NAME          66 /* Time series data param name is of the format <device_name>.<param_name> */
 
 static size_t max_node_params_size = CONFIG_ESP_RMAKER_MAX_PARAM_DATA_SIZE;
-/* This buffer will be allocated once and will be reused for all param updates.
- * It may be reallocated if the params size becomes too large */
 
-static char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
 static bool esp_rmaker_params_mqtt_init_done;
+/* Set while MQTT is disconnected. The changed params are reported only on reconnection. */
+static bool s_mqtt_offline;
+/* Set if the cloud sends params in CBOR, so that the params are reported in CBOR as well */
+static bool s_params_cbor;
+#ifdef CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE
+static TimerHandle_t s_param_report_timer;
+#endif
 
 static const char *TAG = "esp_rmaker_param";
 
@@ -63,6 +82,37 @@ const char *esp_rmaker_device_cb_src_to_str(esp_rmaker_req_src_t src)
     return NULL;
 }
 
+static void esp_rmaker_param_mark_dirty(_esp_rmaker_param_t *param, uint8_t flags)
+{
+    param->flags |= flags;
+    if (param->parent) {
+        esp_rmaker_device_mark_dirty(param->parent, flags);
+    }
+}
+
+/* The size is found by running the JSON generator on a NULL buffer for {"name":value}.
+ * The braces account for the comma separating this param from the next one.
+ */
+static size_t esp_rmaker_param_json_len(_esp_rmaker_param_t *param)
+{
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, NULL, 0, NULL, NULL);
+    json_gen_start_object(&jstr);
+    esp_rmaker_report_value(&param->val, param->name, &jstr);
+    json_gen_end_object(&jstr);
+    return json_gen_str_end(&jstr);
+}
+
+void esp_rmaker_param_update_json_len(_esp_rmaker_param_t *param)
+{
+    size_t json_len = esp_rmaker_param_json_len(param);
+    if (param->parent) {
+        param->parent->params_json_len -= param->json_len;
+        param->parent->params_json_len += json_len;
+    }
+    param->json_len = json_len;
+}
+
 esp_rmaker_param_val_t esp_rmaker_bool(bool val)
 {
     esp_rmaker_param_val_t param_val = {
@@ -117,52 +167,236 @@ esp_rmaker_param_val_t esp_rmaker_array(const char *val)
     return param_val;
 }
 
-static esp_err_t esp_rmaker_populate_params(char *buf, size_t *buf_len, uint8_t flags, bool reset_flags)
-{
-    esp_err_t err = ESP_OK;
+/* Params are encoded as JSON by default, or as CBOR if that is what the cloud uses */
+typedef struct {
+    bool cbor;
     json_gen_str_t jstr;
-    json_gen_str_start(&jstr, buf, *buf_len, NULL, NULL);
-    json_gen_start_object(&jstr);
-    _esp_rmaker_device_t *device = esp_rmaker_node_get_first_device(esp_rmaker_get_node());
-    while (device) {
-        bool device_added = false;
-        _esp_rmaker_param_t *param = device->params;
-        while (param) {
-            if (!flags || (param->flags & flags)) {
-                if (!device_added) {
-                    json_gen_push_object(&jstr, device->name);
-                    device_added = true;
-                }
-                esp_rmaker_report_value(&param->val, param->name, &jstr);
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    esp_rmaker_cbor_enc_t cenc;
+#endif
+} esp_rmaker_params_enc_t;
+
+static void esp_rmaker_params_enc_push_device(esp_rmaker_params_enc_t *enc, char *name)
+{
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (enc->cbor) {
+        esp_rmaker_cbor_enc_text(&enc->cenc, name, strlen(name));
+        esp_rmaker_cbor_enc_map_start(&enc->cenc);
+        return;
+    }
+#endif
+    json_gen_push_object(&enc->jstr, name);
+}
+
+static void esp_rmaker_params_enc_pop_device(esp_rmaker_params_enc_t *enc)
+{
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (enc->cbor) {
+        esp_rmaker_cbor_enc_map_end(&enc->cenc);
+        return;
+    }
+#endif
+    json_gen_pop_object(&enc->jstr);
+}
+
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+static void esp_rmaker_report_value_cbor(const esp_rmaker_param_val_t *val, char *key, esp_rmaker_cbor_enc_t *cenc)
+{
+    esp_rmaker_cbor_enc_text(cenc, key, strlen(key));
+    switch (val->type) {
+        case RMAKER_VAL_TYPE_BOOLEAN:
+            esp_rmaker_cbor_enc_bool(cenc, val->val.b);
+            break;
+        case RMAKER_VAL_TYPE_INTEGER:
+            esp_rmaker_cbor_enc_int(cenc, val->val.i);
+            break;
+        case RMAKER_VAL_TYPE_FLOAT:
+            esp_rmaker_cbor_enc_float(cenc, val->val.f);
+            break;
+        case RMAKER_VAL_TYPE_STRING:
+        case RMAKER_VAL_TYPE_OBJECT:
+        case RMAKER_VAL_TYPE_ARRAY:
+            if (!val->val.s) {
+                esp_rmaker_cbor_enc_null(cenc);
+                break;
             }
-            param = param->next;
+            /* Objects and arrays are kept as JSON, since that is how the application provides them */
+            if (val->type != RMAKER_VAL_TYPE_STRING) {
+                esp_rmaker_cbor_enc_tag(cenc, CBOR_TAG_EMBEDDED_JSON);
+            }
+            esp_rmaker_cbor_enc_text(cenc, val->val.s, strlen(val->val.s));
+            break;
+        default:
+            esp_rmaker_cbor_enc_null(cenc);
+            break;
+    }
+}
+#endif /* CONFIG_ESP_RMAKER_PARAM_CBOR */
+
+static void esp_rmaker_params_enc_value(esp_rmaker_params_enc_t *enc, _esp_rmaker_param_t *param)
+{
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (enc->cbor) {
+        esp_rmaker_report_value_cbor(&param->val, param->name, &enc->cenc);
+        return;
+    }
+#endif
+    esp_rmaker_report_value(&param->val, param->name, &enc->jstr);
+}
+
+static void esp_rmaker_populate_device_params(esp_rmaker_params_enc_t *enc, _esp_rmaker_device_t *device,
+        uint8_t flags, bool reset_flags)
+{
+    bool device_added = false;
+    uint8_t dirty_flags = 0;
+    for (uint16_t i = 0; i < device->param_count; i++) {
+        _esp_rmaker_param_t *param = device->param_array[i];
+        if (reset_flags) {
+            param->reported_flags = 0;
         }
-        if (device_added) {
-            json_gen_pop_object(&jstr);
+        if (!flags || (param->flags & flags)) {
+            if (!device_added) {
+                esp_rmaker_params_enc_push_device(enc, device->name);
+                device_added = true;
+            }
+            esp_rmaker_params_enc_value(enc, param);
+            if (reset_flags) {
+                param->reported_flags = param->flags & flags;
+                param->flags &= ~flags;
+            }
         }
-        device = device->next;
+        dirty_flags |= param->flags;
     }
-    if (json_gen_end_object(&jstr) < 0) {
-        err = ESP_ERR_NO_MEM;
+    if (device_added) {
+        esp_rmaker_params_enc_pop_device(enc);
     }
-    /* Resetting the flags after creating the JSON in order to handle cases wherein
-     * memory has been insufficient and this same function would have to be called
-     * again with a larger buffer.
-     */
-    if (err == ESP_OK) {
-        device = esp_rmaker_node_get_first_device(esp_rmaker_get_node());
-        while (device) {
-            _esp_rmaker_param_t *param = device->params;
-            while (param) {
-                if (reset_flags) {
-                    param->flags &= ~flags;
+    device->dirty_flags = dirty_flags;
+    if (reset_flags) {
+        device->reported = true;
+        device->reported_seq = ((_esp_rmaker_node_t *)device->parent)->report_seq;
+    }
+}
+
+/* Called after the flags have been reset while populating the params. If the JSON could not be
+ * created, the flags are restored so that the same params get picked up again on a retry.
+ * Devices which do not have any flags set are then dropped from the dirty devices list.
+ */
+static void esp_rmaker_params_finish_reset(_esp_rmaker_node_t *node, bool success)
+{
+    _esp_rmaker_device_t **dirty_device = &node->dirty_devices;
+    while (*dirty_device) {
+        _esp_rmaker_device_t *device = *dirty_device;
+        if (!success && device->reported) {
+            for (uint16_t i = 0; i < device->param_count; i++) {
+                _esp_rmaker_param_t *param = device->param_array[i];
+                param->flags |= param->reported_flags;
+                device->dirty_flags |= param->reported_flags;
+                param->reported_flags = 0;
+            }
+        }
+        device->reported = false;
+        if (device->dirty_flags) {
+            dirty_device = &device->next_dirty;
+        } else {
+            *dirty_device = device->next_dirty;
+            device->next_dirty = NULL;
+            device->dirty_listed = false;
+        }
+    }
+}
+
+/* Size of the buffer required for the params JSON, as per the sizes maintained on every param update.
+ * This is exact, but for a couple of bytes per param, and so the JSON can be created in a single pass.
+ */
+size_t esp_rmaker_params_json_size(_esp_rmaker_node_t *node, uint8_t flags)
+{
+    size_t size = 3; /* {} and the NULL termination */
+    _esp_rmaker_device_t *device = flags ? node->dirty_devices : node->devices;
+    while (device) {
+        if (!flags || (device->dirty_flags & flags)) {
+            /* "<device_name>":{<params>}, */
+            size += strlen(device->name) + 6 + device->params_json_len;
+        }
+        device = flags ? device->next_dirty : device->next;
+    }
+    return size;
+}
+
+/* Same as esp_rmaker_params_json_size(), but going through the params instead of using the maintained sizes,
+ * which are stale if the application changed a value directly, using the pointer from esp_rmaker_param_get_val().
+ * If resync is set, the maintained sizes are updated too, which requires the model write lock.
+ */
+static size_t esp_rmaker_params_json_size_resync(_esp_rmaker_node_t *node, uint8_t flags, bool resync)
+{
+    size_t size = 3; /* {} and the NULL termination */
+    _esp_rmaker_device_t *device = flags ? node->dirty_devices : node->devices;
+    while (device) {
+        if (!flags || (device->dirty_flags & flags)) {
+            /* "<device_name>":{<params>}, */
+            size += strlen(device->name) + 6;
+            for (uint16_t i = 0; i < device->param_count; i++) {
+                if (resync) {
+                    esp_rmaker_param_update_json_len(device->param_array[i]);
+                    size += device->param_array[i]->json_len;
+                } else {
+                    size += esp_rmaker_param_json_len(device->param_array[i]);
                 }
-                param = param->next;
             }
-            device = device->next;
         }
+        device = flags ? device->next_dirty : device->next;
+    }
+    return size;
+}
+
+/* On success, buf_len is set to the length of the data, excluding the NULL termination in case of JSON */
+esp_err_t esp_rmaker_populate_params(_esp_rmaker_node_t *node, char *buf, size_t *buf_len,
+        uint8_t flags, bool reset_flags, bool cbor)
+{
+    esp_err_t err = ESP_OK;
+    esp_rmaker_params_enc_t enc = {
+        .cbor = cbor,
+    };
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (cbor) {
+        esp_rmaker_cbor_enc_init(&enc.cenc, (uint8_t *)buf, *buf_len);
+        esp_rmaker_cbor_enc_map_start(&enc.cenc);
+    } else
+#endif
+    {
+        json_gen_str_start(&enc.jstr, buf, *buf_len, NULL, NULL);
+        json_gen_start_object(&enc.jstr);
+    }
+    /* Reporting all the params requires going through all the devices, whereas reporting
+     * only the changed/notified params requires going through only the dirty devices.
+     * The flags are reset in the same pass.
+     */
+    if (flags && reset_flags) {
+        node->report_seq++;
+    }
+    _esp_rmaker_device_t *device = flags ? node->dirty_devices : node->devices;
+    while (device) {
+        if (!flags || (device->dirty_flags & flags)) {
+            esp_rmaker_populate_device_params(&enc, device, flags, reset_flags);
+        }
+        device = flags ? device->next_dirty : device->next;
+    }
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (cbor) {
+        esp_rmaker_cbor_enc_map_end(&enc.cenc);
+        err = esp_rmaker_cbor_enc_finish(&enc.cenc);
+        *buf_len = enc.cenc.len;
+    } else
+#endif
+    {
+        if (json_gen_end_object(&enc.jstr) < 0) {
+            err = ESP_ERR_NO_MEM;
+        }
+        json_gen_str_end(&enc.jstr);
+        *buf_len = (err == ESP_OK) ? strlen(buf) : 0;
+    }
+    if (flags && reset_flags) {
+        esp_rmaker_params_finish_reset(node, err == ESP_OK);
     }
-    *buf_len = json_gen_str_end(&jstr);
     return err;
 }
 
@@ -172,21 +406,31 @@ static esp_err_t esp_rmaker_populate_params(char *buf, size_t *buf_len, uint8_t
  */
 char *esp_rmaker_get_node_params(void)
 {
-    size_t req_size = 0;
-    /* Passing NULL pointer to find the required buffer size */
-    esp_err_t err = esp_rmaker_populate_params(NULL, &req_size, 0, false);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get required size for Node params JSON.");
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
         return NULL;
     }
-    /* Keeping some margin just in case some param value changes in between */
-    req_size += RMAKER_PARAMS_SIZE_MARGIN;
+    esp_rmaker_model_rdlock();
+    size_t req_size = esp_rmaker_params_json_size(node, 0);
     char *node_params = calloc(1, req_size);
     if (!node_params) {
+        esp_rmaker_model_rdunlock();
         ESP_LOGE(TAG, "Failed to allocate %d bytes for Node params.", req_size);
         return NULL;
     }
-    err = esp_rmaker_populate_params(node_params, &req_size, 0, false);
+    size_t buf_size = req_size;
+    esp_err_t err = esp_rmaker_populate_params(node, node_params, &req_size, 0, false, false);
+    if (err == ESP_ERR_NO_MEM) {
+        /* The maintained sizes are stale. Retrying once, with the actual size. */
+        free(node_params);
+        req_size = esp_rmaker_params_json_size_resync(node, 0, false);
+        ESP_LOGW(TAG, "%d bytes not sufficient for Node params. Retrying with %d bytes.", buf_size, req_size);
+        node_params = calloc(1, req_size);
+        if (node_params) {
+            err = esp_rmaker_populate_params(node, node_params, &req_size, 0, false, false);
+        }
+    }
+    esp_rmaker_model_rdunlock();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to generate Node params JSON.");
         free(node_params);
@@ -195,221 +439,570 @@ char *esp_rmaker_get_node_params(void)
     return node_params;
 }
 
-static char * esp_rmaker_param_get_buf(size_t size)
+/* The buffer for the params reports is retained across reports, to avoid allocating it every time.
+ * It is claimed by one report at a time. A report generated concurrently, say by the application
+ * task while the work queue is publishing the earlier one, gets a temporary buffer instead.
+ */
+static char *s_node_params_buf;
+static size_t s_param_buf_size;
+static atomic_bool s_param_buf_busy;
+
+static char *esp_rmaker_param_buf_acquire(size_t size)
 {
-    static char *s_node_params_buf;
-    static size_t s_param_buf_size;
-    /* If received size is 0, we will just return the pointer to the buffer */
-    if (size == 0) {
-        return s_node_params_buf;
+    bool busy = false;
+    if (!atomic_compare_exchange_strong(&s_param_buf_busy, &busy, true)) {
+        ESP_LOGD(TAG, "Params buffer in use. Allocating %d bytes.", size);
+        ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_PARAMS_BUF_ALLOCS, 1);
+        char *buf = calloc(1, size);
+        if (!buf) {
+            ESP_LOGE(TAG, "Failed to allocate %d bytes for Node params.", size);
+        }
+        return buf;
     }
-    /* If s_param_buf_size is not 0, it means that a buffer was already allocated.
-     * If the requested "size" is not the same as the existing s_param_buf_size,
-     * we need to free existing buffer.
-     */
-    if ((s_param_buf_size != 0) && (s_param_buf_size != size)) {
-        ESP_LOGD(TAG, "Freeing s_node_params_buf of size %d", s_param_buf_size);
+    if (s_param_buf_size < size) {
+        ESP_LOGD(TAG, "Reallocating s_node_params_buf from %d to %d bytes.", s_param_buf_size, size);
+        ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_PARAMS_BUF_ALLOCS, 1);
         free(s_node_params_buf);
-        s_node_params_buf = NULL;
-    }
-    if (!s_node_params_buf) {
-        ESP_LOGD(TAG, "Allocating s_node_params_buf for size %d.", size);
         s_node_params_buf = calloc(1, size);
+        s_param_buf_size = s_node_params_buf ? size : 0;
         if (!s_node_params_buf) {
             ESP_LOGE(TAG, "Failed to allocate %d bytes for Node params.", size);
-            s_param_buf_size = 0;
+            atomic_store(&s_param_buf_busy, false);
             return NULL;
         }
-        s_param_buf_size = size;
     }
     return s_node_params_buf;
 }
 
-static esp_err_t esp_rmaker_allocate_and_populate_params(uint8_t flags, bool reset_flags)
+static void esp_rmaker_param_buf_release(char *buf)
 {
-    char *node_params_buf = esp_rmaker_param_get_buf(max_node_params_size);
-    if (!node_params_buf) {
-        return ESP_ERR_NO_MEM;
+    if (!buf) {
+        return;
+    }
+    if (buf == s_node_params_buf) {
+        atomic_store(&s_param_buf_busy, false);
+    } else {
+        free(buf);
+    }
+}
+
+/* Populates the params in a buffer acquired using esp_rmaker_param_buf_acquire(), which should be
+ * released by the caller using esp_rmaker_param_buf_release() once done.
+ * If the flags are being reset, report_seq is set to the sequence number of this report.
+ */
+static esp_err_t esp_rmaker_allocate_and_populate_params(uint8_t flags, bool reset_flags, char **params_buf,
+        size_t *params_len, uint32_t *report_seq)
+{
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (reset_flags) {
+        esp_rmaker_model_wrlock();
+    } else {
+        esp_rmaker_model_rdlock();
     }
     /* Typically, max_node_params_size should be sufficient for the parameters */
-    size_t req_size = max_node_params_size;
-    esp_err_t err = esp_rmaker_populate_params(node_params_buf, &req_size, flags, reset_flags);
-    /* If the max_node_params_size was insufficient, we will re-allocate new buffer */
-    if (err == ESP_ERR_NO_MEM) {
+    size_t req_size = esp_rmaker_params_json_size(node, flags);
+    if (req_size > max_node_params_size) {
         ESP_LOGW(TAG, "%d bytes not sufficient for Node params. Reallocating %d bytes.",
-                max_node_params_size, req_size + RMAKER_PARAMS_SIZE_MARGIN);
-        max_node_params_size = req_size + RMAKER_PARAMS_SIZE_MARGIN; /* Keeping some margin since paramater value size can change */
-        node_params_buf = esp_rmaker_param_get_buf(max_node_params_size);
-        if (!node_params_buf) {
-            return ESP_ERR_NO_MEM;
+                max_node_params_size, req_size);
+        max_node_params_size = req_size;
+    }
+    size_t buf_size = max_node_params_size;
+    char *node_params_buf = esp_rmaker_param_buf_acquire(buf_size);
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (node_params_buf) {
+        req_size = buf_size;
+        err = esp_rmaker_populate_params(node, node_params_buf, &req_size, flags, reset_flags, s_params_cbor);
+    }
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    /* The JSON size is typically an upper bound for CBOR as well, but not always, since
+     * objects and arrays are embedded with some additional overhead.
+     */
+    if (node_params_buf && (err == ESP_ERR_NO_MEM) && s_params_cbor) {
+        esp_rmaker_param_buf_release(node_params_buf);
+        max_node_params_size = req_size;
+        buf_size = req_size;
+        node_params_buf = esp_rmaker_param_buf_acquire(buf_size);
+        if (node_params_buf) {
+            req_size = buf_size;
+            err = esp_rmaker_populate_params(node, node_params_buf, &req_size, flags, reset_flags, true);
         }
-        req_size = max_node_params_size;
-        err = esp_rmaker_populate_params(node_params_buf, &req_size, flags, reset_flags);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to populate node parameters.");
+    }
+#endif
+    if (node_params_buf && (err == ESP_ERR_NO_MEM) && !s_params_cbor) {
+        /* The maintained sizes are stale. Retrying once, with the actual size. The sizes are also
+         * corrected if the write lock is held, so that the next reports do not need this.
+         */
+        esp_rmaker_param_buf_release(node_params_buf);
+        req_size = esp_rmaker_params_json_size_resync(node, flags, reset_flags);
+        ESP_LOGW(TAG, "%d bytes not sufficient for Node params. Retrying with %d bytes.", buf_size, req_size);
+        if (req_size > max_node_params_size) {
+            max_node_params_size = req_size;
+        }
+        buf_size = max_node_params_size;
+        node_params_buf = esp_rmaker_param_buf_acquire(buf_size);
+        if (node_params_buf) {
+            req_size = buf_size;
+            err = esp_rmaker_populate_params(node, node_params_buf, &req_size, flags, reset_flags, false);
         }
     }
-    return err;
+    if (report_seq) {
+        *report_seq = node->report_seq;
+    }
+    if (reset_flags) {
+        esp_rmaker_model_wrunlock();
+    } else {
+        esp_rmaker_model_rdunlock();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to populate node parameters.");
+        esp_rmaker_param_buf_release(node_params_buf);
+        return err;
+    }
+    *params_buf = node_params_buf;
+    *params_len = req_size;
+    return ESP_OK;
+}
+
+/* Even the smallest possible data, Eg. '{"d":{"p":0}}' will be more than an empty object */
+#define RMAKER_PARAMS_EMPTY_LEN     2
+
+static void esp_rmaker_log_params(const char *prefix, const char *params, size_t params_len)
+{
+    if (s_params_cbor) {
+        ESP_LOGI(TAG, "%s (CBOR): %d bytes", prefix, params_len);
+    } else {
+        ESP_LOGI(TAG, "%s: %.*s", prefix, params_len, params);
+    }
+}
+
+/* Marks the params of the given report as changed again, so that they get reported on the next attempt.
+ * The params which were included in a later report by then, are not re-marked.
+ */
+static void esp_rmaker_params_restore_reported(uint32_t report_seq)
+{
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    esp_rmaker_model_wrlock();
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        /* The reported_flags of the devices not in this report are stale */
+        if (device->reported_seq != report_seq) {
+            continue;
+        }
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (param->reported_flags) {
+                esp_rmaker_param_mark_dirty(param, param->reported_flags);
+                param->reported_flags = 0;
+            }
+        }
+    }
+    esp_rmaker_model_wrunlock();
+}
+
+/* A queued report was dropped to make room for other messages. The params are not reported
+ * right away, since that could drop other queued messages again. They go with the next report.
+ */
+static void esp_rmaker_params_report_dropped(void *priv)
+{
+    esp_rmaker_params_restore_reported((uint32_t)(uintptr_t)priv);
 }
 
 static esp_err_t esp_rmaker_report_param_internal(uint8_t flags)
 {
-    esp_err_t err = esp_rmaker_allocate_and_populate_params(flags, true);
-    if (err == ESP_OK) {
-        /* Just checking if there are indeed any params to report by comparing with a decent enough
-         * length as even the smallest possible data, Eg. '{"d":{"p":0}}' will be > 10 bytes.
-         */
-        char *node_params_buf = esp_rmaker_param_get_buf(0);
-        if (strlen(node_params_buf) > 10) {
+    if ((flags == RMAKER_PARAM_FLAG_VALUE_CHANGE) && s_mqtt_offline) {
+        /* The changed params remain marked, so that only those get reported on reconnection */
+        ESP_LOGD(TAG, "MQTT disconnected. Deferring params report.");
+        return ESP_OK;
+    }
+    const char *publish_topic;
+    if (flags == RMAKER_PARAM_FLAG_VALUE_CHANGE) {
+        publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_PARAMS_LOCAL);
+    } else if (flags == RMAKER_PARAM_FLAG_VALUE_NOTIFY) {
+        publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_ALERT);
+    } else {
+        return ESP_FAIL;
+    }
+    char *node_params_buf = NULL;
+    size_t params_len = 0;
+    uint32_t report_seq = 0;
+    esp_err_t err = esp_rmaker_allocate_and_populate_params(flags, true, &node_params_buf, &params_len, &report_seq);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (params_len > RMAKER_PARAMS_EMPTY_LEN) {
+        ESP_RMAKER_TRACE(RMAKER_TRACE_REPORT, params_len);
+        esp_rmaker_log_params((flags == RMAKER_PARAM_FLAG_VALUE_CHANGE) ? "Reporting params" : "Notifying params",
+                node_params_buf, params_len);
+        if (esp_rmaker_params_mqtt_init_done) {
             if (flags == RMAKER_PARAM_FLAG_VALUE_CHANGE) {
-                esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), NODE_PARAMS_LOCAL_TOPIC_SUFFIX, NODE_PARAMS_LOCAL_TOPIC_RULE);
-                ESP_LOGI(TAG, "Reporting params: %s", node_params_buf);
-            } else if (flags == RMAKER_PARAM_FLAG_VALUE_NOTIFY) {
-                esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), NODE_PARAMS_ALERT_TOPIC_SUFFIX, NODE_PARAMS_ALERT_TOPIC_RULE);
-                ESP_LOGI(TAG, "Notifying params: %s", node_params_buf);
+                err = esp_rmaker_mqtt_publish_with_prio_cb(publish_topic, node_params_buf, params_len,
+                        RMAKER_MQTT_QOS1, RMAKER_MQTT_PRIO_PARAMS, esp_rmaker_params_report_dropped,
+                        (void *)(uintptr_t)report_seq);
             } else {
-                return ESP_FAIL;
+                err = esp_rmaker_mqtt_publish_with_prio(publish_topic, node_params_buf, params_len,
+                        RMAKER_MQTT_QOS1, RMAKER_MQTT_PRIO_ALERT);
             }
-            if (esp_rmaker_params_mqtt_init_done) {
-                esp_rmaker_mqtt_publish(publish_topic, node_params_buf, strlen(node_params_buf), RMAKER_MQTT_QOS1, NULL);
-            } else {
-                ESP_LOGW(TAG, "Not reporting params since params mqtt not initialized yet.");
+            ESP_RMAKER_TRACE(RMAKER_TRACE_PUBLISH, err != ESP_OK);
+            /* A queued report is restored only if it gets dropped from the queue later */
+            if ((err != ESP_OK) && (err != ESP_ERR_NOT_FINISHED) && (flags == RMAKER_PARAM_FLAG_VALUE_CHANGE)) {
+                /* Alerts are not retried, since they would be stale */
+                esp_rmaker_params_restore_reported(report_seq);
             }
+        } else {
+            ESP_LOGW(TAG, "Not reporting params since params mqtt not initialized yet.");
         }
-        return ESP_OK;
     }
-    return err;
+    esp_rmaker_param_buf_release(node_params_buf);
+    return ESP_OK;
 }
 
+/* Returns the token following the given token and all its children */
+static json_tok_t *esp_rmaker_json_skip_tok(jparse_ctx_t *jptr, json_tok_t *tok)
+{
+    json_tok_t *end = jptr->tokens + jptr->num_tokens;
+    int tok_end = tok->end;
+    tok++;
+    while ((tok < end) && (tok->start < tok_end)) {
+        tok++;
+    }
+    return tok;
+}
 
-static esp_err_t esp_rmaker_device_set_params(_esp_rmaker_device_t *device, jparse_ctx_t *jptr, esp_rmaker_req_src_t src)
+/* Decodes the value token as per the type of the param. Returns ESP_ERR_INVALID_ARG
+ * if the value is not of the param's type.
+ *
+ * String, object and array values are not copied. Instead, the value points into the payload
+ * itself, NULL terminated by temporarily overwriting the character following the token, which
+ * is returned in "saved_char" so that it can be restored once the value has been consumed.
+ * This character is always within the payload, since the value is either a string (followed by
+ * its closing quote) or nested within the device's object.
+ */
+static esp_err_t esp_rmaker_param_get_val_from_tok(_esp_rmaker_param_t *param, jparse_ctx_t *jptr,
+        json_tok_t *tok, esp_rmaker_param_val_t *new_val, char *saved_char)
 {
-    _esp_rmaker_param_t *param = device->params;
-    while (param) {
-        esp_rmaker_param_val_t new_val = {0};
-        bool param_found = false;
-        switch(param->val.type) {
-            case RMAKER_VAL_TYPE_BOOLEAN:
-                if (json_obj_get_bool(jptr, param->name, &new_val.val.b) == 0) {
-                    new_val.type = RMAKER_VAL_TYPE_BOOLEAN;
-                    param_found = true;
-                }
-                break;
-            case RMAKER_VAL_TYPE_INTEGER:
-                if (json_obj_get_int(jptr, param->name, &new_val.val.i) == 0) {
-                    new_val.type = RMAKER_VAL_TYPE_INTEGER;
-                    param_found = true;
-                }
-                break;
-            case RMAKER_VAL_TYPE_FLOAT:
-                if (json_obj_get_float(jptr, param->name, &new_val.val.f) == 0) {
-                    new_val.type = RMAKER_VAL_TYPE_FLOAT;
-                    param_found = true;
-                }
-                break;
-            case RMAKER_VAL_TYPE_STRING: {
-                int val_size = 0;
-                if (json_obj_get_strlen(jptr, param->name, &val_size) == 0) {
-                    val_size++; /* For NULL termination */
-                    new_val.val.s = calloc(1, val_size);
-                    if (!new_val.val.s) {
-                        return ESP_ERR_NO_MEM;
-                    }
-                    json_obj_get_string(jptr, param->name, new_val.val.s, val_size);
-                    new_val.type = RMAKER_VAL_TYPE_STRING;
-                    param_found = true;
-                }
-                break;
+    const char *val_str = jptr->js + tok->start;
+    int val_len = tok->end - tok->start;
+    switch(param->val.type) {
+        case RMAKER_VAL_TYPE_BOOLEAN:
+            if (tok->type != JSMN_PRIMITIVE) {
+                return ESP_ERR_INVALID_ARG;
             }
-            case RMAKER_VAL_TYPE_OBJECT: {
-                int val_size = 0;
-                if (json_obj_get_object_strlen(jptr, param->name, &val_size) == 0) {
-                    val_size++; /* For NULL termination */
-                    new_val.val.s = calloc(1, val_size);
-                    if (!new_val.val.s) {
-                        return ESP_ERR_NO_MEM;
-                    }
-                    json_obj_get_object_str(jptr, param->name, new_val.val.s, val_size);
-                    new_val.type = RMAKER_VAL_TYPE_OBJECT;
-                    param_found = true;
-                }
-                break;
+            if ((val_len == 4) && (strncmp(val_str, "true", 4) == 0)) {
+                new_val->val.b = true;
+            } else if ((val_len == 5) && (strncmp(val_str, "false", 5) == 0)) {
+                new_val->val.b = false;
+            } else {
+                return ESP_ERR_INVALID_ARG;
             }
-            case RMAKER_VAL_TYPE_ARRAY: {
-                int val_size = 0;
-                if (json_obj_get_array_strlen(jptr, param->name, &val_size) == 0) {
-                    val_size++; /* For NULL termination */
-                    new_val.val.s = calloc(1, val_size);
-                    if (!new_val.val.s) {
-                        return ESP_ERR_NO_MEM;
-                    }
-                    json_obj_get_array_str(jptr, param->name, new_val.val.s, val_size);
-                    new_val.type = RMAKER_VAL_TYPE_ARRAY;
-                    param_found = true;
-                }
-                break;
+            break;
+        case RMAKER_VAL_TYPE_INTEGER:
+        case RMAKER_VAL_TYPE_FLOAT: {
+            /* The payload is not NULL terminated, so a copy is required for strtol/strtof */
+            char num_buf[32];
+            if ((tok->type != JSMN_PRIMITIVE) || (val_len <= 0) || (val_len >= sizeof(num_buf))) {
+                return ESP_ERR_INVALID_ARG;
             }
-            default:
-                break;
+            memcpy(num_buf, val_str, val_len);
+            num_buf[val_len] = '\0';
+            if (param->val.type == RMAKER_VAL_TYPE_INTEGER) {
+                new_val->val.i = strtol(num_buf, NULL, 10);
+            } else {
+                new_val->val.f = strtof(num_buf, NULL);
+            }
+            break;
         }
-        if (param_found) {
-            /* Special handling for ESP_RMAKER_PARAM_NAME. Just update the name instead
-             * of calling the registered callback.
-             */
-            if (param->type && (strcmp(param->type, ESP_RMAKER_PARAM_NAME) == 0)) {
+        case RMAKER_VAL_TYPE_STRING:
+        case RMAKER_VAL_TYPE_OBJECT:
+        case RMAKER_VAL_TYPE_ARRAY: {
+            jsmntype_t expected_type = (param->val.type == RMAKER_VAL_TYPE_STRING) ? JSMN_STRING :
+                    ((param->val.type == RMAKER_VAL_TYPE_OBJECT) ? JSMN_OBJECT : JSMN_ARRAY);
+            if (tok->type != expected_type) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            char *val_view = (char *)val_str;
+            *saved_char = val_view[val_len];
+            val_view[val_len] = '\0';
+            new_val->val.s = val_view;
+            break;
+        }
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+    new_val->type = param->val.type;
+    return ESP_OK;
+}
+
+void esp_rmaker_device_write_param(_esp_rmaker_device_t *device, _esp_rmaker_param_t *param,
+        esp_rmaker_param_val_t new_val, esp_rmaker_req_src_t src)
+{
+    /* Special handling for ESP_RMAKER_PARAM_NAME. Just update the name instead
+     * of calling the registered callback.
+     */
+    if (param->type && (strcmp(param->type, ESP_RMAKER_PARAM_NAME) == 0)) {
 #ifdef CONFIG_RMAKER_NAME_PARAM_CB
-                if (device->write_cb) {
-                    esp_rmaker_write_ctx_t ctx = {
-                        .src = src,
-                    };
-                    device->write_cb((esp_rmaker_device_t *)device, (esp_rmaker_param_t *)param,
-                                new_val, device->priv_data, &ctx);
-                } else {
-                    esp_rmaker_param_update_and_report((esp_rmaker_param_t *)param, new_val);
-                }
+        if (device->write_cb) {
+            esp_rmaker_write_ctx_t ctx = {
+                .src = src,
+            };
+            device->write_cb((esp_rmaker_device_t *)device, (esp_rmaker_param_t *)param,
+                        new_val, device->priv_data, &ctx);
+        } else {
+            esp_rmaker_param_update_and_report((esp_rmaker_param_t *)param, new_val);
+        }
 #else
-                esp_rmaker_param_update_and_report((esp_rmaker_param_t *)param, new_val);
+        esp_rmaker_param_update_and_report((esp_rmaker_param_t *)param, new_val);
 #endif
-            } else if (device->write_cb) {
-                esp_rmaker_write_ctx_t ctx = {
-                    .src = src,
-                };
-                if (device->write_cb((esp_rmaker_device_t *)device, (esp_rmaker_param_t *)param,
-                            new_val, device->priv_data, &ctx) != ESP_OK) {
-                    ESP_LOGE(TAG, "Remote update to param %s - %s failed", device->name, param->name);
-                }
-            }
-            if ((new_val.type == RMAKER_VAL_TYPE_STRING) || (new_val.type == RMAKER_VAL_TYPE_OBJECT ||
-                        (new_val.type == RMAKER_VAL_TYPE_ARRAY))) {
-                if (new_val.val.s) {
-                    free(new_val.val.s);
+    } else if (device->write_cb) {
+        esp_rmaker_write_ctx_t ctx = {
+            .src = src,
+        };
+        ESP_RMAKER_TRACE(RMAKER_TRACE_CB_START, src);
+        esp_err_t err = device->write_cb((esp_rmaker_device_t *)device, (esp_rmaker_param_t *)param,
+                    new_val, device->priv_data, &ctx);
+        ESP_RMAKER_TRACE(RMAKER_TRACE_CB_END, err != ESP_OK);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Remote update to param %s - %s failed", device->name, param->name);
+        }
+    }
+}
+
+/* Goes through the keys of the device's JSON object just once, looking up each in the device's
+ * param index, rather than searching the JSON for every param of the device.
+ */
+static esp_err_t esp_rmaker_device_set_params(_esp_rmaker_device_t *device, jparse_ctx_t *jptr,
+        json_tok_t *device_obj, esp_rmaker_req_src_t src, esp_rmaker_param_write_fn_t write_fn)
+{
+    json_tok_t *end = jptr->tokens + jptr->num_tokens;
+    json_tok_t *key = device_obj + 1;
+    ESP_RMAKER_TRACE(RMAKER_TRACE_DISPATCH, device_obj->size);
+    for (int i = 0; (i < device_obj->size) && ((key + 1) < end); i++) {
+        json_tok_t *val = key + 1;
+        /* The lock is not held while calling write_fn, so that the callbacks can update the params */
+        esp_rmaker_model_rdlock();
+        _esp_rmaker_param_t *param = esp_rmaker_name_index_find(&device->param_index,
+                jptr->js + key->start, key->end - key->start);
+        esp_rmaker_model_rdunlock();
+        if (param) {
+            esp_rmaker_param_val_t new_val = {0};
+            char saved_char = 0;
+            if (esp_rmaker_param_get_val_from_tok(param, jptr, val, &new_val, &saved_char) == ESP_OK) {
+                write_fn(device, param, new_val, src);
+                if ((new_val.type == RMAKER_VAL_TYPE_STRING) || (new_val.type == RMAKER_VAL_TYPE_OBJECT ||
+                            (new_val.type == RMAKER_VAL_TYPE_ARRAY))) {
+                    /* Restore the payload which was modified for NULL terminating the value */
+                    new_val.val.s[val->end - val->start] = saved_char;
                 }
             }
         }
-        param = param->next;
+        key = esp_rmaker_json_skip_tok(jptr, val);
     }
     return ESP_OK;
 }
 
-esp_err_t esp_rmaker_handle_set_params(char *data, size_t data_len, esp_rmaker_req_src_t src)
+static esp_err_t esp_rmaker_params_decode_json(_esp_rmaker_node_t *node, char *data, size_t data_len,
+        esp_rmaker_req_src_t src, esp_rmaker_param_write_fn_t write_fn)
 {
-    ESP_LOGI(TAG, "Received params: %.*s", data_len, data);
     jparse_ctx_t jctx;
     if (json_parse_start(&jctx, data, data_len) != 0) {
         return ESP_FAIL;
     }
-    _esp_rmaker_device_t *device = esp_rmaker_node_get_first_device(esp_rmaker_get_node());
-    while (device) {
-        if (json_obj_get_object(&jctx, device->name) == 0) {
-            esp_rmaker_device_set_params(device, &jctx, src);
-            json_obj_leave_object(&jctx);
+    json_tok_t *node_obj = jctx.tokens;
+    if ((jctx.num_tokens > 0) && (node_obj->type == JSMN_OBJECT)) {
+        ESP_RMAKER_TRACE(RMAKER_TRACE_PARSE, node_obj->size);
+        json_tok_t *end = jctx.tokens + jctx.num_tokens;
+        json_tok_t *key = node_obj + 1;
+        for (int i = 0; (i < node_obj->size) && ((key + 1) < end); i++) {
+            json_tok_t *val = key + 1;
+            if (val->type == JSMN_OBJECT) {
+                esp_rmaker_model_rdlock();
+                _esp_rmaker_device_t *device = esp_rmaker_name_index_find(&node->device_index,
+                        jctx.js + key->start, key->end - key->start);
+                esp_rmaker_model_rdunlock();
+                if (device) {
+                    esp_rmaker_device_set_params(device, &jctx, val, src, write_fn);
+                }
+            }
+            key = esp_rmaker_json_skip_tok(&jctx, val);
         }
-        device = device->next;
     }
     json_parse_end(&jctx);
     return ESP_OK;
 }
 
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+/* Decodes the value as per the type of the param. For strings, objects and arrays, a NULL terminated
+ * copy is allocated, which the caller should free. Returns ESP_ERR_INVALID_ARG if the value is not
+ * of the param's type, in which case the value still needs to be skipped.
+ */
+static esp_err_t esp_rmaker_param_get_val_from_cbor(_esp_rmaker_param_t *param, esp_rmaker_cbor_dec_t *dec,
+        esp_rmaker_cbor_item_t *item, esp_rmaker_param_val_t *new_val)
+{
+    esp_err_t err;
+    switch (param->val.type) {
+        case RMAKER_VAL_TYPE_BOOLEAN:
+            if ((item->major != CBOR_MAJOR_SIMPLE) ||
+                    ((item->info != CBOR_SIMPLE_TRUE) && (item->info != CBOR_SIMPLE_FALSE))) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            new_val->val.b = (item->info == CBOR_SIMPLE_TRUE);
+            break;
+        case RMAKER_VAL_TYPE_INTEGER:
+            /* CBOR integers are 64 bit wide. Anything not fitting in an int is rejected, instead of being
+             * converted, since that is undefined. For negative integers, the value is -1 - item->val.
+             */
+            if ((item->major == CBOR_MAJOR_UINT) && (item->val <= INT_MAX)) {
+                new_val->val.i = (int)item->val;
+            } else if ((item->major == CBOR_MAJOR_NINT) && (item->val <= INT_MAX)) {
+                new_val->val.i = -1 - (int)item->val;
+            } else {
+                return ESP_ERR_INVALID_ARG;
+            }
+            break;
+        case RMAKER_VAL_TYPE_FLOAT: {
+            double num;
+            if (item->major == CBOR_MAJOR_UINT) {
+                num = (double)item->val;
+            } else if (item->major == CBOR_MAJOR_NINT) {
+                num = -1.0 - (double)item->val;
+            } else if ((item->major == CBOR_MAJOR_SIMPLE) &&
+                    (item->info >= CBOR_SIMPLE_FLOAT16) && (item->info <= CBOR_SIMPLE_FLOAT64)) {
+                num = item->f;
+            } else {
+                return ESP_ERR_INVALID_ARG;
+            }
+            /* Converting a finite double beyond the range of float is undefined too */
+            if (isfinite(num) && (fabs(num) > FLT_MAX)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            new_val->val.f = (float)num;
+            break;
+        }
+        case RMAKER_VAL_TYPE_STRING:
+        case RMAKER_VAL_TYPE_OBJECT:
+        case RMAKER_VAL_TYPE_ARRAY:
+            /* Objects and arrays are embedded as JSON text, optionally tagged as such */
+            if ((param->val.type != RMAKER_VAL_TYPE_STRING) && (item->major == CBOR_MAJOR_TAG)) {
+                if (item->val != CBOR_TAG_EMBEDDED_JSON) {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                if ((err = esp_rmaker_cbor_dec_next(dec, item)) != ESP_OK) {
+                    return err;
+                }
+            }
+            if ((item->major != CBOR_MAJOR_TEXT) || item->indefinite) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            new_val->val.s = strndup((const char *)item->data, item->val);
+            if (!new_val->val.s) {
+                return ESP_ERR_NO_MEM;
+            }
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+    new_val->type = param->val.type;
+    return ESP_OK;
+}
+
+static esp_err_t esp_rmaker_params_decode_cbor(_esp_rmaker_node_t *node, const uint8_t *data, size_t data_len,
+        esp_rmaker_req_src_t src, esp_rmaker_param_write_fn_t write_fn)
+{
+    esp_rmaker_cbor_dec_t dec;
+    esp_rmaker_cbor_item_t node_map, device_map, key, val;
+    esp_rmaker_cbor_dec_init(&dec, data, data_len);
+    if ((esp_rmaker_cbor_dec_next(&dec, &node_map) != ESP_OK) || (node_map.major != CBOR_MAJOR_MAP)) {
+        return ESP_FAIL;
+    }
+    ESP_RMAKER_TRACE(RMAKER_TRACE_PARSE, node_map.indefinite ? 0 : node_map.val);
+    for (uint64_t i = 0; esp_rmaker_cbor_dec_has_more(&dec, &node_map, i); i += 2) {
+        if ((esp_rmaker_cbor_dec_next(&dec, &key) != ESP_OK) || (key.major != CBOR_MAJOR_TEXT) || key.indefinite ||
+                (esp_rmaker_cbor_dec_next(&dec, &device_map) != ESP_OK)) {
+            return ESP_FAIL;
+        }
+        _esp_rmaker_device_t *device = NULL;
+        if (device_map.major == CBOR_MAJOR_MAP) {
+            esp_rmaker_model_rdlock();
+            device = esp_rmaker_name_index_find(&node->device_index, (const char *)key.data, key.val);
+            esp_rmaker_model_rdunlock();
+        }
+        if (!device) {
+            if (esp_rmaker_cbor_dec_skip(&dec, &device_map) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            continue;
+        }
+        ESP_RMAKER_TRACE(RMAKER_TRACE_DISPATCH, device_map.indefinite ? 0 : device_map.val);
+        for (uint64_t j = 0; esp_rmaker_cbor_dec_has_more(&dec, &device_map, j); j += 2) {
+            if ((esp_rmaker_cbor_dec_next(&dec, &key) != ESP_OK) || (key.major != CBOR_MAJOR_TEXT) || key.indefinite ||
+                    (esp_rmaker_cbor_dec_next(&dec, &val) != ESP_OK)) {
+                return ESP_FAIL;
+            }
+            esp_rmaker_model_rdlock();
+            _esp_rmaker_param_t *param = esp_rmaker_name_index_find(&device->param_index,
+                    (const char *)key.data, key.val);
+            esp_rmaker_model_rdunlock();
+            esp_rmaker_param_val_t new_val = {0};
+            esp_err_t err = ESP_ERR_NOT_FOUND;
+            if (param) {
+                err = esp_rmaker_param_get_val_from_cbor(param, &dec, &val, &new_val);
+            }
+            if (err == ESP_OK) {
+                write_fn(device, param, new_val, src);
+                if ((new_val.type == RMAKER_VAL_TYPE_STRING) || (new_val.type == RMAKER_VAL_TYPE_OBJECT) ||
+                        (new_val.type == RMAKER_VAL_TYPE_ARRAY)) {
+                    free(new_val.val.s);
+                }
+            } else if (esp_rmaker_cbor_dec_skip(&dec, &val) != ESP_OK) {
+                return ESP_FAIL;
+            }
+        }
+    }
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_RMAKER_PARAM_CBOR */
+
+esp_err_t esp_rmaker_params_decode(_esp_rmaker_node_t *node, char *data, size_t data_len,
+        esp_rmaker_req_src_t src, esp_rmaker_param_write_fn_t write_fn)
+{
+    if (!node || !data || !data_len || !write_fn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    if (CBOR_IS_MAP(data[0])) {
+        return esp_rmaker_params_decode_cbor(node, (const uint8_t *)data, data_len, src, write_fn);
+    }
+#endif
+    return esp_rmaker_params_decode_json(node, data, data_len, src, write_fn);
+}
+
+esp_err_t esp_rmaker_handle_set_params(char *data, size_t data_len, esp_rmaker_req_src_t src)
+{
+    ESP_RMAKER_TRACE(RMAKER_TRACE_RECV, data_len);
+    ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_SET_PARAMS, 1);
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#ifdef CONFIG_ESP_RMAKER_PARAM_CBOR
+    bool cbor = data_len && CBOR_IS_MAP(data[0]);
+    /* Reports follow whichever encoding the cloud last used */
+    if (src == ESP_RMAKER_REQ_SRC_CLOUD) {
+        s_params_cbor = cbor;
+    }
+    if (cbor) {
+        ESP_LOGI(TAG, "Received params (CBOR): %d bytes", data_len);
+    } else
+#endif
+    {
+        ESP_LOGI(TAG, "Received params: %.*s", data_len, data);
+    }
+    esp_err_t err = esp_rmaker_params_decode(node, data, data_len, src, esp_rmaker_device_write_param);
+    ESP_RMAKER_TRACE(RMAKER_TRACE_DONE, 0);
+    return err;
+}
+
 static void esp_rmaker_set_params_callback(const char *topic, void *payload, size_t payload_len, void *priv_data)
 {
     esp_rmaker_handle_set_params((char *)payload, payload_len, ESP_RMAKER_REQ_SRC_CLOUD);
@@ -417,12 +1010,10 @@ static void esp_rmaker_set_params_callback(const char *topic, void *payload, siz
 
 static esp_err_t esp_rmaker_register_for_set_params(void)
 {
-    char subscribe_topic[MQTT_TOPIC_BUFFER_SIZE];
-    snprintf(subscribe_topic, sizeof(subscribe_topic), "node/%s/%s",
-                esp_rmaker_get_node_id(), NODE_PARAMS_REMOTE_TOPIC_SUFFIX);
-    esp_err_t err = esp_rmaker_mqtt_subscribe(subscribe_topic, esp_rmaker_set_params_callback, RMAKER_MQTT_QOS1, NULL);
+    esp_err_t err = esp_rmaker_mqtt_node_subscribe(NODE_PARAMS_REMOTE_TOPIC_SUFFIX, esp_rmaker_set_params_callback,
+                RMAKER_MQTT_QOS1, NULL);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", subscribe_topic, err);
+        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", NODE_PARAMS_REMOTE_TOPIC_SUFFIX, err);
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -470,33 +1061,6 @@ esp_err_t esp_rmaker_param_get_stored_value(_esp_rmaker_param_t *param, esp_rmak
     return err;
 }
 
-esp_err_t esp_rmaker_param_store_value(_esp_rmaker_param_t *param)
-{
-    if (!param || !param->parent) {
-        return ESP_FAIL;
-    }
-    nvs_handle handle;
-    esp_err_t err = nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, param->parent->name, NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        return err;
-    }
-    if ((param->val.type == RMAKER_VAL_TYPE_STRING) || (param->val.type == RMAKER_VAL_TYPE_OBJECT) ||
-                (param->val.type == RMAKER_VAL_TYPE_ARRAY)) {
-        /* Store only if value is not NULL */
-        if (param->val.val.s) {
-            err = nvs_set_blob(handle, param->name, param->val.val.s, strlen(param->val.val.s));
-            nvs_commit(handle);
-        } else {
-            err = ESP_OK;
-        }
-    } else {
-        err = nvs_set_blob(handle, param->name, &param->val, sizeof(esp_rmaker_param_val_t));
-        nvs_commit(handle);
-    }
-    nvs_close(handle);
-    return err;
-}
-
 esp_rmaker_param_val_t *esp_rmaker_param_get_val(esp_rmaker_param_t *param)
 {
     if (!param) {
@@ -506,20 +1070,63 @@ esp_rmaker_param_val_t *esp_rmaker_param_get_val(esp_rmaker_param_t *param)
     return &((_esp_rmaker_param_t *)param)->val;
 }
 
+/* Copies the string value into the param's existing buffer, allocating a new one only if
+ * the existing one is not large enough. The string may point into the existing buffer itself.
+ */
+static esp_err_t esp_rmaker_param_store_str(_esp_rmaker_param_t *param, const char *str)
+{
+    if (!str) {
+        if (param->val.val.s) {
+            free(param->val.val.s);
+        }
+        param->val.val.s = NULL;
+        param->val_buf_size = 0;
+        return ESP_OK;
+    }
+    size_t size = strlen(str) + 1;
+    if (size > param->val_buf_size) {
+        char *new_buf = malloc(size);
+        if (!new_buf) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(new_buf, str, size);
+        if (param->val.val.s) {
+            free(param->val.val.s);
+        }
+        param->val.val.s = new_buf;
+        param->val_buf_size = size;
+    } else {
+        memmove(param->val.val.s, str, size);
+    }
+    return ESP_OK;
+}
+
 esp_err_t esp_rmaker_param_delete(const esp_rmaker_param_t *param)
 {
     _esp_rmaker_param_t *_param = (_esp_rmaker_param_t *)param;
     if (_param) {
         if (_param->name) {
-            free(_param->name);
+            esp_rmaker_model_free(_param->name);
+        }
+        if (_param->bounds) {
+            esp_rmaker_model_free(_param->bounds);
+        }
+        if (_param->valid_str_list) {
+            esp_rmaker_model_free(_param->valid_str_list);
         }
-        if (_param->type) {
-            free(_param->type);
+        if (_param->ts_compress) {
+            esp_rmaker_model_free(_param->ts_compress);
         }
-        if (_param->ui_type) {
-            free(_param->ui_type);
+#ifdef CONFIG_ESP_RMAKER_TS_BATCH
+        esp_rmaker_param_ts_free(_param);
+#endif
+        if ((_param->val.type == RMAKER_VAL_TYPE_STRING) || (_param->val.type == RMAKER_VAL_TYPE_OBJECT) ||
+                (_param->val.type == RMAKER_VAL_TYPE_ARRAY)) {
+            if (_param->val.val.s) {
+                free(_param->val.val.s);
+            }
         }
-        free(_param);
+        esp_rmaker_model_free(_param);
         return ESP_OK;
     }
     return ESP_ERR_INVALID_ARG;
@@ -538,18 +1145,18 @@ esp_rmaker_param_t *esp_rmaker_param_create(const char *param_name, const char *
             return NULL;
         }
     }
-    _esp_rmaker_param_t *param = calloc(1, sizeof(_esp_rmaker_param_t));
+    _esp_rmaker_param_t *param = esp_rmaker_model_calloc(1, sizeof(_esp_rmaker_param_t));
     if (!param) {
         ESP_LOGE(TAG, "Failed to allocate memory for param %s", param_name);
         return NULL;
     }
-    param->name = strdup(param_name);
+    param->name = esp_rmaker_model_strdup(param_name);
     if (!param->name) {
         ESP_LOGE(TAG, "Failed to allocate memory for name for param %s.", param_name);
         goto param_create_err;
     }
     if (type) {
-        param->type = strdup(type);
+        param->type = esp_rmaker_model_intern(type);
         if (!param->type) {
             ESP_LOGE(TAG, "Failed to allocate memory for type for param %s.", param_name);
             goto param_create_err;
@@ -559,15 +1166,13 @@ esp_rmaker_param_t *esp_rmaker_param_create(const char *param_name, const char *
     param->prop_flags = properties;
     if ((val.type == RMAKER_VAL_TYPE_STRING) || (val.type == RMAKER_VAL_TYPE_OBJECT) ||
                 (val.type == RMAKER_VAL_TYPE_ARRAY)) {
-        if (val.val.s) {
-             param->val.val.s = strdup(val.val.s);
-             if (!param->val.val.s) {
-                 ESP_LOGE(TAG, "Failed to allocate memory for the value of param %s.", param_name);
-             }
+        if (esp_rmaker_param_store_str(param, val.val.s) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate memory for the value of param %s.", param_name);
         }
     } else {
         param->val.val = val.val;
     }
+    esp_rmaker_param_update_json_len(param);
     if (properties & PROP_FLAG_TIME_SERIES) {
         /* Time series params will require time sync */
         esp_rmaker_time_sync_init(NULL);
@@ -595,7 +1200,7 @@ esp_err_t esp_rmaker_param_add_bounds(const esp_rmaker_param_t *param,
         ESP_LOGE(TAG, "Cannot set bounds for %s because of value type mismatch.", _param->name);
         return ESP_ERR_INVALID_ARG;
     }
-    esp_rmaker_param_bounds_t *bounds = calloc(1, sizeof(esp_rmaker_param_bounds_t));
+    esp_rmaker_param_bounds_t *bounds = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_param_bounds_t));
     if (!bounds) {
         ESP_LOGE(TAG, "Failed to allocate memory for parameter bounds.");
         return ESP_ERR_NO_MEM;
@@ -604,9 +1209,10 @@ esp_err_t esp_rmaker_param_add_bounds(const esp_rmaker_param_t *param,
     bounds->max = max;
     bounds->step = step;
     if (_param->bounds) {
-        free(_param->bounds);
+        esp_rmaker_model_free(_param->bounds);
     }
     _param->bounds = bounds;
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -621,7 +1227,7 @@ esp_err_t esp_rmaker_param_add_valid_str_list(const esp_rmaker_param_t *param, c
         ESP_LOGE(TAG, "Only string params can have valid strings array.");
         return ESP_ERR_INVALID_ARG;
     }
-    esp_rmaker_param_valid_str_list_t *valid_str_list = calloc(1, sizeof(esp_rmaker_param_valid_str_list_t));
+    esp_rmaker_param_valid_str_list_t *valid_str_list = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_param_valid_str_list_t));
     if (!valid_str_list) {
         ESP_LOGE(TAG, "Failed to allocate memory for valid strings array.");
         return ESP_ERR_NO_MEM;
@@ -629,9 +1235,10 @@ esp_err_t esp_rmaker_param_add_valid_str_list(const esp_rmaker_param_t *param, c
     valid_str_list->str_list = strs;
     valid_str_list->str_list_cnt = count;
     if (_param->valid_str_list) {
-        free(_param->valid_str_list);
+        esp_rmaker_model_free(_param->valid_str_list);
     }
     _param->valid_str_list = valid_str_list;
+    esp_rmaker_node_config_invalidate();
   return ESP_OK;
 }
 
@@ -646,16 +1253,17 @@ esp_err_t esp_rmaker_param_add_array_max_count(const esp_rmaker_param_t *param,
         ESP_LOGE(TAG, "Only array params can have max count.");
         return ESP_ERR_INVALID_ARG;
     }
-    esp_rmaker_param_bounds_t *bounds = calloc(1, sizeof(esp_rmaker_param_bounds_t));
+    esp_rmaker_param_bounds_t *bounds = esp_rmaker_model_calloc(1, sizeof(esp_rmaker_param_bounds_t));
     if (!bounds) {
         ESP_LOGE(TAG, "Failed to allocate memory for parameter bounds.");
         return ESP_ERR_NO_MEM;
     }
     bounds->max = esp_rmaker_int(count);
     if (_param->bounds) {
-        free(_param->bounds);
+        esp_rmaker_model_free(_param->bounds);
     }
     _param->bounds = bounds;
+    esp_rmaker_node_config_invalidate();
     return ESP_OK;
 }
 
@@ -666,10 +1274,8 @@ esp_err_t esp_rmaker_param_add_ui_type(const esp_rmaker_param_t *param, const ch
         return ESP_ERR_INVALID_ARG;
     }
     _esp_rmaker_param_t *_param = (_esp_rmaker_param_t *)param;
-    if (_param->ui_type) {
-        free(_param->ui_type);
-    }
-    if ((_param->ui_type = strdup(ui_type)) != NULL ) {
+    if ((_param->ui_type = esp_rmaker_model_intern(ui_type)) != NULL ) {
+        esp_rmaker_node_config_invalidate();
         return ESP_OK;
     } else {
         return ESP_ERR_NO_MEM;
@@ -687,35 +1293,83 @@ esp_err_t esp_rmaker_param_update(const esp_rmaker_param_t *param, esp_rmaker_pa
         ESP_LOGE(TAG, "New param value type not same as the existing one.");
         return ESP_ERR_INVALID_ARG;
     }
+    esp_err_t err = ESP_OK;
+    esp_rmaker_model_wrlock();
     switch (_param->val.type) {
         case RMAKER_VAL_TYPE_STRING:
         case RMAKER_VAL_TYPE_OBJECT:
-        case RMAKER_VAL_TYPE_ARRAY: {
-            char *new_val = NULL;
-            if (val.val.s) {
-                new_val = strdup(val.val.s);
-                if (!new_val) {
-                    return ESP_FAIL;
-                }
-            }
-            if (_param->val.val.s) {
-                free(_param->val.val.s);
+        case RMAKER_VAL_TYPE_ARRAY:
+            if (esp_rmaker_param_store_str(_param, val.val.s) != ESP_OK) {
+                err = ESP_FAIL;
             }
-            _param->val.val.s = new_val;
             break;
-        }
         case RMAKER_VAL_TYPE_BOOLEAN:
         case RMAKER_VAL_TYPE_INTEGER:
         case RMAKER_VAL_TYPE_FLOAT:
             _param->val.val = val.val;
             break;
         default:
-            return ESP_ERR_INVALID_ARG;
+            err = ESP_ERR_INVALID_ARG;
+    }
+    if (err == ESP_OK) {
+        esp_rmaker_param_update_json_len(_param);
+        esp_rmaker_param_mark_dirty(_param, RMAKER_PARAM_FLAG_VALUE_CHANGE);
+        if (_param->prop_flags & PROP_FLAG_PERSIST) {
+            esp_rmaker_param_persist(_param);
+        }
+    }
+    esp_rmaker_model_wrunlock();
+    return err;
+}
+
+#ifdef CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE
+static void esp_rmaker_param_report_work_cb(void *priv_data)
+{
+    esp_rmaker_report_param_internal(RMAKER_PARAM_FLAG_VALUE_CHANGE);
+}
+
+static void esp_rmaker_param_report_timer_cb(TimerHandle_t handle)
+{
+    if (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_NORMAL, esp_rmaker_param_report_work_cb, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue the coalesced param report.");
+    }
+}
+
+/* The coalescing window starts with the first update after a report. All updates received till
+ * the window expires just get their flags set and are reported together by the work queue.
+ */
+static esp_err_t esp_rmaker_param_schedule_report(void)
+{
+    if (!s_param_report_timer) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTimerIsTimerActive(s_param_report_timer) == pdFALSE) {
+        if (xTimerStart(s_param_report_timer, 0) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start param report timer.");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE */
+
+/* Called from esp_rmaker_init(), before any param exists, so that the timer is not created
+ * concurrently by the tasks reporting params.
+ */
+esp_err_t esp_rmaker_params_report_init(void)
+{
+#ifdef CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE
+    if (s_param_report_timer) {
+        return ESP_OK;
     }
-    _param->flags |= RMAKER_PARAM_FLAG_VALUE_CHANGE;
-    if (_param->prop_flags & PROP_FLAG_PERSIST) {
-        esp_rmaker_param_store_value(_param);
+    s_param_report_timer = xTimerCreate("param_report_tm",
+            pdMS_TO_TICKS(CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE_WINDOW),
+            pdFALSE, NULL, esp_rmaker_param_report_timer_cb);
+    if (!s_param_report_timer) {
+        ESP_LOGE(TAG, "Failed to create param report timer.");
+        return ESP_ERR_NO_MEM;
     }
+#endif
     return ESP_OK;
 }
 
@@ -725,20 +1379,42 @@ esp_err_t esp_rmaker_param_report(const esp_rmaker_param_t *param)
         ESP_LOGE(TAG, "Param handle cannot be NULL.");
         return ESP_ERR_INVALID_ARG;
     }
+#ifdef CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE
+    if (esp_rmaker_param_schedule_report() == ESP_OK) {
+        return ESP_OK;
+    }
+    /* Fall back to reporting immediately */
+#endif
+    return esp_rmaker_report_param_internal(RMAKER_PARAM_FLAG_VALUE_CHANGE);
+}
+
+esp_err_t esp_rmaker_param_report_flush(void)
+{
+#ifdef CONFIG_ESP_RMAKER_PARAM_REPORT_COALESCE
+    if (s_param_report_timer) {
+        xTimerStop(s_param_report_timer, 0);
+    }
+#endif
+    if (esp_rmaker_get_state() != ESP_RMAKER_STATE_STARTED) {
+        return ESP_ERR_INVALID_STATE;
+    }
     return esp_rmaker_report_param_internal(RMAKER_PARAM_FLAG_VALUE_CHANGE);
 }
 
-static esp_err_t __esp_rmaker_param_report_time_series_records(json_gen_str_t *jptr, const _esp_rmaker_param_t *param)
+#ifndef CONFIG_ESP_RMAKER_TS_BATCH
+static esp_err_t __esp_rmaker_param_report_time_series_records(json_gen_str_t *jptr, const esp_rmaker_ts_sample_t *sample)
 {
     json_gen_start_object(jptr);
     time_t current_timestamp = 0;
     time(&current_timestamp);
+    current_timestamp -= (esp_timer_get_time() - sample->at) / 1000000;
     json_gen_obj_set_int(jptr, "t", (int)current_timestamp);
-    esp_rmaker_report_value(&param->val, "v", jptr);
+    esp_rmaker_report_value(&sample->val, "v", jptr);
     json_gen_end_object(jptr);
     return ESP_OK;
 }
-static esp_err_t __esp_rmaker_param_report_time_series(json_gen_str_t *jptr, const esp_rmaker_param_t *param)
+static esp_err_t __esp_rmaker_param_report_time_series(json_gen_str_t *jptr, const esp_rmaker_param_t *param,
+        const esp_rmaker_ts_sample_t *sample)
 {
     json_gen_start_object(jptr);
     char param_name[MAX_TS_DATA_PARAM_NAME];
@@ -754,13 +1430,13 @@ static esp_err_t __esp_rmaker_param_report_time_series(json_gen_str_t *jptr, con
     json_gen_obj_set_string(jptr, "name", param_name);
     esp_rmaker_report_data_type( _param->val.type, "dt", jptr);
     json_gen_push_array(jptr, "records");
-    __esp_rmaker_param_report_time_series_records(jptr, _param);
+    __esp_rmaker_param_report_time_series_records(jptr, sample);
     json_gen_pop_array(jptr);
     json_gen_end_object(jptr);
     return ESP_OK;
 }
 
-static esp_err_t esp_rmaker_param_report_time_series(const esp_rmaker_param_t *param)
+static esp_err_t esp_rmaker_param_report_time_series(const esp_rmaker_param_t *param, const esp_rmaker_ts_sample_t *sample)
 {
     if (!param) {
         ESP_LOGE(TAG, "Param handle cannot be NULL.");
@@ -774,33 +1450,67 @@ static esp_err_t esp_rmaker_param_report_time_series(const esp_rmaker_param_t *p
         ESP_LOGE(TAG, "Current time not yet available. Cannot report time series data.");
         return ESP_ERR_INVALID_STATE;
     }
-    /* node_params_buf will be NULL during the first publish */
-    char * node_params_buf = esp_rmaker_param_get_buf(max_node_params_size);
+    int buf_len = max_node_params_size;
+    char *node_params_buf = esp_rmaker_param_buf_acquire(buf_len);
     if (!node_params_buf) {
         return ESP_ERR_NO_MEM;
     }
     esp_err_t err;
     json_gen_str_t jstr;
-    int buf_len = max_node_params_size;
     json_gen_str_start(&jstr, node_params_buf, buf_len, NULL, NULL);
     json_gen_start_object(&jstr);
     json_gen_obj_set_string(&jstr, "ts_data_version", TS_DATA_VERSION);
     json_gen_push_array(&jstr, "ts_data");
-    if ((err = __esp_rmaker_param_report_time_series(&jstr, param)) != ESP_OK) {
+    if ((err = __esp_rmaker_param_report_time_series(&jstr, param, sample)) != ESP_OK) {
+        esp_rmaker_param_buf_release(node_params_buf);
         return err;
     }
     json_gen_pop_array(&jstr);
     json_gen_end_object(&jstr);
     json_gen_str_end(&jstr);
-    esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), TIME_SERIES_DATA_TOPIC_SUFFIX, TIME_SERIES_DATA_TOPIC_RULE);
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_TS_DATA);
     if (esp_rmaker_params_mqtt_init_done) {
         _esp_rmaker_param_t *_param = (_esp_rmaker_param_t *)param;
         _esp_rmaker_device_t *_device = _param->parent;
         ESP_LOGI(TAG, "Reporting Time Series Data for %s.%s", _device->name, _param->name);
-        esp_rmaker_mqtt_publish(publish_topic, node_params_buf, strlen(node_params_buf), RMAKER_MQTT_QOS1, NULL);
+        esp_rmaker_mqtt_publish_with_prio(publish_topic, node_params_buf, strlen(node_params_buf), RMAKER_MQTT_QOS1,
+                RMAKER_MQTT_PRIO_TS);
     }
+    esp_rmaker_param_buf_release(node_params_buf);
     return ESP_OK;
 }
+#endif /* !CONFIG_ESP_RMAKER_TS_BATCH */
+
+/* With CONFIG_ESP_RMAKER_TS_BATCH, the sample is recorded, to be reported along with others later */
+static esp_err_t esp_rmaker_param_record_time_series(const esp_rmaker_param_t *param, const esp_rmaker_ts_sample_t *sample)
+{
+#ifdef CONFIG_ESP_RMAKER_TS_BATCH
+    return esp_rmaker_param_ts_record((_esp_rmaker_param_t *)param, sample);
+#else
+    return esp_rmaker_param_report_time_series(param, sample);
+#endif
+}
+
+static esp_err_t esp_rmaker_param_handle_time_series(const esp_rmaker_param_t *param)
+{
+    /* The value is sampled and compressed under the lock, but recorded/reported after releasing it */
+    esp_rmaker_model_wrlock();
+    esp_rmaker_ts_sample_t current = {
+        .val = ((_esp_rmaker_param_t *)param)->val,
+        .at = esp_timer_get_time(),
+    };
+    esp_rmaker_ts_sample_t held;
+    esp_err_t err = ESP_OK;
+    uint8_t record = esp_rmaker_param_ts_compress((_esp_rmaker_param_t *)param, current.at, &held);
+    esp_rmaker_model_wrunlock();
+    if (record & RMAKER_TS_RECORD_HELD) {
+        err = esp_rmaker_param_record_time_series(param, &held);
+    }
+    if (record & RMAKER_TS_RECORD_CURRENT) {
+        err = esp_rmaker_param_record_time_series(param, &current);
+    }
+    return err;
+}
 
 esp_err_t esp_rmaker_param_notify(const esp_rmaker_param_t *param)
 {
@@ -808,7 +1518,10 @@ esp_err_t esp_rmaker_param_notify(const esp_rmaker_param_t *param)
         ESP_LOGE(TAG, "Param handle cannot be NULL.");
         return ESP_ERR_INVALID_ARG;
     }
-    ((_esp_rmaker_param_t *)param)->flags |= (RMAKER_PARAM_FLAG_VALUE_CHANGE | RMAKER_PARAM_FLAG_VALUE_NOTIFY);
+    esp_rmaker_model_wrlock();
+    esp_rmaker_param_mark_dirty((_esp_rmaker_param_t *)param,
+            RMAKER_PARAM_FLAG_VALUE_CHANGE | RMAKER_PARAM_FLAG_VALUE_NOTIFY);
+    esp_rmaker_model_wrunlock();
     esp_err_t err = esp_rmaker_report_param_internal(RMAKER_PARAM_FLAG_VALUE_NOTIFY);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "Failed to report parameter");
@@ -822,7 +1535,7 @@ esp_err_t esp_rmaker_param_update_and_report(const esp_rmaker_param_t *param, es
     /** Report parameter only if the RainMaker has started */
     if ((err == ESP_OK) && (esp_rmaker_get_state() == ESP_RMAKER_STATE_STARTED)) {
         if (((_esp_rmaker_param_t *)param)->prop_flags & PROP_FLAG_TIME_SERIES) {
-            esp_rmaker_param_report_time_series(param);
+            esp_rmaker_param_handle_time_series(param);
         }
         err = esp_rmaker_param_report(param);
     }
@@ -835,7 +1548,7 @@ esp_err_t esp_rmaker_param_update_and_notify(const esp_rmaker_param_t *param, es
     /** Report parameter only if the RainMaker has started */
     if ((err == ESP_OK) && (esp_rmaker_get_state() == ESP_RMAKER_STATE_STARTED)) {
         if (((_esp_rmaker_param_t *)param)->prop_flags & PROP_FLAG_TIME_SERIES) {
-            esp_rmaker_param_report_time_series(param);
+            esp_rmaker_param_handle_time_series(param);
         }
         err = esp_rmaker_param_notify(param);
     }
@@ -849,7 +1562,7 @@ static esp_err_t esp_rmaker_report_all_ts_params(void)
         _esp_rmaker_param_t *param = device->params;
         while (param) {
             if (param->prop_flags & PROP_FLAG_TIME_SERIES) {
-                esp_rmaker_param_report_time_series((esp_rmaker_param_t *)param);
+                esp_rmaker_param_handle_time_series((esp_rmaker_param_t *)param);
             }
             param = param->next;
         }
@@ -861,33 +1574,60 @@ static esp_err_t esp_rmaker_report_all_ts_params(void)
 
 esp_err_t esp_rmaker_report_node_state(void)
 {
-    esp_err_t err = esp_rmaker_allocate_and_populate_params(0, false);
+    char *node_params_buf = NULL;
+    size_t params_len = 0;
+    esp_err_t err = esp_rmaker_allocate_and_populate_params(0, false, &node_params_buf, &params_len, NULL);
     if (err == ESP_OK) {
-        /* Just checking if there are indeed any params to report by comparing with a decent enough
-         * length as even the smallest possible data, Eg. '{"d":{"p":0}}' will be > 10 bytes.
-         */
-        char *node_params_buf = esp_rmaker_param_get_buf(0);
-        if (strlen(node_params_buf) > 10) {
-            esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), NODE_PARAMS_LOCAL_INIT_TOPIC_SUFFIX, NODE_PARAMS_LOCAL_INIT_RULE);
-            ESP_LOGI(TAG, "Reporting params (init): %s", node_params_buf);
+        if (params_len > RMAKER_PARAMS_EMPTY_LEN) {
+            const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_PARAMS_LOCAL_INIT);
+            esp_rmaker_log_params("Reporting params (init)", node_params_buf, params_len);
             if (esp_rmaker_params_mqtt_init_done) {
-                esp_rmaker_mqtt_publish(publish_topic, node_params_buf, strlen(node_params_buf), RMAKER_MQTT_QOS1, NULL);
+                esp_rmaker_mqtt_publish_with_prio(publish_topic, node_params_buf, params_len, RMAKER_MQTT_QOS1,
+                        RMAKER_MQTT_PRIO_PARAMS);
             } else {
                 ESP_LOGW(TAG, "Not reporting params since params mqtt not initialized yet.");
             }
         }
+        esp_rmaker_param_buf_release(node_params_buf);
         /* Report all Time Series Params separately */
         return esp_rmaker_report_all_ts_params();
     }
     return err;
 }
 
+static void esp_rmaker_report_offline_changes(void *priv_data)
+{
+    if (esp_rmaker_get_state() == ESP_RMAKER_STATE_STARTED) {
+        esp_rmaker_report_param_internal(RMAKER_PARAM_FLAG_VALUE_CHANGE);
+    }
+}
+
+static void esp_rmaker_param_mqtt_event_handler(void* arg, esp_event_base_t event_base,
+                          int32_t event_id, void* event_data)
+{
+    if (event_id == RMAKER_MQTT_EVENT_DISCONNECTED) {
+        s_mqtt_offline = true;
+    } else if ((event_id == RMAKER_MQTT_EVENT_CONNECTED) && s_mqtt_offline) {
+        s_mqtt_offline = false;
+        /* The cloud retains the node state across reconnections. So, only the params changed
+         * while offline are reported, instead of the complete node state.
+         */
+        esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_NORMAL, esp_rmaker_report_offline_changes, NULL);
+    }
+}
+
 esp_err_t esp_rmaker_params_mqtt_init(void)
 {
     /* Subscribe for parameter update requests */
     esp_err_t err = esp_rmaker_register_for_set_params();
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Params MQTT Init done.");
+        if (!esp_rmaker_params_mqtt_init_done) {
+            esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_CONNECTED,
+                    &esp_rmaker_param_mqtt_event_handler, NULL);
+            esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_DISCONNECTED,
+                    &esp_rmaker_param_mqtt_event_handler, NULL);
+        }
         esp_rmaker_params_mqtt_init_done = true;
         /* Report the current node state i.e. values of all the node parameters */
         esp_rmaker_report_node_state();
@@ -919,7 +1659,10 @@ esp_err_t esp_rmaker_raise_alert(const char *alert_str)
     strlcpy(msg, alert_str, sizeof(msg));
     char buf[ESP_RMAKER_MAX_ALERT_LEN + RMAKER_ALERT_STR_MARGIN];
     snprintf(buf, sizeof(buf), "{\"%s\":\"%s\"}", ESP_RMAKER_ALERT_KEY, msg);
-    esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), NODE_PARAMS_ALERT_TOPIC_SUFFIX, NODE_PARAMS_ALERT_TOPIC_RULE);
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_ALERT);
     ESP_LOGI(TAG, "Reporting alert: %s", buf);
-    return esp_rmaker_mqtt_publish(publish_topic, buf, strlen(buf), RMAKER_MQTT_QOS1, NULL);
+    esp_err_t err = esp_rmaker_mqtt_publish_with_prio(publish_topic, buf, strlen(buf), RMAKER_MQTT_QOS1,
+            RMAKER_MQTT_PRIO_ALERT);
+    /* Queued alerts are considered raised, as they were before the queue was added */
+    return (err == ESP_ERR_NOT_FINISHED) ? ESP_OK : err;
 }
@@ -0,0 +1,370 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <string.h>
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_system.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <freertos/semphr.h>
+
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_lock.h"
+#include "esp_rmaker_metrics_internal.h"
+
+static const char *TAG = "esp_rmaker_persist";
+
+static esp_rmaker_param_persist_stats_t s_persist_stats;
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+static TimerHandle_t s_persist_timer;
+static SemaphoreHandle_t s_persist_flush_lock;
+#endif
+
+/* Time for which the shutdown handler waits for the model lock, since the task calling esp_restart(),
+ * or one preempted by it, may be holding it.
+ */
+#define PERSIST_SHUTDOWN_LOCK_TIMEOUT_MS    200
+
+/* Writes the param value using the given handle. The caller is expected to commit, and clear
+ * persist_pending only if that succeeds too.
+ */
+static esp_err_t esp_rmaker_param_write_value(_esp_rmaker_param_t *param, nvs_handle handle)
+{
+    esp_err_t err = ESP_OK;
+    if ((param->val.type == RMAKER_VAL_TYPE_STRING) || (param->val.type == RMAKER_VAL_TYPE_OBJECT) ||
+                (param->val.type == RMAKER_VAL_TYPE_ARRAY)) {
+        /* Store only if value is not NULL */
+        if (param->val.val.s) {
+            err = nvs_set_blob(handle, param->name, param->val.val.s, strlen(param->val.val.s));
+            s_persist_stats.writes++;
+            ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_NVS_WRITES, 1);
+        }
+    } else {
+        err = nvs_set_blob(handle, param->name, &param->val, sizeof(esp_rmaker_param_val_t));
+        s_persist_stats.writes++;
+        ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_NVS_WRITES, 1);
+    }
+    return err;
+}
+
+esp_err_t esp_rmaker_param_store_value(_esp_rmaker_param_t *param)
+{
+    if (!param || !param->parent) {
+        return ESP_FAIL;
+    }
+    nvs_handle handle;
+    esp_err_t err = nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, param->parent->name, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_rmaker_param_write_value(param, handle);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+        s_persist_stats.commits++;
+    }
+    nvs_close(handle);
+    if (err == ESP_OK) {
+        param->persist_pending = false;
+    }
+    return err;
+}
+
+/* Copy of a pending value, so that it can be written to NVS without holding the model lock */
+typedef struct esp_rmaker_persist_value {
+    struct esp_rmaker_persist_value *next;
+    /* Namespace (device name) and key (param name), stored after the data */
+    char *ns;
+    char *key;
+    size_t len;
+    bool failed;
+    uint8_t data[];
+} esp_rmaker_persist_value_t;
+
+static void esp_rmaker_persist_values_free(esp_rmaker_persist_value_t *values)
+{
+    while (values) {
+        esp_rmaker_persist_value_t *next = values->next;
+        free(values);
+        values = next;
+    }
+}
+
+/* Copies the pending values, clearing their pending flags, so that updates made while the copies are being
+ * written get written again. The values of a device are kept together, so that they are committed together.
+ * Should be called with the model write lock held.
+ */
+static esp_err_t esp_rmaker_persist_values_get(_esp_rmaker_node_t *node, esp_rmaker_persist_value_t **values)
+{
+    esp_rmaker_persist_value_t **tail = values;
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        if (!device->persist_pending) {
+            continue;
+        }
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (!param->persist_pending) {
+                continue;
+            }
+            const void *data = &param->val;
+            size_t len = sizeof(esp_rmaker_param_val_t);
+            if ((param->val.type == RMAKER_VAL_TYPE_STRING) || (param->val.type == RMAKER_VAL_TYPE_OBJECT) ||
+                        (param->val.type == RMAKER_VAL_TYPE_ARRAY)) {
+                /* Store only if value is not NULL */
+                data = param->val.val.s;
+                len = data ? strlen(data) : 0;
+            }
+            if (data) {
+                size_t ns_len = strlen(device->name);
+                esp_rmaker_persist_value_t *value = calloc(1, sizeof(esp_rmaker_persist_value_t) + len +
+                        ns_len + strlen(param->name) + 2);
+                if (!value) {
+                    /* The remaining values stay pending */
+                    return ESP_ERR_NO_MEM;
+                }
+                value->len = len;
+                memcpy(value->data, data, len);
+                value->ns = (char *)value->data + len;
+                strcpy(value->ns, device->name);
+                value->key = value->ns + ns_len + 1;
+                strcpy(value->key, param->name);
+                *tail = value;
+                tail = &value->next;
+            }
+            param->persist_pending = false;
+        }
+        device->persist_pending = false;
+    }
+    return ESP_OK;
+}
+
+/* Writes the values of each device in its namespace, with a single commit. If any of them fails, all the
+ * values of that device are marked as failed, since rewriting a value is harmless.
+ */
+static esp_err_t esp_rmaker_persist_values_write(esp_rmaker_persist_value_t *values)
+{
+    esp_err_t ret = ESP_OK;
+    esp_rmaker_persist_value_t *value = values;
+    while (value) {
+        esp_rmaker_persist_value_t *first = value;
+        nvs_handle handle;
+        esp_err_t err = nvs_open_from_partition(ESP_RMAKER_NVS_PART_NAME, first->ns, NVS_READWRITE, &handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open NVS namespace for %s", first->ns);
+        } else {
+            for (; value && (strcmp(value->ns, first->ns) == 0) && (err == ESP_OK); value = value->next) {
+                err = nvs_set_blob(handle, value->key, value->data, value->len);
+                s_persist_stats.writes++;
+                ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_NVS_WRITES, 1);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to store value of %s.%s", value->ns, value->key);
+                }
+            }
+            if (err == ESP_OK) {
+                err = nvs_commit(handle);
+                s_persist_stats.commits++;
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to commit values of %s. Error %d", first->ns, err);
+                }
+            }
+            nvs_close(handle);
+        }
+        /* Skips the values of this device which were not attempted */
+        while (value && (strcmp(value->ns, first->ns) == 0)) {
+            value = value->next;
+        }
+        if (err != ESP_OK) {
+            for (esp_rmaker_persist_value_t *failed = first; failed != value; failed = failed->next) {
+                failed->failed = true;
+            }
+            ret = ESP_FAIL;
+        }
+    }
+    return ret;
+}
+
+/* Marks the failed values as pending again, unless updated in the meanwhile, in which case the newer
+ * value is already pending. Should be called with the model write lock held.
+ */
+static void esp_rmaker_persist_values_restore(_esp_rmaker_node_t *node, esp_rmaker_persist_value_t *values)
+{
+    for (esp_rmaker_persist_value_t *value = values; value; value = value->next) {
+        if (!value->failed) {
+            continue;
+        }
+        /* The device or param may have been deleted in the meanwhile, so handles are not retained */
+        for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+            if (strcmp(device->name, value->ns) != 0) {
+                continue;
+            }
+            for (uint16_t i = 0; i < device->param_count; i++) {
+                if (strcmp(device->param_array[i]->name, value->key) == 0) {
+                    device->param_array[i]->persist_pending = true;
+                    device->persist_pending = true;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+/* Waits indefinitely for UINT32_MAX */
+static esp_err_t esp_rmaker_persist_wrlock(uint32_t timeout_ms)
+{
+    if (timeout_ms == UINT32_MAX) {
+        esp_rmaker_model_wrlock();
+        return ESP_OK;
+    }
+    return esp_rmaker_model_wrlock_timeout(timeout_ms);
+}
+
+/* Copies the pending values under the model lock and writes them to NVS after releasing it, so that the
+ * flash operations do not hold up the other users of the model. The flushes are serialised, so that an
+ * older copy is never written after a newer one.
+ */
+static esp_err_t __esp_rmaker_param_persist_flush(_esp_rmaker_node_t *node, uint32_t timeout_ms)
+{
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+    if (!s_persist_flush_lock) {
+        /* Nothing has been deferred yet */
+        return ESP_OK;
+    }
+    if (xSemaphoreTake(s_persist_flush_lock, timeout_ms == UINT32_MAX ? portMAX_DELAY :
+                pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+#endif
+    esp_rmaker_persist_value_t *values = NULL;
+    esp_err_t err = esp_rmaker_persist_wrlock(timeout_ms);
+    if (err == ESP_OK) {
+        err = esp_rmaker_persist_values_get(node, &values);
+        esp_rmaker_model_wrunlock();
+        if (esp_rmaker_persist_values_write(values) != ESP_OK) {
+            err = ESP_FAIL;
+        }
+        if ((err != ESP_OK) && (esp_rmaker_persist_wrlock(timeout_ms) == ESP_OK)) {
+            esp_rmaker_persist_values_restore(node, values);
+            esp_rmaker_model_wrunlock();
+        }
+        esp_rmaker_persist_values_free(values);
+    }
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+    xSemaphoreGive(s_persist_flush_lock);
+#endif
+    return err;
+}
+
+esp_err_t esp_rmaker_param_persist_flush(void)
+{
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+    if (s_persist_timer) {
+        xTimerStop(s_persist_timer, 0);
+    }
+#endif
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = __esp_rmaker_param_persist_flush(node, UINT32_MAX);
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+    /* Retried after the delay, with any values updated in the meanwhile */
+    if ((err != ESP_OK) && s_persist_timer) {
+        xTimerStart(s_persist_timer, 0);
+    }
+#endif
+    return err;
+}
+
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+static void esp_rmaker_param_persist_work_cb(void *priv_data)
+{
+    esp_rmaker_param_persist_flush();
+}
+
+static void esp_rmaker_param_persist_timer_cb(TimerHandle_t handle)
+{
+    if (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_LOW, esp_rmaker_param_persist_work_cb, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue writing of persistent params.");
+    }
+}
+
+static void esp_rmaker_param_persist_shutdown_handler(void)
+{
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return;
+    }
+    /* Waiting indefinitely could hang the restart, if the lock is held by the restarting task */
+    if (__esp_rmaker_param_persist_flush(node, PERSIST_SHUTDOWN_LOCK_TIMEOUT_MS) == ESP_ERR_TIMEOUT) {
+        ESP_LOGW(TAG, "Model busy. Pending persistent values will be lost on restart.");
+    }
+}
+
+/* The timer is not restarted on subsequent updates, so that values are not held back
+ * indefinitely by a param which keeps changing.
+ */
+static esp_err_t esp_rmaker_param_persist_schedule(void)
+{
+    /* Called with the model write lock held, and so not created twice */
+    if (!s_persist_flush_lock) {
+        s_persist_flush_lock = xSemaphoreCreateMutex();
+        if (!s_persist_flush_lock) {
+            ESP_LOGE(TAG, "Failed to create persistent params lock.");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (!s_persist_timer) {
+        s_persist_timer = xTimerCreate("persist_tm", pdMS_TO_TICKS(CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY),
+                pdFALSE, NULL, esp_rmaker_param_persist_timer_cb);
+        if (!s_persist_timer) {
+            ESP_LOGE(TAG, "Failed to create persistent params timer.");
+            return ESP_ERR_NO_MEM;
+        }
+        if (esp_register_shutdown_handler(esp_rmaker_param_persist_shutdown_handler) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register shutdown handler. Pending values may be lost on restart.");
+        }
+    }
+    if (xTimerIsTimerActive(s_persist_timer) == pdFALSE) {
+        if (xTimerStart(s_persist_timer, 0) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start persistent params timer.");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0 */
+
+esp_err_t esp_rmaker_param_persist(_esp_rmaker_param_t *param)
+{
+    if (!param || !param->parent) {
+        return ESP_FAIL;
+    }
+    s_persist_stats.updates++;
+#if CONFIG_ESP_RMAKER_PARAM_PERSIST_DELAY > 0
+    param->persist_pending = true;
+    param->parent->persist_pending = true;
+    if (esp_rmaker_param_persist_schedule() == ESP_OK) {
+        return ESP_OK;
+    }
+    /* Fall back to writing immediately */
+#endif
+    return esp_rmaker_param_store_value(param);
+}
+
+esp_err_t esp_rmaker_param_persist_get_stats(esp_rmaker_param_persist_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = s_persist_stats;
+    return ESP_OK;
+}
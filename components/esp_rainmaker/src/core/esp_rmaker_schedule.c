@@ -14,13 +14,17 @@
 
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <esp_log.h>
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <freertos/timers.h>
 #include <json_parser.h>
 #include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
 #include <esp_rmaker_core.h>
 #include <esp_rmaker_utils.h>
 #include <esp_rmaker_internal.h>
@@ -112,6 +116,12 @@ typedef struct {
     esp_rmaker_device_t *schedule_service;
     TimerHandle_t time_sync_timer;
     enum time_sync_state time_sync_state;;
+    /* The schedules are accessed by the triggers and the time sync in the work lanes (and with
+     * CONFIG_ESP_RMAKER_WORK_LANES_SECOND_WORKER, two triggers could run concurrently), by the timestamp
+     * callback in the esp_schedule timer and by the param write callback. Recursive, since triggering a
+     * schedule sets params, which could include the schedules param itself.
+     */
+    SemaphoreHandle_t lock;
 } esp_rmaker_schedule_priv_data_t;
 
 static esp_rmaker_schedule_priv_data_t *schedule_priv_data;
@@ -122,6 +132,16 @@ static esp_err_t esp_rmaker_schedule_report_params(void);
 static esp_err_t esp_rmaker_schedule_timesync_timer_deinit(void);
 static esp_err_t esp_rmaker_schedule_timesync_timer_start(void);
 
+static void esp_rmaker_schedule_lock(void)
+{
+    xSemaphoreTakeRecursive(schedule_priv_data->lock, portMAX_DELAY);
+}
+
+static void esp_rmaker_schedule_unlock(void)
+{
+    xSemaphoreGiveRecursive(schedule_priv_data->lock);
+}
+
 static void esp_rmaker_schedule_free(esp_rmaker_schedule_t *schedule)
 {
     if (!schedule) {
@@ -292,15 +312,21 @@ static esp_err_t esp_rmaker_schedule_process_action(esp_rmaker_schedule_action_t
 static void esp_rmaker_schedule_trigger_work_cb(void *priv_data)
 {
     int32_t index = (int32_t)priv_data;
+    esp_rmaker_schedule_lock();
     esp_rmaker_schedule_t *schedule = esp_rmaker_schedule_get_schedule_from_index(index);
     if (!schedule) {
+        esp_rmaker_schedule_unlock();
         ESP_LOGE(TAG, "Schedule with index %"PRIi32" not found for trigger work callback", index);
         return;
     }
     esp_rmaker_schedule_process_action(&schedule->action);
-    if (esp_rmaker_schedule_is_expired(schedule))  {
+    bool expired = esp_rmaker_schedule_is_expired(schedule);
+    if (expired)  {
         /* This schedule does not repeat anymore. Disable it and report the params. */
         esp_rmaker_schedule_operation_disable(schedule);
+    }
+    esp_rmaker_schedule_unlock();
+    if (expired) {
         esp_rmaker_schedule_report_params();
     }
 }
@@ -308,18 +334,57 @@ static void esp_rmaker_schedule_trigger_work_cb(void *priv_data)
 static void esp_rmaker_schedule_trigger_common_cb(esp_schedule_handle_t handle, void *priv_data)
 {
     /* Adding to work queue to change the context from timer's task. */
-    esp_rmaker_work_queue_add_task(esp_rmaker_schedule_trigger_work_cb, priv_data);
+    esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_HIGH, esp_rmaker_schedule_trigger_work_cb, priv_data);
 }
 
-static void esp_rmaker_schedule_timestamp_common_cb(esp_schedule_handle_t handle, uint32_t next_timestamp, void *priv_data)
+typedef struct {
+    int32_t index;
+    uint32_t next_timestamp;
+} esp_rmaker_schedule_timestamp_t;
+
+static void esp_rmaker_schedule_set_next_timestamp(int32_t index, uint32_t next_timestamp)
 {
-    int32_t index = (int32_t)priv_data;
+    esp_rmaker_schedule_lock();
     esp_rmaker_schedule_t *schedule = esp_rmaker_schedule_get_schedule_from_index(index);
+    if (schedule) {
+        schedule->trigger.next_timestamp = next_timestamp;
+    }
+    esp_rmaker_schedule_unlock();
     if (!schedule) {
         ESP_LOGE(TAG, "Schedule with index %"PRIi32" not found for timestamp callback", index);
+    }
+}
+
+static void esp_rmaker_schedule_timestamp_work_cb(void *priv_data)
+{
+    esp_rmaker_schedule_timestamp_t *timestamp = (esp_rmaker_schedule_timestamp_t *)priv_data;
+    esp_rmaker_schedule_set_next_timestamp(timestamp->index, timestamp->next_timestamp);
+    free(timestamp);
+}
+
+static void esp_rmaker_schedule_timestamp_common_cb(esp_schedule_handle_t handle, uint32_t next_timestamp, void *priv_data)
+{
+    int32_t index = (int32_t)priv_data;
+    if (xTaskGetCurrentTaskHandle() != xTimerGetTimerDaemonTaskHandle()) {
+        /* Called from esp_schedule_enable()/edit(), with the schedule lock already held by this task */
+        esp_rmaker_schedule_set_next_timestamp(index, next_timestamp);
         return;
     }
-    schedule->trigger.next_timestamp = next_timestamp;
+    /* The timer task must not wait for the schedule lock, since its holder may be waiting for the
+     * timer task to process its timer commands. Adding to work queue to change the context.
+     */
+    esp_rmaker_schedule_timestamp_t *timestamp = calloc(1, sizeof(esp_rmaker_schedule_timestamp_t));
+    if (!timestamp) {
+        ESP_LOGE(TAG, "Failed to allocate timestamp for schedule with index %"PRIi32, index);
+        return;
+    }
+    timestamp->index = index;
+    timestamp->next_timestamp = next_timestamp;
+    if (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_HIGH, esp_rmaker_schedule_timestamp_work_cb,
+                timestamp) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue timestamp for schedule with index %"PRIi32, index);
+        free(timestamp);
+    }
 }
 
 static esp_err_t esp_rmaker_schedule_prepare_config(esp_rmaker_schedule_t *schedule, esp_schedule_config_t *schedule_config)
@@ -430,6 +495,7 @@ static void esp_rmaker_schedule_timesync_timer_work_cb(void *priv_data)
     esp_rmaker_schedule_timesync_timer_deinit();
     schedule_priv_data->time_sync_state = TIME_SYNC_DONE;
     ESP_LOGI(TAG, "Time is synchronised now. Enabling the schedules.");
+    esp_rmaker_schedule_lock();
     esp_rmaker_schedule_t *schedule = schedule_priv_data->schedule_list;
     while (schedule) {
         if (schedule->enabled == true) {
@@ -437,11 +503,12 @@ static void esp_rmaker_schedule_timesync_timer_work_cb(void *priv_data)
         }
         schedule = schedule->next;
     }
+    esp_rmaker_schedule_unlock();
 }
 
 static void esp_rmaker_schedule_timesync_timer_cb(TimerHandle_t timer)
 {
-    esp_rmaker_work_queue_add_task(esp_rmaker_schedule_timesync_timer_work_cb, NULL);
+    esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_NORMAL, esp_rmaker_schedule_timesync_timer_work_cb, NULL);
 }
 
 static esp_err_t esp_rmaker_schedule_timesync_timer_init(void)
@@ -886,22 +953,26 @@ static esp_err_t __esp_rmaker_schedule_get_params(char *buf, size_t *buf_size)
 static char *esp_rmaker_schedule_get_params(void)
 {
     size_t req_size = 0;
+    char *data = NULL;
+    esp_rmaker_schedule_lock();
     esp_err_t err = __esp_rmaker_schedule_get_params(NULL, &req_size);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get required size for schedules JSON.");
-        return NULL;
+        goto exit;
     }
-    char *data = calloc(1, req_size);
+    data = calloc(1, req_size);
     if (!data) {
         ESP_LOGE(TAG, "Failed to allocate %d bytes for schedule.", req_size);
-        return NULL;
+        goto exit;
     }
     err = __esp_rmaker_schedule_get_params(data, &req_size);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error occured while trying to populate schedules JSON.");
         free(data);
-        return NULL;
+        data = NULL;
     }
+exit:
+    esp_rmaker_schedule_unlock();
     return data;
 }
 
@@ -930,7 +1001,9 @@ static esp_err_t write_cb(const esp_rmaker_device_t *device, const esp_rmaker_pa
         ESP_LOGI(TAG, "Invalid length for params: %d", strlen(val.val.s));
         return ESP_ERR_INVALID_ARG;
     }
+    esp_rmaker_schedule_lock();
     esp_rmaker_schedule_parse_json(val.val.s, strlen(val.val.s), ctx->src);
+    esp_rmaker_schedule_unlock();
     if (ctx->src != ESP_RMAKER_REQ_SRC_INIT) {
         /* Since this is a persisting param, we get a write_cb while booting up. We need not report the param when the source is 'init' as this will get reported when the device first reports all the params. */
         esp_rmaker_schedule_report_params();
@@ -945,6 +1018,13 @@ esp_err_t esp_rmaker_schedule_enable(void)
         ESP_LOGE(TAG, "Couldn't allocate schedule_priv_data");
         return ESP_ERR_NO_MEM;
     }
+    schedule_priv_data->lock = xSemaphoreCreateRecursiveMutex();
+    if (!schedule_priv_data->lock) {
+        ESP_LOGE(TAG, "Couldn't create schedule lock");
+        free(schedule_priv_data);
+        schedule_priv_data = NULL;
+        return ESP_ERR_NO_MEM;
+    }
     esp_rmaker_time_sync_init(NULL);
 
     esp_schedule_init(false, NULL, NULL);
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_rmaker_trace.h"
+
+#ifdef CONFIG_ESP_RMAKER_TRACE
+
+#define TRACE_ENTRIES   CONFIG_ESP_RMAKER_TRACE_ENTRIES
+
+#if (TRACE_ENTRIES & (TRACE_ENTRIES - 1)) != 0
+#error "CONFIG_ESP_RMAKER_TRACE_ENTRIES should be a power of 2"
+#endif
+
+typedef struct {
+    /* Set to the sequence number of the event + 1, after all the other fields have been written.
+     * So, an entry being overwritten is identified by a mismatch with its position.
+     */
+    _Atomic uint32_t seq;
+    uint32_t cycles;
+    uint32_t req_id;
+    uint16_t arg;
+    uint8_t event;
+    uint8_t core;
+} esp_rmaker_trace_entry_t;
+
+static esp_rmaker_trace_entry_t s_trace[TRACE_ENTRIES];
+static _Atomic uint32_t s_trace_seq;
+static _Atomic uint32_t s_trace_req;
+/* Events before this sequence number are not dumped */
+static _Atomic uint32_t s_trace_start;
+
+static const char *trace_event_names[RMAKER_TRACE_MAX] = {
+    "recv", "parse", "dispatch", "cb_start", "cb_end", "done", "report", "publish"
+};
+
+void esp_rmaker_trace(esp_rmaker_trace_event_t event, uint32_t arg)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count();
+    uint32_t req_id = (event == RMAKER_TRACE_RECV) ? atomic_fetch_add(&s_trace_req, 1) + 1 :
+            atomic_load(&s_trace_req);
+    uint32_t seq = atomic_fetch_add(&s_trace_seq, 1);
+    esp_rmaker_trace_entry_t *entry = &s_trace[seq & (TRACE_ENTRIES - 1)];
+    atomic_store(&entry->seq, 0);
+    entry->cycles = cycles;
+    entry->req_id = req_id;
+    entry->arg = (arg > UINT16_MAX) ? UINT16_MAX : arg;
+    entry->event = event;
+    entry->core = xPortGetCoreID();
+    atomic_store(&entry->seq, seq + 1);
+}
+
+void esp_rmaker_trace_dump(bool clear)
+{
+    uint32_t end = atomic_load(&s_trace_seq);
+    uint32_t start = atomic_load(&s_trace_start);
+    if ((end - start) > TRACE_ENTRIES) {
+        start = end - TRACE_ENTRIES;
+    }
+    printf("# rmaker_trace,%"PRIu32",%"PRIu32"\n", esp_rom_get_cpu_ticks_per_us(), end - start);
+    for (uint32_t seq = start; seq != end; seq++) {
+        esp_rmaker_trace_entry_t *entry = &s_trace[seq & (TRACE_ENTRIES - 1)];
+        esp_rmaker_trace_entry_t copy = {
+            .cycles = entry->cycles,
+            .req_id = entry->req_id,
+            .arg = entry->arg,
+            .event = entry->event,
+            .core = entry->core,
+        };
+        /* Skip the entries being written, or already overwritten by newer events */
+        if ((atomic_load(&entry->seq) != (seq + 1)) || (copy.event >= RMAKER_TRACE_MAX)) {
+            continue;
+        }
+        printf("%"PRIu32",%d,%"PRIu32",%"PRIu32",%s,%d\n", seq, copy.core, copy.cycles, copy.req_id,
+                trace_event_names[copy.event], copy.arg);
+    }
+    if (clear) {
+        atomic_store(&s_trace_start, end);
+    }
+}
+
+#endif /* CONFIG_ESP_RMAKER_TRACE */
@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+/* Trace points on the set params path, from an inbound params message till the resulting params report */
+typedef enum {
+    /* Set params received. arg: payload length */
+    RMAKER_TRACE_RECV = 0,
+    /* Payload parsed (JSON tokenised, or CBOR map header decoded). arg: number of devices in the payload */
+    RMAKER_TRACE_PARSE,
+    /* Dispatching the params of a device. arg: number of params of the device in the payload */
+    RMAKER_TRACE_DISPATCH,
+    /* Device write callback invoked. arg: source of the request (esp_rmaker_req_src_t) */
+    RMAKER_TRACE_CB_START,
+    /* Device write callback returned. arg: 0 on success, 1 otherwise */
+    RMAKER_TRACE_CB_END,
+    /* Set params handled. arg: 0 */
+    RMAKER_TRACE_DONE,
+    /* Params report built. arg: report length */
+    RMAKER_TRACE_REPORT,
+    /* Params report published (or queued). arg: 0 on success, 1 otherwise */
+    RMAKER_TRACE_PUBLISH,
+    RMAKER_TRACE_MAX,
+} esp_rmaker_trace_event_t;
+
+#ifdef CONFIG_ESP_RMAKER_TRACE
+/* Records an event in the trace ring buffer. This is lock free, and so can be called from any task.
+ * A RMAKER_TRACE_RECV event starts a new request, the id of which is recorded with all the events
+ * till the next one, so that the events of a request (and the report triggered by it) can be grouped.
+ */
+void esp_rmaker_trace(esp_rmaker_trace_event_t event, uint32_t arg);
+
+/* Prints the events in the trace buffer, oldest first, as CSV which can be decoded on the host:
+ *
+ * # rmaker_trace,<cpu_mhz>,<entries>
+ * <seq>,<core>,<cycles>,<request id>,<event name>,<arg>
+ *
+ * The cycles are the CPU cycle count of the core which recorded the event. These wrap around
+ * every 2^32 cycles, and are not synchronised across cores, so the deltas should be computed
+ * only between the events of the same core. If clear is set, the buffer is reset after printing.
+ */
+void esp_rmaker_trace_dump(bool clear);
+
+#define ESP_RMAKER_TRACE(event, arg)    esp_rmaker_trace(event, arg)
+#else
+#define ESP_RMAKER_TRACE(event, arg)
+#endif /* CONFIG_ESP_RMAKER_TRACE */
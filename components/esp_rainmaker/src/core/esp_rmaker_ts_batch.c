@@ -0,0 +1,562 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <json_generator.h>
+
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
+#include <esp_rmaker_mqtt.h>
+#include <esp_rmaker_utils.h>
+#include "esp_rmaker_mqtt_topics.h"
+#include "esp_rmaker_mqtt_queue.h"
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_lock.h"
+
+static const char *TAG = "esp_rmaker_ts_batch";
+
+static esp_rmaker_param_ts_stats_t s_ts_stats;
+
+#ifdef CONFIG_ESP_RMAKER_TS_BATCH
+
+typedef struct {
+    /* Seconds since boot instead of the epoch, if the time was not yet available when recorded */
+    bool uptime;
+    time_t t;
+    esp_rmaker_param_val_t val;
+} esp_rmaker_ts_record_t;
+
+/* Circular buffer of the samples of a param, which are yet to be reported */
+struct esp_rmaker_ts_ring {
+    uint16_t head;
+    uint16_t count;
+    /* Oldest samples, which are in the report being published */
+    uint16_t inflight;
+    esp_rmaker_ts_record_t records[CONFIG_ESP_RMAKER_TS_BATCH_RECORDS];
+};
+
+/* Lock order: s_ts_flush_lock, the model lock, s_ts_lock */
+static SemaphoreHandle_t s_ts_lock;
+/* Only one report at a time, so that the samples being published are not reported again */
+static SemaphoreHandle_t s_ts_flush_lock;
+static TimerHandle_t s_ts_timer;
+/* Total samples across all the params, which are yet to be reported */
+static uint32_t s_ts_pending;
+static bool s_ts_flush_queued;
+
+static void esp_rmaker_ts_record_free(esp_rmaker_ts_record_t *record)
+{
+    if ((record->val.type == RMAKER_VAL_TYPE_STRING) && record->val.val.s) {
+        free(record->val.val.s);
+        record->val.val.s = NULL;
+    }
+}
+
+/* Drops the oldest "count" samples of the param */
+static void esp_rmaker_ts_ring_consume(struct esp_rmaker_ts_ring *ring, uint16_t count)
+{
+    while (count-- && ring->count) {
+        esp_rmaker_ts_record_free(&ring->records[ring->head]);
+        ring->head = (ring->head + 1) % CONFIG_ESP_RMAKER_TS_BATCH_RECORDS;
+        ring->count--;
+        if (ring->inflight) {
+            ring->inflight--;
+        }
+        s_ts_pending--;
+    }
+}
+
+static time_t esp_rmaker_ts_get_uptime(void)
+{
+    return esp_timer_get_time() / 1000000;
+}
+
+typedef struct {
+    struct esp_rmaker_ts_ring *ring;
+    /* Index of the first sample to be returned, relative to the oldest one */
+    uint16_t start;
+    time_t now;
+    time_t uptime;
+} esp_rmaker_ts_ring_iter_t;
+
+static const esp_rmaker_param_val_t *esp_rmaker_ts_ring_get(void *priv, uint16_t index, time_t *t)
+{
+    esp_rmaker_ts_ring_iter_t *iter = (esp_rmaker_ts_ring_iter_t *)priv;
+    esp_rmaker_ts_record_t *record = &iter->ring->records[(iter->ring->head + iter->start + index) %
+            CONFIG_ESP_RMAKER_TS_BATCH_RECORDS];
+    *t = record->uptime ? (iter->now - (iter->uptime - record->t)) : record->t;
+    return &record->val;
+}
+
+static void esp_rmaker_ts_report_records(json_gen_str_t *jptr, _esp_rmaker_param_t *param, uint16_t start,
+        uint16_t count, time_t now, time_t uptime)
+{
+    char param_name[MAX_TS_DATA_PARAM_NAME];
+    esp_rmaker_ts_ring_iter_t iter = {
+        .ring = param->ts_ring,
+        .start = start,
+        .now = now,
+        .uptime = uptime,
+    };
+    snprintf(param_name, sizeof(param_name), "%s.%s", param->parent->name, param->name);
+#ifdef CONFIG_ESP_RMAKER_TS_COMPACT
+    bool compact = true;
+#else
+    bool compact = false;
+#endif
+    esp_rmaker_ts_encode_records(jptr, param_name, param->val.type, count,
+            esp_rmaker_ts_ring_get, &iter, compact);
+}
+
+/* Generates a single ts_data document with "count" pending samples of the given param, starting with the
+ * "start"th oldest one, or if NULL, with all the pending samples of all the params.
+ */
+static int esp_rmaker_ts_populate(_esp_rmaker_node_t *node, _esp_rmaker_param_t *only_param, uint16_t start,
+        uint16_t count, char *buf, size_t buf_size)
+{
+    time_t now = 0;
+    time(&now);
+    time_t uptime = esp_rmaker_ts_get_uptime();
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, buf, buf_size, NULL, NULL);
+    json_gen_start_object(&jstr);
+    json_gen_obj_set_string(&jstr, "ts_data_version", TS_DATA_VERSION);
+    json_gen_push_array(&jstr, "ts_data");
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (!only_param && param->ts_ring && param->ts_ring->count) {
+                esp_rmaker_ts_report_records(&jstr, param, 0, param->ts_ring->count, now, uptime);
+            } else if (param == only_param) {
+                esp_rmaker_ts_report_records(&jstr, param, start, count, now, uptime);
+            }
+        }
+    }
+    json_gen_pop_array(&jstr);
+    if (json_gen_end_object(&jstr) < 0) {
+        return -1;
+    }
+    return json_gen_str_end(&jstr);
+}
+
+/* Marks all the pending samples as being reported, so that only these are consumed once published, even if
+ * more samples get recorded, or the oldest ones get dropped, meanwhile.
+ */
+static void esp_rmaker_ts_mark_inflight(_esp_rmaker_node_t *node)
+{
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (param->ts_ring) {
+                param->ts_ring->inflight = param->ts_ring->count;
+            }
+        }
+    }
+}
+
+/* Consumes the samples which were marked as being reported if published, else just clears the marking.
+ * Returns the number of samples consumed.
+ */
+static uint32_t esp_rmaker_ts_consume_inflight(_esp_rmaker_node_t *node, bool published)
+{
+    uint32_t consumed = 0;
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (!param->ts_ring) {
+                continue;
+            }
+            if (published) {
+                consumed += param->ts_ring->inflight;
+                esp_rmaker_ts_ring_consume(param->ts_ring, param->ts_ring->inflight);
+            }
+            param->ts_ring->inflight = 0;
+        }
+    }
+    return consumed;
+}
+
+static void esp_rmaker_ts_work_cb(void *priv_data)
+{
+    esp_rmaker_param_ts_flush();
+}
+
+static void esp_rmaker_ts_timer_cb(TimerHandle_t handle)
+{
+    if (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_LOW, esp_rmaker_ts_work_cb, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to queue reporting of time series data.");
+    }
+}
+
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+static void esp_rmaker_ts_shutdown_handler(void);
+#endif
+
+/* Called from esp_rmaker_init(), before any param exists, and so before any sample can be recorded */
+esp_err_t esp_rmaker_ts_batch_init(void)
+{
+    if (s_ts_lock) {
+        return ESP_OK;
+    }
+    s_ts_flush_lock = xSemaphoreCreateMutex();
+    if (!s_ts_flush_lock) {
+        ESP_LOGE(TAG, "Failed to create time series flush lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    s_ts_timer = xTimerCreate("ts_batch_tm", pdMS_TO_TICKS(CONFIG_ESP_RMAKER_TS_BATCH_MAX_AGE * 1000),
+            pdFALSE, NULL, esp_rmaker_ts_timer_cb);
+    if (!s_ts_timer) {
+        ESP_LOGE(TAG, "Failed to create time series timer.");
+        vSemaphoreDelete(s_ts_flush_lock);
+        s_ts_flush_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    /* Created last, since the other functions check this to know if the initialisation is done */
+    s_ts_lock = xSemaphoreCreateMutex();
+    if (!s_ts_lock) {
+        ESP_LOGE(TAG, "Failed to create time series lock.");
+        xTimerDelete(s_ts_timer, 0);
+        s_ts_timer = NULL;
+        vSemaphoreDelete(s_ts_flush_lock);
+        s_ts_flush_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+    if (esp_register_shutdown_handler(esp_rmaker_ts_shutdown_handler) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to register shutdown handler. Pending time series data may be lost on restart.");
+    }
+#endif
+    return ESP_OK;
+}
+
+/* The age timer is started with the first pending sample and not restarted with the subsequent ones,
+ * so that no sample is held back for longer than CONFIG_ESP_RMAKER_TS_BATCH_MAX_AGE.
+ */
+static esp_err_t esp_rmaker_ts_schedule(void)
+{
+    if (xTimerIsTimerActive(s_ts_timer) == pdFALSE) {
+        if (xTimerStart(s_ts_timer, 0) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start time series timer.");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_param_ts_record(_esp_rmaker_param_t *param, const esp_rmaker_ts_sample_t *sample)
+{
+    if (!param || !param->parent || !sample) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_ts_lock) {
+        ESP_LOGE(TAG, "Time series batching not initialised.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_rmaker_ts_record_t record = {
+        .val = sample->val,
+    };
+    /* If the time is not yet available, the sample is timestamped once it is */
+    if (esp_rmaker_time_check()) {
+        time(&record.t);
+        record.t -= esp_rmaker_ts_get_uptime() - (sample->at / 1000000);
+    } else {
+        record.uptime = true;
+        record.t = sample->at / 1000000;
+    }
+    if ((record.val.type == RMAKER_VAL_TYPE_STRING) && record.val.val.s) {
+        record.val.val.s = strdup(record.val.val.s);
+        if (!record.val.val.s) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    bool flush = false;
+    xSemaphoreTake(s_ts_lock, portMAX_DELAY);
+    if (!param->ts_ring) {
+        param->ts_ring = calloc(1, sizeof(struct esp_rmaker_ts_ring));
+        if (!param->ts_ring) {
+            xSemaphoreGive(s_ts_lock);
+            esp_rmaker_ts_record_free(&record);
+            ESP_LOGE(TAG, "Failed to allocate time series buffer for %s.%s", param->parent->name, param->name);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    struct esp_rmaker_ts_ring *ring = param->ts_ring;
+    if (ring->count == CONFIG_ESP_RMAKER_TS_BATCH_RECORDS) {
+        /* Could not be reported in time, typically because of being offline. Drop the oldest sample. */
+        esp_rmaker_ts_ring_consume(ring, 1);
+        s_ts_stats.dropped++;
+    }
+    ring->records[(ring->head + ring->count) % CONFIG_ESP_RMAKER_TS_BATCH_RECORDS] = record;
+    ring->count++;
+    s_ts_pending++;
+    s_ts_stats.samples++;
+    if ((ring->count == CONFIG_ESP_RMAKER_TS_BATCH_RECORDS) && !s_ts_flush_queued) {
+        s_ts_flush_queued = flush = true;
+    }
+    xSemaphoreGive(s_ts_lock);
+    if (flush) {
+        if (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_LOW, esp_rmaker_ts_work_cb, NULL) != ESP_OK) {
+            s_ts_flush_queued = false;
+        }
+    } else {
+        esp_rmaker_ts_schedule();
+    }
+    return ESP_OK;
+}
+
+void esp_rmaker_param_ts_free(_esp_rmaker_param_t *param)
+{
+    if (!param->ts_ring) {
+        return;
+    }
+    xSemaphoreTake(s_ts_lock, portMAX_DELAY);
+    esp_rmaker_ts_ring_consume(param->ts_ring, param->ts_ring->count);
+    free(param->ts_ring);
+    param->ts_ring = NULL;
+    xSemaphoreGive(s_ts_lock);
+}
+
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+#define TS_SHUTDOWN_LOCK_TIMEOUT_MS     200
+
+/* Stores "count" pending samples of the param, starting with the "start"th oldest one, as a single entry */
+static esp_err_t esp_rmaker_ts_spill_records(_esp_rmaker_node_t *node, _esp_rmaker_param_t *param, uint16_t start,
+        uint16_t count, bool relative)
+{
+    if (relative) {
+        /* All the samples have uptime based timestamps, since the time was never available */
+        char param_name[MAX_TS_DATA_PARAM_NAME];
+        esp_rmaker_ts_ring_iter_t iter = {
+            .ring = param->ts_ring,
+            .start = start,
+            .now = 0,
+            .uptime = esp_rmaker_ts_get_uptime(),
+        };
+        snprintf(param_name, sizeof(param_name), "%s.%s", param->parent->name, param->name);
+        return esp_rmaker_ts_spill_write_uptime(param_name, param->val.type, count, esp_rmaker_ts_ring_get, &iter);
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    int len = esp_rmaker_ts_populate(node, param, start, count, NULL, 0);
+    char *data = (len > 0) ? malloc(len) : NULL;
+    if (data && (esp_rmaker_ts_populate(node, param, start, count, data, len) >= 0)) {
+        err = esp_rmaker_ts_spill_write(data, strlen(data));
+    }
+    free(data);
+    return err;
+}
+
+/* Stores the pending samples in flash, as ts_data documents per param, so that these can be reported
+ * later, in the same format. If the time is not yet available, the samples are stored with timestamps
+ * relative to the restart instead, to be converted in the next boot. The samples of a param are split
+ * into as many entries as required to fit in a flash sector. Called with the model lock and s_ts_lock held.
+ */
+static void esp_rmaker_ts_spill_all(_esp_rmaker_node_t *node, bool restart)
+{
+    bool relative = restart && !esp_rmaker_time_check();
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (!param->ts_ring || !param->ts_ring->count) {
+                continue;
+            }
+            uint16_t count = param->ts_ring->count;
+            uint16_t chunk = count;
+            for (uint16_t done = 0; done < count; ) {
+                uint16_t n = (count - done < chunk) ? (count - done) : chunk;
+                esp_err_t err = esp_rmaker_ts_spill_records(node, param, done, n, relative);
+                if ((err == ESP_ERR_INVALID_SIZE) && (n > 1)) {
+                    /* Too large for an entry. Retried with half as many, which is then used for the rest too. */
+                    chunk = n / 2;
+                    continue;
+                }
+                if (err == ESP_OK) {
+                    s_ts_stats.spilled += n;
+                } else {
+                    ESP_LOGE(TAG, "Failed to store %d samples of %s.%s in flash.", n, device->name, param->name);
+                    s_ts_stats.dropped += n;
+                }
+                done += n;
+            }
+            esp_rmaker_ts_ring_consume(param->ts_ring, count);
+        }
+    }
+}
+
+static bool esp_rmaker_ts_any_ring_full(_esp_rmaker_node_t *node)
+{
+    for (_esp_rmaker_device_t *device = node->devices; device; device = device->next) {
+        for (uint16_t i = 0; i < device->param_count; i++) {
+            _esp_rmaker_param_t *param = device->param_array[i];
+            if (param->ts_ring && (param->ts_ring->count == CONFIG_ESP_RMAKER_TS_BATCH_RECORDS)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Pending samples are stored in flash as is, without trying to report them, since the restart should not
+ * wait for the network. Samples of a report being published concurrently are stored as well, and so
+ * may get reported twice. The locks are taken with a timeout, since the restart could have been
+ * requested by a task holding these.
+ */
+static void esp_rmaker_ts_shutdown_handler(void)
+{
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return;
+    }
+    /* Entries relative to the last restart would be stale after this one */
+    esp_rmaker_ts_spill_expire_uptime();
+    if (esp_rmaker_model_rdlock_timeout(TS_SHUTDOWN_LOCK_TIMEOUT_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not lock the model. Pending time series data will be lost.");
+        return;
+    }
+    if (xSemaphoreTake(s_ts_lock, pdMS_TO_TICKS(TS_SHUTDOWN_LOCK_TIMEOUT_MS)) != pdTRUE) {
+        esp_rmaker_model_rdunlock();
+        ESP_LOGW(TAG, "Could not lock the time series data. Pending data will be lost.");
+        return;
+    }
+    if (s_ts_pending) {
+        esp_rmaker_ts_spill_all(node, true);
+    }
+    xSemaphoreGive(s_ts_lock);
+    esp_rmaker_model_rdunlock();
+}
+#endif /* CONFIG_ESP_RMAKER_TS_SPILL */
+
+/* Generates the report of all the pending samples, and marks these as being reported.
+ * Called with the model lock and s_ts_lock held.
+ */
+static esp_err_t esp_rmaker_ts_prepare_report(_esp_rmaker_node_t *node, char **payload)
+{
+    if (s_ts_pending == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* Samples recorded before the time was available can be timestamped only once it is */
+    if (esp_rmaker_time_check() != true) {
+        ESP_LOGW(TAG, "Current time not yet available. Time series data will be reported later.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    char *buf = NULL;
+    int len = esp_rmaker_ts_populate(node, NULL, 0, 0, NULL, 0);
+    if (len > 0) {
+        buf = calloc(1, len);
+    }
+    if (!buf || (esp_rmaker_ts_populate(node, NULL, 0, 0, buf, len) < 0)) {
+        ESP_LOGE(TAG, "Failed to generate time series data.");
+        free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_rmaker_ts_mark_inflight(node);
+    *payload = buf;
+    return ESP_OK;
+}
+
+/* Reports all the pending samples. If that fails, the samples are kept in RAM, till the buffer
+ * of some param gets full, after which they are stored in flash, if enabled.
+ * The model lock is not held while publishing, and so the samples which get reported are consumed
+ * only after that, going by the marking done while generating the report.
+ */
+static esp_err_t esp_rmaker_ts_flush(void)
+{
+    if (!s_ts_lock) {
+        return ESP_OK;
+    }
+    xTimerStop(s_ts_timer, 0);
+    _esp_rmaker_node_t *node = (_esp_rmaker_node_t *)esp_rmaker_get_node();
+    if (!node) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char *payload = NULL;
+    xSemaphoreTake(s_ts_flush_lock, portMAX_DELAY);
+    esp_rmaker_model_rdlock();
+    xSemaphoreTake(s_ts_lock, portMAX_DELAY);
+    s_ts_flush_queued = false;
+    uint32_t count = s_ts_pending;
+    esp_err_t err = esp_rmaker_ts_prepare_report(node, &payload);
+    xSemaphoreGive(s_ts_lock);
+    esp_rmaker_model_rdunlock();
+    if (err == ESP_OK) {
+        const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_TS_DATA);
+        ESP_LOGI(TAG, "Reporting %"PRIu32" time series records.", count);
+        /* Not using the publish queue, since the samples are consumed once published. If the budget is not
+         * available, they are retained here instead, and can be spilled to flash.
+         */
+        err = esp_rmaker_mqtt_publish_class(publish_topic, payload, strlen(payload), RMAKER_MQTT_QOS1, NULL,
+                RMAKER_MQTT_PRIO_TS);
+        free(payload);
+        if (err != ESP_OK) {
+            /* The samples are retained, and will be reported along with the subsequent ones */
+            ESP_LOGW(TAG, "Failed to report time series data.");
+        }
+    }
+    esp_rmaker_model_rdlock();
+    xSemaphoreTake(s_ts_lock, portMAX_DELAY);
+    uint32_t consumed = esp_rmaker_ts_consume_inflight(node, err == ESP_OK);
+    if (err == ESP_OK) {
+        s_ts_stats.records += consumed;
+        s_ts_stats.publishes++;
+    }
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+    /* Samples with uptime based timestamps are not spilled till the restart, since these cannot be
+     * converted later in the same boot.
+     */
+    if ((err != ESP_OK) && (err != ESP_ERR_NOT_FOUND) && (err != ESP_ERR_INVALID_STATE) &&
+            esp_rmaker_ts_any_ring_full(node)) {
+        esp_rmaker_ts_spill_all(node, false);
+    }
+#endif
+    if (s_ts_pending) {
+        esp_rmaker_ts_schedule();
+    }
+    xSemaphoreGive(s_ts_lock);
+    esp_rmaker_model_rdunlock();
+    xSemaphoreGive(s_ts_flush_lock);
+    return (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+}
+
+esp_err_t esp_rmaker_param_ts_flush(void)
+{
+    return esp_rmaker_ts_flush();
+}
+
+#else /* !CONFIG_ESP_RMAKER_TS_BATCH */
+
+esp_err_t esp_rmaker_ts_batch_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_param_ts_flush(void)
+{
+    return ESP_OK;
+}
+
+#endif /* !CONFIG_ESP_RMAKER_TS_BATCH */
+
+esp_err_t esp_rmaker_param_ts_get_stats(esp_rmaker_param_ts_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = s_ts_stats;
+    stats->compressed = esp_rmaker_param_ts_compress_get_count();
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+    stats->spill_pending = esp_rmaker_ts_spill_get_pending();
+#endif
+    return ESP_OK;
+}
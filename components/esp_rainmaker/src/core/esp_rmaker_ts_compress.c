@@ -0,0 +1,144 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <math.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include <esp_rmaker_core.h>
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_model_alloc.h"
+
+static const char *TAG = "esp_rmaker_ts_compress";
+
+struct esp_rmaker_ts_compress {
+    esp_rmaker_param_ts_compression_t config;
+    /* The last recorded sample. Invalid till the first sample is recorded. */
+    bool archived_valid;
+    double archived_val;
+    int64_t archived_at;
+    /* For swinging door, the last sample received after the archived one, which has not been recorded */
+    bool held_valid;
+    esp_rmaker_ts_sample_t held;
+    /* For swinging door, the range of slopes (per second) of the lines from the archived sample,
+     * which pass within the deviation of all the samples received after it
+     */
+    double slope_max;
+    double slope_min;
+};
+
+static uint32_t s_compressed_count;
+
+static double esp_rmaker_ts_val_to_double(const esp_rmaker_param_val_t *val)
+{
+    return (val->type == RMAKER_VAL_TYPE_FLOAT) ? val->val.f : val->val.i;
+}
+
+static void esp_rmaker_ts_compress_archive(struct esp_rmaker_ts_compress *tc, double val, int64_t at)
+{
+    tc->archived_valid = true;
+    tc->archived_val = val;
+    tc->archived_at = at;
+    tc->held_valid = false;
+    tc->slope_max = INFINITY;
+    tc->slope_min = -INFINITY;
+}
+
+/* Narrows the door for the given sample. Returns false if the door opens, ie. the sample cannot be
+ * interpolated from the archived one along with the earlier ones.
+ */
+static bool esp_rmaker_ts_compress_door(struct esp_rmaker_ts_compress *tc, double val, int64_t at)
+{
+    double dt = (at > tc->archived_at) ? (at - tc->archived_at) / 1000000.0 : 1e-6;
+    double slope_max = fmin(tc->slope_max, (val + tc->config.deviation - tc->archived_val) / dt);
+    double slope_min = fmax(tc->slope_min, (val - tc->config.deviation - tc->archived_val) / dt);
+    if (slope_min > slope_max) {
+        return false;
+    }
+    tc->slope_max = slope_max;
+    tc->slope_min = slope_min;
+    return true;
+}
+
+uint8_t esp_rmaker_param_ts_compress(_esp_rmaker_param_t *param, int64_t now, esp_rmaker_ts_sample_t *held)
+{
+    struct esp_rmaker_ts_compress *tc = param->ts_compress;
+    if (!tc || (tc->config.type == RMAKER_TS_COMPRESSION_NONE)) {
+        return RMAKER_TS_RECORD_CURRENT;
+    }
+    double val = esp_rmaker_ts_val_to_double(&param->val);
+    uint8_t record = 0;
+    if (!tc->archived_valid) {
+        record = RMAKER_TS_RECORD_CURRENT;
+    } else if (tc->config.max_interval &&
+            ((now - tc->archived_at) >= ((int64_t)tc->config.max_interval * 1000000))) {
+        /* Heartbeat. The held sample, if any, is needed to reconstruct the trend till the current one. */
+        record = RMAKER_TS_RECORD_CURRENT | (tc->held_valid ? RMAKER_TS_RECORD_HELD : 0);
+    } else if (tc->config.type == RMAKER_TS_COMPRESSION_DEADBAND) {
+        if (fabs(val - tc->archived_val) > tc->config.deviation) {
+            record = RMAKER_TS_RECORD_CURRENT;
+        }
+    } else if (!esp_rmaker_ts_compress_door(tc, val, now)) {
+        /* The door opened. So the held sample gets recorded, and becomes the start of the next door. */
+        esp_rmaker_ts_compress_archive(tc, esp_rmaker_ts_val_to_double(&tc->held.val), tc->held.at);
+        esp_rmaker_ts_compress_door(tc, val, now);
+        record = RMAKER_TS_RECORD_HELD;
+    }
+    if (record & RMAKER_TS_RECORD_HELD) {
+        /* It was counted as compressed when received */
+        *held = tc->held;
+        s_compressed_count--;
+    }
+    if (record & RMAKER_TS_RECORD_CURRENT) {
+        esp_rmaker_ts_compress_archive(tc, val, now);
+    } else {
+        s_compressed_count++;
+        if (tc->config.type == RMAKER_TS_COMPRESSION_SWINGING_DOOR) {
+            tc->held_valid = true;
+            tc->held.val = param->val;
+            tc->held.at = now;
+        }
+    }
+    return record;
+}
+
+uint32_t esp_rmaker_param_ts_compress_get_count(void)
+{
+    return s_compressed_count;
+}
+
+esp_err_t esp_rmaker_param_add_ts_compression(const esp_rmaker_param_t *param,
+        const esp_rmaker_param_ts_compression_t *config)
+{
+    if (!param || !config) {
+        ESP_LOGE(TAG, "Param handle and config cannot be NULL.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    _esp_rmaker_param_t *_param = (_esp_rmaker_param_t *)param;
+    if (!(_param->prop_flags & PROP_FLAG_TIME_SERIES)) {
+        ESP_LOGE(TAG, "Compression can be added only for params with PROP_FLAG_TIME_SERIES.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((_param->val.type != RMAKER_VAL_TYPE_INTEGER) && (_param->val.type != RMAKER_VAL_TYPE_FLOAT)) {
+        ESP_LOGE(TAG, "Only integer and float params can have compression.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((config->type > RMAKER_TS_COMPRESSION_SWINGING_DOOR) || !(config->deviation >= 0)) {
+        ESP_LOGE(TAG, "Invalid compression config for %s.", _param->name);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!_param->ts_compress) {
+        _param->ts_compress = esp_rmaker_model_calloc(1, sizeof(struct esp_rmaker_ts_compress));
+        if (!_param->ts_compress) {
+            ESP_LOGE(TAG, "Failed to allocate memory for compression of %s.", _param->name);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    _param->ts_compress->config = *config;
+    _param->ts_compress->archived_valid = false;
+    _param->ts_compress->held_valid = false;
+    return ESP_OK;
+}
@@ -0,0 +1,138 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <math.h>
+#include <json_generator.h>
+
+#include <esp_rmaker_core.h>
+#include "esp_rmaker_internal.h"
+
+#ifdef CONFIG_ESP_RMAKER_TS_COMPACT_DECIMALS
+#define TS_COMPACT_DECIMALS     CONFIG_ESP_RMAKER_TS_COMPACT_DECIMALS
+#else
+#define TS_COMPACT_DECIMALS     2
+#endif
+
+/* Compact encoding of the records of a param:
+ * {"name":"<device>.<param>","dt":"float","enc":"dod","t":<first timestamp>,"td":[...],"s":<scale>,"v":[...]}
+ * td has the difference between the first two timestamps, followed by the delta-of-delta of each of the
+ * subsequent timestamps, ie. (t[i] - t[i-1]) - (t[i-1] - t[i-2]). So, it is all 0s for periodic samples.
+ * v has the first value multiplied by the scale, followed by the deltas of the subsequent scaled values.
+ * The scale is present only for floats. Booleans are encoded as 0/1.
+ */
+#define TS_COMPACT_ENCODING     "dod"
+
+static bool esp_rmaker_ts_scaled_value(const esp_rmaker_param_val_t *val, int64_t scale, int64_t *scaled)
+{
+    switch (val->type) {
+        case RMAKER_VAL_TYPE_BOOLEAN:
+            *scaled = val->val.b ? 1 : 0;
+            return true;
+        case RMAKER_VAL_TYPE_INTEGER:
+            *scaled = val->val.i;
+            return true;
+        case RMAKER_VAL_TYPE_FLOAT: {
+            double v = (double)val->val.f * scale;
+            if (!isfinite(v) || (fabs(v) > INT32_MAX)) {
+                return false;
+            }
+            *scaled = llround(v);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool esp_rmaker_ts_fits_int(int64_t val)
+{
+    return (val >= INT32_MIN) && (val <= INT32_MAX);
+}
+
+/* Checks if the records can be encoded compactly, ie. all the values and deltas fit in an int */
+static bool esp_rmaker_ts_can_encode_compact(uint16_t count, esp_rmaker_ts_record_get_t get, void *priv, int64_t scale)
+{
+    int64_t prev_t = 0, prev_delta = 0, prev_v = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        time_t t;
+        int64_t v;
+        if (!esp_rmaker_ts_scaled_value(get(priv, i, &t), scale, &v)) {
+            return false;
+        }
+        int64_t delta = (int64_t)t - prev_t;
+        if ((i > 0) && (!esp_rmaker_ts_fits_int(delta - prev_delta) || !esp_rmaker_ts_fits_int(v - prev_v))) {
+            return false;
+        }
+        prev_delta = (i > 0) ? delta : 0;
+        prev_t = t;
+        prev_v = v;
+    }
+    return true;
+}
+
+static void esp_rmaker_ts_encode_compact(json_gen_str_t *jptr, esp_rmaker_val_type_t type, uint16_t count,
+        esp_rmaker_ts_record_get_t get, void *priv, int64_t scale)
+{
+    time_t t0;
+    get(priv, 0, &t0);
+    json_gen_obj_set_string(jptr, "enc", TS_COMPACT_ENCODING);
+    json_gen_obj_set_int(jptr, "t", (int)t0);
+    json_gen_push_array(jptr, "td");
+    int64_t prev_t = t0, prev_delta = 0;
+    for (uint16_t i = 1; i < count; i++) {
+        time_t t;
+        get(priv, i, &t);
+        int64_t delta = (int64_t)t - prev_t;
+        json_gen_arr_set_int(jptr, (int)(delta - prev_delta));
+        prev_delta = delta;
+        prev_t = t;
+    }
+    json_gen_pop_array(jptr);
+    if (type == RMAKER_VAL_TYPE_FLOAT) {
+        json_gen_obj_set_int(jptr, "s", (int)scale);
+    }
+    json_gen_push_array(jptr, "v");
+    int64_t prev_v = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        time_t t;
+        int64_t v = 0;
+        esp_rmaker_ts_scaled_value(get(priv, i, &t), scale, &v);
+        json_gen_arr_set_int(jptr, (int)(v - prev_v));
+        prev_v = v;
+    }
+    json_gen_pop_array(jptr);
+}
+
+void esp_rmaker_ts_encode_records(json_gen_str_t *jptr, const char *name, esp_rmaker_val_type_t type,
+        uint16_t count, esp_rmaker_ts_record_get_t get, void *priv, bool compact)
+{
+    int64_t scale = 1;
+    if (type == RMAKER_VAL_TYPE_FLOAT) {
+        for (int i = 0; i < TS_COMPACT_DECIMALS; i++) {
+            scale *= 10;
+        }
+    }
+    json_gen_start_object(jptr);
+    json_gen_obj_set_string(jptr, "name", name);
+    esp_rmaker_report_data_type(type, "dt", jptr);
+    /* A single record is smaller in the standard encoding */
+    if (compact && (count > 1) && esp_rmaker_ts_can_encode_compact(count, get, priv, scale)) {
+        esp_rmaker_ts_encode_compact(jptr, type, count, get, priv, scale);
+    } else {
+        json_gen_push_array(jptr, "records");
+        for (uint16_t i = 0; i < count; i++) {
+            time_t t;
+            const esp_rmaker_param_val_t *val = get(priv, i, &t);
+            json_gen_start_object(jptr);
+            json_gen_obj_set_int(jptr, "t", (int)t);
+            esp_rmaker_report_value(val, "v", jptr);
+            json_gen_end_object(jptr);
+        }
+        json_gen_pop_array(jptr);
+    }
+    json_gen_end_object(jptr);
+}
@@ -0,0 +1,587 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_event.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
+#include <esp_rmaker_mqtt.h>
+#include <esp_rmaker_common_events.h>
+#include <esp_rmaker_utils.h>
+#include <json_generator.h>
+#include "esp_rmaker_mqtt_topics.h"
+#include "esp_rmaker_mqtt_budget.h"
+#include "esp_rmaker_internal.h"
+
+#ifdef CONFIG_ESP_RMAKER_TS_SPILL
+
+static const char *TAG = "esp_rmaker_ts_spill";
+
+/* The partition is used as a circular log of ts_data documents, each preceded by a header.
+ * Entries do not cross sector boundaries, and a sector is erased just before the first write
+ * to it, dropping any entries in it which have not been reported yet.
+ * Reported entries are marked by clearing the state word, which does not require an erase.
+ *
+ * Samples which could not be timestamped before a restart, since the time was not available, are stored
+ * in a binary format instead, with timestamps relative to the restart. These are converted to ts_data
+ * documents in the next boot, once the time is available, taking the restart to have been just before
+ * that boot. So, the timestamps are off by the time taken to restart, and such entries are dropped if the
+ * next boot is not the result of a restart (like after a power loss or a crash), or if there is another
+ * restart before the time is available.
+ */
+#define TS_SPILL_MAGIC              0x50535452  /* "RTSP" */
+#define TS_SPILL_MAGIC_UPTIME       0x55535452  /* "RTSU" */
+#define TS_SPILL_STATE_PENDING      0xFFFFFFFF
+#define TS_SPILL_STATE_REPORTED     0x00000000
+#define TS_SPILL_SECTOR_SIZE        4096
+#define TS_SPILL_ALIGN(len)         (((len) + 3) & ~3)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t len;
+    uint32_t state;
+} esp_rmaker_ts_spill_hdr_t;
+
+#define TS_SPILL_MAX_DATA_LEN       (TS_SPILL_SECTOR_SIZE - sizeof(esp_rmaker_ts_spill_hdr_t))
+
+/* Data of a TS_SPILL_MAGIC_UPTIME entry. This is followed by the NULL terminated param name, and then the
+ * records, each being an int32_t timestamp in seconds relative to the restart, and the value, as a 4 byte
+ * int/float/bool, or for strings, a uint16_t length (including the NULL termination) followed by the string.
+ * Nothing is aligned, and so the fields are accessed using memcpy().
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t name_len;
+    uint16_t count;
+} esp_rmaker_ts_spill_uptime_hdr_t;
+
+typedef struct {
+    time_t t;
+    esp_rmaker_param_val_t val;
+} esp_rmaker_ts_spill_record_t;
+
+static const esp_partition_t *s_spill_part;
+static SemaphoreHandle_t s_spill_lock;
+static TimerHandle_t s_replay_timer;
+/* Offset for the next entry */
+static size_t s_write_off;
+/* Offset of the oldest pending entry. Valid only if s_pending is non zero. */
+static size_t s_read_off;
+static uint32_t s_seq;
+static uint32_t s_pending;
+/* Sequence number of the first entry stored in this boot */
+static uint32_t s_boot_seq;
+static bool s_replay_queued;
+
+static size_t esp_rmaker_ts_spill_sector(size_t off)
+{
+    return off - (off % TS_SPILL_SECTOR_SIZE);
+}
+
+/* Returns false if there is no valid entry at the offset, as also at the end of the written part of a sector */
+static bool esp_rmaker_ts_spill_read_hdr(size_t off, esp_rmaker_ts_spill_hdr_t *hdr)
+{
+    if ((off % TS_SPILL_SECTOR_SIZE) + sizeof(esp_rmaker_ts_spill_hdr_t) > TS_SPILL_SECTOR_SIZE) {
+        return false;
+    }
+    if (esp_partition_read(s_spill_part, off, hdr, sizeof(esp_rmaker_ts_spill_hdr_t)) != ESP_OK) {
+        return false;
+    }
+    return ((hdr->magic == TS_SPILL_MAGIC) || (hdr->magic == TS_SPILL_MAGIC_UPTIME)) && (hdr->len <= TS_SPILL_MAX_DATA_LEN) &&
+            ((off % TS_SPILL_SECTOR_SIZE) + sizeof(esp_rmaker_ts_spill_hdr_t) + hdr->len <= TS_SPILL_SECTOR_SIZE);
+}
+
+static size_t esp_rmaker_ts_spill_next_sector(size_t off)
+{
+    return (esp_rmaker_ts_spill_sector(off) + TS_SPILL_SECTOR_SIZE) % s_spill_part->size;
+}
+
+/* Moves s_read_off to the next pending entry, if any, starting with the given offset */
+static void esp_rmaker_ts_spill_seek_pending(size_t off)
+{
+    esp_rmaker_ts_spill_hdr_t hdr;
+    /* Bounded by the number of sectors, since every entry in a sector is checked in one go */
+    for (size_t sectors = 0; s_pending && (sectors <= s_spill_part->size / TS_SPILL_SECTOR_SIZE); ) {
+        if (esp_rmaker_ts_spill_read_hdr(off, &hdr)) {
+            if (hdr.state == TS_SPILL_STATE_PENDING) {
+                s_read_off = off;
+                return;
+            }
+            off += TS_SPILL_ALIGN(sizeof(hdr) + hdr.len);
+        } else {
+            off = esp_rmaker_ts_spill_next_sector(off);
+            sectors++;
+        }
+    }
+    /* Should not happen, unless the partition was modified externally */
+    s_pending = 0;
+}
+
+/* Rebuilds the state by scanning all the entries in the partition */
+static void esp_rmaker_ts_spill_recover(void)
+{
+    esp_rmaker_ts_spill_hdr_t hdr;
+    bool found = false;
+    uint32_t oldest_pending_seq = 0;
+    for (size_t sector = 0; sector < s_spill_part->size; sector += TS_SPILL_SECTOR_SIZE) {
+        size_t off = sector;
+        while (esp_rmaker_ts_spill_read_hdr(off, &hdr)) {
+            size_t next_off = off + TS_SPILL_ALIGN(sizeof(hdr) + hdr.len);
+            if (!found || ((int32_t)(hdr.seq - s_seq) >= 0)) {
+                s_seq = hdr.seq + 1;
+                s_write_off = next_off % s_spill_part->size;
+                found = true;
+            }
+            if (hdr.state == TS_SPILL_STATE_PENDING) {
+                if (!s_pending || ((int32_t)(hdr.seq - oldest_pending_seq) < 0)) {
+                    oldest_pending_seq = hdr.seq;
+                    s_read_off = off;
+                }
+                s_pending++;
+            }
+            off = next_off;
+        }
+    }
+    if (found && (s_write_off % TS_SPILL_SECTOR_SIZE)) {
+        /* The rest of the last written sector may have a partially written entry, and so is not reused */
+        s_write_off = esp_rmaker_ts_spill_next_sector(s_write_off);
+    }
+    ESP_LOGI(TAG, "%"PRIu32" time series entries pending in flash.", s_pending);
+}
+
+static void esp_rmaker_ts_spill_mark_reported(size_t off)
+{
+    uint32_t state = TS_SPILL_STATE_REPORTED;
+    esp_partition_write(s_spill_part, off + offsetof(esp_rmaker_ts_spill_hdr_t, state), &state, sizeof(state));
+}
+
+/* Erases the sector at the offset, dropping any pending entries in it */
+static esp_err_t esp_rmaker_ts_spill_erase(size_t sector)
+{
+    if (s_pending && (esp_rmaker_ts_spill_sector(s_read_off) == sector)) {
+        esp_rmaker_ts_spill_hdr_t hdr;
+        uint32_t dropped = 0;
+        for (size_t off = s_read_off; esp_rmaker_ts_spill_read_hdr(off, &hdr);
+                off += TS_SPILL_ALIGN(sizeof(hdr) + hdr.len)) {
+            if (hdr.state == TS_SPILL_STATE_PENDING) {
+                dropped++;
+            }
+        }
+        ESP_LOGW(TAG, "Time series flash buffer full. Dropping %"PRIu32" oldest entries.", dropped);
+        s_pending -= dropped;
+        esp_rmaker_ts_spill_seek_pending(esp_rmaker_ts_spill_next_sector(sector));
+    }
+    return esp_partition_erase_range(s_spill_part, sector, TS_SPILL_SECTOR_SIZE);
+}
+
+static void esp_rmaker_ts_replay_work_cb(void *priv_data);
+
+static void esp_rmaker_ts_replay_schedule(bool immediate)
+{
+    if (immediate) {
+        if (!s_replay_queued &&
+                (esp_rmaker_work_lane_add_task(RMAKER_WORK_LANE_LOW, esp_rmaker_ts_replay_work_cb, NULL) == ESP_OK)) {
+            s_replay_queued = true;
+        }
+    } else if (xTimerIsTimerActive(s_replay_timer) == pdFALSE) {
+        xTimerStart(s_replay_timer, 0);
+    }
+}
+
+static esp_err_t esp_rmaker_ts_spill_write_entry(uint32_t magic, const char *data, size_t len)
+{
+    if (!s_spill_part) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > TS_SPILL_MAX_DATA_LEN) {
+        /* Not an error yet, since the caller splits the data and retries */
+        ESP_LOGD(TAG, "Time series data of %d bytes too large for an entry.", len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t total_len = TS_SPILL_ALIGN(sizeof(esp_rmaker_ts_spill_hdr_t) + len);
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+    if ((s_write_off % TS_SPILL_SECTOR_SIZE) + total_len > TS_SPILL_SECTOR_SIZE) {
+        s_write_off = esp_rmaker_ts_spill_next_sector(s_write_off);
+    }
+    if ((s_write_off % TS_SPILL_SECTOR_SIZE) == 0) {
+        err = esp_rmaker_ts_spill_erase(s_write_off);
+    }
+    esp_rmaker_ts_spill_hdr_t hdr = {
+        .magic = magic,
+        .seq = s_seq,
+        .len = len,
+        .state = TS_SPILL_STATE_PENDING,
+    };
+    /* The header is written after the data, so that a partially written entry is not considered valid */
+    if (err == ESP_OK) {
+        err = esp_partition_write(s_spill_part, s_write_off + sizeof(hdr), data, len);
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(s_spill_part, s_write_off, &hdr, sizeof(hdr));
+    }
+    if (err == ESP_OK) {
+        if (!s_pending) {
+            s_read_off = s_write_off;
+        }
+        s_pending++;
+        s_seq++;
+    } else {
+        ESP_LOGE(TAG, "Failed to store time series data in flash.");
+    }
+    s_write_off = (s_write_off + total_len) % s_spill_part->size;
+    xSemaphoreGive(s_spill_lock);
+    if (err == ESP_OK) {
+        esp_rmaker_ts_replay_schedule(false);
+    }
+    return err;
+}
+
+esp_err_t esp_rmaker_ts_spill_write(const char *data, size_t len)
+{
+    return esp_rmaker_ts_spill_write_entry(TS_SPILL_MAGIC, data, len);
+}
+
+static size_t esp_rmaker_ts_spill_val_len(const esp_rmaker_param_val_t *val)
+{
+    if (val->type == RMAKER_VAL_TYPE_STRING) {
+        return sizeof(uint16_t) + (val->val.s ? strlen(val->val.s) : 0) + 1;
+    }
+    return sizeof(int32_t);
+}
+
+esp_err_t esp_rmaker_ts_spill_write_uptime(const char *name, esp_rmaker_val_type_t type, uint16_t count,
+        esp_rmaker_ts_record_get_t get, void *priv)
+{
+    if ((type != RMAKER_VAL_TYPE_BOOLEAN) && (type != RMAKER_VAL_TYPE_INTEGER) &&
+            (type != RMAKER_VAL_TYPE_FLOAT) && (type != RMAKER_VAL_TYPE_STRING)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_rmaker_ts_spill_uptime_hdr_t hdr = {
+        .type = type,
+        .name_len = strlen(name) + 1,
+        .count = count,
+    };
+    size_t len = sizeof(hdr) + hdr.name_len;
+    for (uint16_t i = 0; i < count; i++) {
+        time_t t;
+        len += sizeof(int32_t) + esp_rmaker_ts_spill_val_len(get(priv, i, &t));
+    }
+    char *data = malloc(len);
+    if (!data) {
+        return ESP_ERR_NO_MEM;
+    }
+    char *p = data;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, name, hdr.name_len);
+    p += hdr.name_len;
+    for (uint16_t i = 0; i < count; i++) {
+        time_t t;
+        const esp_rmaker_param_val_t *val = get(priv, i, &t);
+        int32_t rel_t = t;
+        memcpy(p, &rel_t, sizeof(rel_t));
+        p += sizeof(rel_t);
+        if (type == RMAKER_VAL_TYPE_STRING) {
+            const char *str = val->val.s ? val->val.s : "";
+            uint16_t str_len = strlen(str) + 1;
+            memcpy(p, &str_len, sizeof(str_len));
+            p += sizeof(str_len);
+            memcpy(p, str, str_len);
+            p += str_len;
+        } else {
+            int32_t raw = 0;
+            if (type == RMAKER_VAL_TYPE_FLOAT) {
+                memcpy(&raw, &val->val.f, sizeof(raw));
+            } else if (type == RMAKER_VAL_TYPE_BOOLEAN) {
+                raw = val->val.b;
+            } else {
+                raw = val->val.i;
+            }
+            memcpy(p, &raw, sizeof(raw));
+            p += sizeof(raw);
+        }
+    }
+    esp_err_t err = esp_rmaker_ts_spill_write_entry(TS_SPILL_MAGIC_UPTIME, data, len);
+    free(data);
+    return err;
+}
+
+void esp_rmaker_ts_spill_expire_uptime(void)
+{
+    if (!s_spill_part) {
+        return;
+    }
+    esp_rmaker_ts_spill_hdr_t hdr;
+    uint32_t expired = 0;
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+    for (size_t sector = 0; sector < s_spill_part->size; sector += TS_SPILL_SECTOR_SIZE) {
+        for (size_t off = sector; esp_rmaker_ts_spill_read_hdr(off, &hdr);
+                off += TS_SPILL_ALIGN(sizeof(hdr) + hdr.len)) {
+            if ((hdr.magic == TS_SPILL_MAGIC_UPTIME) && (hdr.state == TS_SPILL_STATE_PENDING) &&
+                    ((int32_t)(hdr.seq - s_boot_seq) < 0)) {
+                esp_rmaker_ts_spill_mark_reported(off);
+                expired++;
+            }
+        }
+    }
+    if (expired) {
+        ESP_LOGW(TAG, "Dropping %"PRIu32" stored time series entries, which cannot be timestamped anymore.", expired);
+        s_pending -= expired;
+        esp_rmaker_ts_spill_seek_pending(s_read_off);
+    }
+    xSemaphoreGive(s_spill_lock);
+}
+
+static const esp_rmaker_param_val_t *esp_rmaker_ts_spill_record_get(void *priv, uint16_t index, time_t *t)
+{
+    esp_rmaker_ts_spill_record_t *records = (esp_rmaker_ts_spill_record_t *)priv;
+    *t = records[index].t;
+    return &records[index].val;
+}
+
+static int esp_rmaker_ts_spill_populate(const char *name, esp_rmaker_val_type_t type, uint16_t count,
+        esp_rmaker_ts_spill_record_t *records, char *buf, size_t buf_size)
+{
+#ifdef CONFIG_ESP_RMAKER_TS_COMPACT
+    bool compact = true;
+#else
+    bool compact = false;
+#endif
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, buf, buf_size, NULL, NULL);
+    json_gen_start_object(&jstr);
+    json_gen_obj_set_string(&jstr, "ts_data_version", TS_DATA_VERSION);
+    json_gen_push_array(&jstr, "ts_data");
+    esp_rmaker_ts_encode_records(&jstr, name, type, count, esp_rmaker_ts_spill_record_get, records, compact);
+    json_gen_pop_array(&jstr);
+    if (json_gen_end_object(&jstr) < 0) {
+        return -1;
+    }
+    return json_gen_str_end(&jstr);
+}
+
+/* Converts the data of a TS_SPILL_MAGIC_UPTIME entry into a ts_data document. The string values point into
+ * the data, which should remain valid till the document is generated. Returns ESP_ERR_INVALID_RESPONSE if
+ * the data is invalid.
+ */
+static esp_err_t esp_rmaker_ts_spill_uptime_to_json(char *data, size_t len, char **doc, size_t *doc_len)
+{
+    esp_rmaker_ts_spill_uptime_hdr_t hdr;
+    if (len < sizeof(hdr)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    size_t off = sizeof(hdr);
+    if (!hdr.count || !hdr.name_len || (off + hdr.name_len > len) || data[off + hdr.name_len - 1]) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    const char *name = data + off;
+    off += hdr.name_len;
+    esp_rmaker_ts_spill_record_t *records = calloc(hdr.count, sizeof(esp_rmaker_ts_spill_record_t));
+    if (!records) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* The restart was just before this boot */
+    time_t boot_time = 0;
+    time(&boot_time);
+    boot_time -= esp_timer_get_time() / 1000000;
+    esp_err_t err = ESP_OK;
+    for (uint16_t i = 0; (i < hdr.count) && (err == ESP_OK); i++) {
+        int32_t rel_t, raw;
+        uint16_t str_len;
+        size_t val_len = (hdr.type == RMAKER_VAL_TYPE_STRING) ? sizeof(str_len) : sizeof(raw);
+        if (off + sizeof(rel_t) + val_len > len) {
+            err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+        memcpy(&rel_t, data + off, sizeof(rel_t));
+        off += sizeof(rel_t);
+        records[i].t = boot_time + rel_t;
+        records[i].val.type = hdr.type;
+        if (hdr.type == RMAKER_VAL_TYPE_STRING) {
+            memcpy(&str_len, data + off, sizeof(str_len));
+            off += sizeof(str_len);
+            if (!str_len || (off + str_len > len) || data[off + str_len - 1]) {
+                err = ESP_ERR_INVALID_RESPONSE;
+                break;
+            }
+            records[i].val.val.s = data + off;
+            off += str_len;
+            continue;
+        }
+        memcpy(&raw, data + off, sizeof(raw));
+        off += sizeof(raw);
+        switch (hdr.type) {
+            case RMAKER_VAL_TYPE_FLOAT:
+                memcpy(&records[i].val.val.f, &raw, sizeof(float));
+                break;
+            case RMAKER_VAL_TYPE_BOOLEAN:
+                records[i].val.val.b = raw;
+                break;
+            case RMAKER_VAL_TYPE_INTEGER:
+                records[i].val.val.i = raw;
+                break;
+            default:
+                err = ESP_ERR_INVALID_RESPONSE;
+                break;
+        }
+    }
+    if (err == ESP_OK) {
+        int json_len = esp_rmaker_ts_spill_populate(name, hdr.type, hdr.count, records, NULL, 0);
+        *doc = (json_len > 0) ? malloc(json_len) : NULL;
+        if (!*doc || (esp_rmaker_ts_spill_populate(name, hdr.type, hdr.count, records, *doc, json_len) < 0)) {
+            free(*doc);
+            *doc = NULL;
+            err = ESP_ERR_NO_MEM;
+        } else {
+            *doc_len = strlen(*doc);
+        }
+    }
+    free(records);
+    return err;
+}
+
+/* Reports the oldest pending entry, if the MQTT budget allows it. Returns ESP_ERR_NOT_FOUND if there is none. */
+static esp_err_t esp_rmaker_ts_replay_one(void)
+{
+    if (!s_pending) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* Leave the budget for the live data */
+    if (!esp_rmaker_mqtt_is_budget_available()) {
+        return ESP_FAIL;
+    }
+    esp_rmaker_ts_spill_hdr_t hdr;
+    if (!esp_rmaker_ts_spill_read_hdr(s_read_off, &hdr)) {
+        esp_rmaker_ts_spill_seek_pending(s_read_off);
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Entries with timestamps relative to the restart can be converted only once the time is available */
+    if ((hdr.magic == TS_SPILL_MAGIC_UPTIME) && (esp_rmaker_time_check() != true)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char *data = malloc(hdr.len);
+    if (!data) {
+        return ESP_ERR_NO_MEM;
+    }
+    char *doc = data;
+    size_t doc_len = hdr.len;
+    esp_err_t err = esp_partition_read(s_spill_part, s_read_off + sizeof(hdr), data, hdr.len);
+    if ((err == ESP_OK) && (hdr.magic == TS_SPILL_MAGIC_UPTIME)) {
+        err = esp_rmaker_ts_spill_uptime_to_json(data, hdr.len, &doc, &doc_len);
+        if (err == ESP_ERR_INVALID_RESPONSE) {
+            ESP_LOGE(TAG, "Dropping invalid time series entry.");
+        }
+    }
+    if (err == ESP_OK) {
+        const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_TS_DATA);
+        err = esp_rmaker_mqtt_publish(publish_topic, doc, doc_len, RMAKER_MQTT_QOS1, NULL);
+    }
+    if (doc != data) {
+        free(doc);
+    }
+    free(data);
+    if ((err != ESP_OK) && (err != ESP_ERR_INVALID_RESPONSE)) {
+        return err;
+    }
+    esp_rmaker_ts_spill_mark_reported(s_read_off);
+    s_pending--;
+    esp_rmaker_ts_spill_seek_pending(s_read_off + TS_SPILL_ALIGN(sizeof(hdr) + hdr.len));
+    return err;
+}
+
+/* Reports one entry per run, so that the replay after an outage is spread out */
+static void esp_rmaker_ts_replay_work_cb(void *priv_data)
+{
+    s_replay_queued = false;
+    xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+    esp_err_t err = esp_rmaker_ts_replay_one();
+    bool pending = s_pending;
+    xSemaphoreGive(s_spill_lock);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Reported stored time series data. %"PRIu32" entries pending.", s_pending);
+    }
+    if (pending) {
+        esp_rmaker_ts_replay_schedule(false);
+    }
+}
+
+static void esp_rmaker_ts_replay_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_ts_replay_schedule(true);
+}
+
+static void esp_rmaker_ts_spill_event_handler(void* arg, esp_event_base_t event_base,
+                          int32_t event_id, void* event_data)
+{
+    if (s_pending) {
+        esp_rmaker_ts_replay_schedule(true);
+    }
+}
+
+esp_err_t esp_rmaker_ts_spill_init(void)
+{
+    if (s_spill_part) {
+        return ESP_OK;
+    }
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+            CONFIG_ESP_RMAKER_TS_SPILL_PARTITION);
+    if (!part) {
+        ESP_LOGW(TAG, "Partition %s not found. Time series data will not be stored in flash.",
+                CONFIG_ESP_RMAKER_TS_SPILL_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if ((part->size < TS_SPILL_SECTOR_SIZE) || (part->size % TS_SPILL_SECTOR_SIZE) || part->encrypted) {
+        ESP_LOGE(TAG, "Partition %s should be an unencrypted, sector aligned one.", CONFIG_ESP_RMAKER_TS_SPILL_PARTITION);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s_spill_lock = xSemaphoreCreateMutex();
+    s_replay_timer = xTimerCreate("ts_replay_tm", pdMS_TO_TICKS(CONFIG_ESP_RMAKER_TS_SPILL_REPLAY_INTERVAL),
+            pdFALSE, NULL, esp_rmaker_ts_replay_timer_cb);
+    if (!s_spill_lock || !s_replay_timer) {
+        ESP_LOGE(TAG, "Failed to create time series replay lock/timer.");
+        if (s_spill_lock) {
+            vSemaphoreDelete(s_spill_lock);
+            s_spill_lock = NULL;
+        }
+        if (s_replay_timer) {
+            xTimerDelete(s_replay_timer, 0);
+            s_replay_timer = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    s_spill_part = part;
+    esp_rmaker_ts_spill_recover();
+    s_boot_seq = s_seq;
+    /* Entries relative to the restart are valid only if this boot is the result of one */
+    if (esp_reset_reason() != ESP_RST_SW) {
+        esp_rmaker_ts_spill_expire_uptime();
+    }
+    return esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_CONNECTED,
+            &esp_rmaker_ts_spill_event_handler, NULL);
+}
+
+uint32_t esp_rmaker_ts_spill_get_pending(void)
+{
+    return s_pending;
+}
+
+#endif /* CONFIG_ESP_RMAKER_TS_SPILL */
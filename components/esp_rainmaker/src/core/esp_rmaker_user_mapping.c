@@ -105,6 +105,8 @@ static void esp_rmaker_user_mapping_event_handler(void* arg, esp_event_base_t ev
                 esp_rmaker_post_event(RMAKER_EVENT_USER_NODE_MAPPING_DONE, rmaker_user_mapping_data->user_id,
                     strlen(rmaker_user_mapping_data->user_id) + 1);
             }
+            /* The node config should be reported again after a change in the user, even if unchanged */
+            esp_rmaker_node_config_clear_hash();
 #ifdef CONFIG_ESP_RMAKER_USER_ID_CHECK
             /* Store User Id in NVS since acknowledgement of the user-node association message is received */
             nvs_handle handle;
@@ -148,8 +150,7 @@ static void esp_rmaker_user_mapping_cb(void *priv_data)
     }
     json_gen_end_object(&jstr);
     json_gen_str_end(&jstr);
-    char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-    esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), USER_MAPPING_TOPIC_SUFFIX, USER_MAPPING_TOPIC_RULE);
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_USER_MAPPING);
     esp_err_t err = esp_rmaker_mqtt_publish(publish_topic, publish_payload, strlen(publish_payload), RMAKER_MQTT_QOS1, &rmaker_user_mapping_data->mqtt_msg_id);
     ESP_LOGI(TAG, "MQTT Publish: %s", publish_payload);
     if (err != ESP_OK) {
@@ -0,0 +1,274 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_work_lanes.h>
+#include "esp_rmaker_internal.h"
+#include "esp_rmaker_metrics_internal.h"
+
+static const char *TAG = "esp_rmaker_work_lanes";
+
+#ifdef CONFIG_ESP_RMAKER_WORK_LANES
+
+#if defined(CONFIG_ESP_RMAKER_WORK_LANES_SECOND_WORKER) && (portNUM_PROCESSORS > 1)
+#define WORK_LANES_WORKERS      2
+#else
+#define WORK_LANES_WORKERS      1
+#endif
+
+#define WORK_LANES_QUEUE_SIZE   CONFIG_ESP_RMAKER_WORK_LANES_QUEUE_SIZE
+#define WORK_LANES_TASK_STACK   CONFIG_ESP_RMAKER_WORK_LANES_TASK_STACK
+#define WORK_LANES_TASK_PRIO    CONFIG_ESP_RMAKER_WORK_LANES_TASK_PRIORITY
+
+typedef struct {
+    esp_rmaker_work_fn_t work_fn;
+    void *priv_data;
+    int64_t queued_at;
+} esp_rmaker_work_job_t;
+
+/* Every worker serves the lanes from RMAKER_WORK_LANE_HIGH till (but excluding) its "lanes".
+ * So the first worker serves all of them, and the second one, only the high priority lane.
+ * The pending semaphore of a worker is given once for every job added to any of its lanes.
+ * Since a job is queued before the semaphore is given, a worker may find its lanes empty on
+ * waking up (the other worker picked the job), but a job is never left behind.
+ */
+typedef struct {
+    SemaphoreHandle_t pending;
+    uint8_t lanes;
+    TaskHandle_t task;
+} esp_rmaker_work_worker_t;
+
+static QueueHandle_t s_lanes[RMAKER_WORK_LANE_MAX];
+static esp_rmaker_work_worker_t s_workers[WORK_LANES_WORKERS];
+static esp_rmaker_work_lane_stats_t s_lane_stats[RMAKER_WORK_LANE_MAX];
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_started;
+
+static const char *lane_names[RMAKER_WORK_LANE_MAX] = {"high", "normal", "low"};
+
+static int esp_rmaker_work_hist_bucket(int64_t us)
+{
+    int bucket = 0;
+    int64_t limit = 1000;
+    while ((bucket < (RMAKER_WORK_HIST_BUCKETS - 1)) && (us >= limit)) {
+        bucket++;
+        limit *= 4;
+    }
+    return bucket;
+}
+
+static void esp_rmaker_work_record(esp_rmaker_work_lane_t lane, int64_t wait_us, int64_t run_us)
+{
+    esp_rmaker_work_lane_stats_t *stats = &s_lane_stats[lane];
+    int wait_bucket = esp_rmaker_work_hist_bucket(wait_us);
+    int run_bucket = esp_rmaker_work_hist_bucket(run_us);
+    portENTER_CRITICAL(&s_stats_lock);
+    stats->jobs++;
+    stats->wait_hist[wait_bucket]++;
+    stats->run_hist[run_bucket]++;
+    if (wait_us > stats->max_wait_us) {
+        stats->max_wait_us = (uint32_t)wait_us;
+    }
+    if (run_us > stats->max_run_us) {
+        stats->max_run_us = (uint32_t)run_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void esp_rmaker_work_lanes_update_depth(void)
+{
+#ifdef CONFIG_ESP_RMAKER_METRICS
+    uint32_t depth = 0;
+    for (int i = 0; i < RMAKER_WORK_LANE_MAX; i++) {
+        depth += uxQueueMessagesWaiting(s_lanes[i]);
+    }
+    ESP_RMAKER_METRIC_SET(RMAKER_METRIC_WORK_DEPTH, depth);
+#endif
+}
+
+static void esp_rmaker_work_lanes_task(void *arg)
+{
+    esp_rmaker_work_worker_t *worker = (esp_rmaker_work_worker_t *)arg;
+    while (1) {
+        xSemaphoreTake(worker->pending, portMAX_DELAY);
+        esp_rmaker_work_job_t job;
+        for (int lane = 0; lane < worker->lanes; lane++) {
+            if (xQueueReceive(s_lanes[lane], &job, 0) == pdTRUE) {
+                esp_rmaker_work_lanes_update_depth();
+                int64_t start = esp_timer_get_time();
+                job.work_fn(job.priv_data);
+                int64_t end = esp_timer_get_time();
+                esp_rmaker_work_record(lane, start - job.queued_at, end - start);
+                break;
+            }
+        }
+    }
+}
+
+esp_err_t esp_rmaker_work_lanes_init(void)
+{
+    if (s_lanes[0]) {
+        return ESP_OK;
+    }
+    for (int i = 0; i < RMAKER_WORK_LANE_MAX; i++) {
+        s_lanes[i] = xQueueCreate(WORK_LANES_QUEUE_SIZE, sizeof(esp_rmaker_work_job_t));
+        if (!s_lanes[i]) {
+            goto init_err;
+        }
+    }
+    for (int i = 0; i < WORK_LANES_WORKERS; i++) {
+        s_workers[i].lanes = (i == 0) ? RMAKER_WORK_LANE_MAX : (RMAKER_WORK_LANE_HIGH + 1);
+        s_workers[i].pending = xSemaphoreCreateCounting(WORK_LANES_QUEUE_SIZE * s_workers[i].lanes, 0);
+        if (!s_workers[i].pending) {
+            goto init_err;
+        }
+    }
+    return ESP_OK;
+init_err:
+    ESP_LOGE(TAG, "Failed to create the work lanes.");
+    esp_rmaker_work_lanes_deinit();
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_rmaker_work_lanes_deinit(void)
+{
+    if (s_started) {
+        ESP_LOGE(TAG, "Cannot deinit the work lanes once started.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < RMAKER_WORK_LANE_MAX; i++) {
+        if (s_lanes[i]) {
+            vQueueDelete(s_lanes[i]);
+            s_lanes[i] = NULL;
+        }
+    }
+    for (int i = 0; i < WORK_LANES_WORKERS; i++) {
+        if (s_workers[i].pending) {
+            vSemaphoreDelete(s_workers[i].pending);
+            s_workers[i].pending = NULL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lanes_start(void)
+{
+    if (!s_lanes[0]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_started) {
+        return ESP_OK;
+    }
+    for (int i = 0; i < WORK_LANES_WORKERS; i++) {
+        BaseType_t ret;
+        if (i == 0) {
+            ret = xTaskCreate(&esp_rmaker_work_lanes_task, "rmaker_lanes", WORK_LANES_TASK_STACK,
+                    &s_workers[i], WORK_LANES_TASK_PRIO, &s_workers[i].task);
+        } else {
+            /* The high priority worker is pinned to the core other than the one on which RainMaker
+             * is being started, which typically is where the networking stack and the rest of the
+             * work run, so that it does not compete with them.
+             */
+            ret = xTaskCreatePinnedToCore(&esp_rmaker_work_lanes_task, "rmaker_lanes_hi", WORK_LANES_TASK_STACK,
+                    &s_workers[i], WORK_LANES_TASK_PRIO, &s_workers[i].task, !xPortGetCoreID());
+        }
+        if (ret != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create work lanes task %d.", i);
+            /* The tasks already created keep serving the lanes */
+            return (i == 0) ? ESP_FAIL : ESP_OK;
+        }
+        s_started = true;
+    }
+    ESP_LOGI(TAG, "Started %d work lanes worker(s).", WORK_LANES_WORKERS);
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lane_add_task(esp_rmaker_work_lane_t lane, esp_rmaker_work_fn_t work_fn, void *priv_data)
+{
+    if ((lane >= RMAKER_WORK_LANE_MAX) || !work_fn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lanes[lane]) {
+        ESP_LOGE(TAG, "Work lanes not initialised.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_rmaker_work_job_t job = {
+        .work_fn = work_fn,
+        .priv_data = priv_data,
+        .queued_at = esp_timer_get_time(),
+    };
+    if (xQueueSend(s_lanes[lane], &job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "The %s priority work lane is full.", lane_names[lane]);
+        portENTER_CRITICAL(&s_stats_lock);
+        s_lane_stats[lane].dropped++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < WORK_LANES_WORKERS; i++) {
+        if (lane < s_workers[i].lanes) {
+            xSemaphoreGive(s_workers[i].pending);
+        }
+    }
+    esp_rmaker_work_lanes_update_depth();
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lanes_get_stats(esp_rmaker_work_lanes_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_stats_lock);
+    memcpy(stats->lane, s_lane_stats, sizeof(stats->lane));
+    portEXIT_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < RMAKER_WORK_LANE_MAX; i++) {
+        stats->lane[i].depth = s_lanes[i] ? uxQueueMessagesWaiting(s_lanes[i]) : 0;
+    }
+    stats->workers = WORK_LANES_WORKERS;
+    return ESP_OK;
+}
+
+#else /* !CONFIG_ESP_RMAKER_WORK_LANES */
+
+esp_err_t esp_rmaker_work_lanes_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lanes_deinit(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lanes_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_work_lane_add_task(esp_rmaker_work_lane_t lane, esp_rmaker_work_fn_t work_fn, void *priv_data)
+{
+    if ((lane >= RMAKER_WORK_LANE_MAX) || !work_fn) {
+        ESP_LOGE(TAG, "Invalid work lane or function.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_rmaker_work_queue_add_task(work_fn, priv_data);
+}
+
+esp_err_t esp_rmaker_work_lanes_get_stats(esp_rmaker_work_lanes_stats_t *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* CONFIG_ESP_RMAKER_WORK_LANES */
@@ -18,6 +18,8 @@
 #include <esp_rmaker_core.h>
 
 #include "esp_rmaker_mqtt_budget.h"
+#include "esp_rmaker_mqtt_queue.h"
+#include "esp_rmaker_metrics_internal.h"
 
 static const char *TAG = "esp_rmaker_mqtt";
 static esp_rmaker_mqtt_config_t g_mqtt_config;
@@ -49,6 +51,9 @@ esp_err_t esp_rmaker_mqtt_init(esp_rmaker_mqtt_conn_params_t *conn_params)
             if (esp_rmaker_mqtt_budgeting_init() != ESP_OK) {
                 ESP_LOGE(TAG, "Failied to initialise MQTT Budgeting.");
             }
+            if (esp_rmaker_mqtt_queue_init() != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to initialise MQTT publish queue.");
+            }
         }
         return err;
     }
@@ -107,16 +112,23 @@ esp_err_t esp_rmaker_mqtt_unsubscribe(const char *topic)
     return ESP_OK;
 }
 
-esp_err_t esp_rmaker_mqtt_publish(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id)
+esp_err_t esp_rmaker_mqtt_publish_class(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id,
+        esp_rmaker_mqtt_prio_t prio)
 {
-    if (esp_rmaker_mqtt_is_budget_available() != true) {
+    uint32_t cost = esp_rmaker_mqtt_budget_get_cost(data_len);
+    if (esp_rmaker_mqtt_budget_class_try_consume(prio, cost) != true) {
         ESP_LOGE(TAG, "Out of MQTT Budget. Dropping publish message.");
+        ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_MQTT_BUDGET_DROPS, 1);
         return ESP_FAIL;
     }
     if (g_mqtt_config.publish) {
         esp_err_t err = g_mqtt_config.publish(topic, data, data_len, qos, msg_id);
-        if (err == ESP_OK) {
-            esp_rmaker_mqtt_decrease_budget(1);
+        if (err != ESP_OK) {
+            /* Budget is consumed only by the messages actually published */
+            esp_rmaker_mqtt_budget_class_refund(prio, cost);
+        } else {
+            ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_MQTT_PUBLISHES, 1);
+            ESP_RMAKER_METRIC_OBSERVE(RMAKER_METRIC_MQTT_PUBLISH_BYTES, data_len);
         }
         return err;
     }
@@ -124,6 +136,11 @@ esp_err_t esp_rmaker_mqtt_publish(const char *topic, void *data, size_t data_len
     return ESP_OK;
 }
 
+esp_err_t esp_rmaker_mqtt_publish(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id)
+{
+    return esp_rmaker_mqtt_publish_class(topic, data, data_len, qos, msg_id, RMAKER_MQTT_PRIO_MAX);
+}
+
 void esp_rmaker_create_mqtt_topic(char *buf, size_t buf_size, const char *topic_suffix, const char *rule)
 {
 #ifdef CONFIG_ESP_RMAKER_MQTT_USE_BASIC_INGEST_TOPICS
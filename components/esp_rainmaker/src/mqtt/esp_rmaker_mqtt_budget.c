@@ -7,135 +7,311 @@
 
 #include <sdkconfig.h>
 #include <esp_log.h>
+#include <esp_rmaker_mqtt.h>
+#include "esp_rmaker_mqtt_budget.h"
 
 static const char *TAG = "esp_rmaker_mqtt_budget";
 
 #ifdef CONFIG_ESP_RMAKER_MQTT_ENABLE_BUDGETING
 
-#include <freertos/FreeRTOS.h>
-#include <freertos/timers.h>
-#include <freertos/semphr.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <esp_timer.h>
 
 #define DEFAULT_BUDGET              CONFIG_ESP_RMAKER_MQTT_DEFAULT_BUDGET
 #define MAX_BUDGET                  CONFIG_ESP_RMAKER_MQTT_MAX_BUDGET
 #define BUDGET_REVIVE_COUNT         CONFIG_ESP_RMAKER_MQTT_BUDGET_REVIVE_COUNT
 #define BUDGET_REVIVE_PERIOD        CONFIG_ESP_RMAKER_MQTT_BUDGET_REVIVE_PERIOD
+#define BUDGET_REVIVE_PERIOD_US     (BUDGET_REVIVE_PERIOD * 1000000LL)
+#define BUDGET_BYTES_PER_UNIT       CONFIG_ESP_RMAKER_MQTT_BUDGET_BYTES_PER_UNIT
 
-static int16_t mqtt_budget = DEFAULT_BUDGET;
-static TimerHandle_t mqtt_budget_timer;
-static SemaphoreHandle_t mqtt_budget_lock;
-#define SEMAPHORE_DELAY_MSEC         500
+/* Token bucket, which is refilled lazily, based on the number of revive periods elapsed since the last
+ * refill, instead of using a timer. All the operations are lock-free, so that publishing never blocks.
+ */
+typedef struct {
+    atomic_int_fast32_t budget;
+    /* Index of the revive period (as per esp_timer_get_time()) till which the budget has been revived */
+    atomic_uint_fast32_t period;
+    /* 0 if the bucket does not limit anything, which is possible only for the classes */
+    atomic_int_fast32_t max_budget;
+    atomic_int_fast32_t revive_count;
+    atomic_uint_fast32_t messages;
+    atomic_uint_fast32_t consumed;
+    atomic_uint_fast32_t rejected;
+} esp_rmaker_mqtt_bucket_t;
 
-bool esp_rmaker_mqtt_is_budget_available(void)
+/* The overall bucket, followed by one per class */
+static esp_rmaker_mqtt_bucket_t mqtt_buckets[1 + RMAKER_MQTT_PRIO_MAX];
+#define GLOBAL_BUCKET               (&mqtt_buckets[0])
+static atomic_bool mqtt_budget_running;
+static atomic_bool mqtt_budget_initialised;
+
+static uint32_t esp_rmaker_mqtt_budget_get_period(void)
 {
-    if (mqtt_budget_lock == NULL) {
-        ESP_LOGW(TAG, "MQTT budgeting not started yet. Allowing publish.");
+    return esp_timer_get_time() / BUDGET_REVIVE_PERIOD_US;
+}
+
+/* Returns the bucket of the class, or NULL if there is no such class, or it is not limited */
+static esp_rmaker_mqtt_bucket_t *esp_rmaker_mqtt_class_bucket(esp_rmaker_mqtt_prio_t prio)
+{
+    if ((prio >= RMAKER_MQTT_PRIO_MAX) || !atomic_load(&mqtt_buckets[1 + prio].max_budget)) {
+        return NULL;
+    }
+    return &mqtt_buckets[1 + prio];
+}
+
+static void esp_rmaker_mqtt_bucket_add(esp_rmaker_mqtt_bucket_t *bucket, int32_t budget)
+{
+    int_fast32_t max_budget = atomic_load(&bucket->max_budget);
+    int_fast32_t cur = atomic_load(&bucket->budget);
+    int_fast32_t new;
+    do {
+        new = cur + budget;
+        if (new > max_budget) {
+            new = max_budget;
+        } else if (new < 0) {
+            new = 0;
+        }
+    } while (!atomic_compare_exchange_weak(&bucket->budget, &cur, new));
+}
+
+/* Adds the budget for the revive periods elapsed since the last refill. Only the caller which
+ * advances the period adds the budget, so concurrent callers cannot add it twice.
+ */
+static void esp_rmaker_mqtt_bucket_refill(esp_rmaker_mqtt_bucket_t *bucket)
+{
+    if (!atomic_load(&mqtt_budget_running)) {
+        return;
+    }
+    uint32_t now = esp_rmaker_mqtt_budget_get_period();
+    uint_fast32_t last = atomic_load(&bucket->period);
+    while (now > last) {
+        if (atomic_compare_exchange_weak(&bucket->period, &last, now)) {
+            uint32_t periods = now - last;
+            /* Avoid overflow after a long time. The budget is capped anyway. */
+            if (periods > MAX_BUDGET) {
+                periods = MAX_BUDGET;
+            }
+            esp_rmaker_mqtt_bucket_add(bucket, periods * atomic_load(&bucket->revive_count));
+            return;
+        }
+    }
+}
+
+/* A message costing more than the maximum budget of a bucket could never be published otherwise */
+static int32_t esp_rmaker_mqtt_bucket_cost(esp_rmaker_mqtt_bucket_t *bucket, uint32_t cost)
+{
+    int32_t max_budget = atomic_load(&bucket->max_budget);
+    return (cost > max_budget) ? max_budget : cost;
+}
+
+static bool esp_rmaker_mqtt_bucket_available(esp_rmaker_mqtt_bucket_t *bucket, uint32_t cost)
+{
+    esp_rmaker_mqtt_bucket_refill(bucket);
+    return atomic_load(&bucket->budget) >= esp_rmaker_mqtt_bucket_cost(bucket, cost);
+}
+
+static bool esp_rmaker_mqtt_bucket_try_consume(esp_rmaker_mqtt_bucket_t *bucket, uint32_t cost)
+{
+    esp_rmaker_mqtt_bucket_refill(bucket);
+    int32_t bucket_cost = esp_rmaker_mqtt_bucket_cost(bucket, cost);
+    int_fast32_t cur = atomic_load(&bucket->budget);
+    do {
+        if (cur < bucket_cost) {
+            atomic_fetch_add(&bucket->rejected, 1);
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&bucket->budget, &cur, cur - bucket_cost));
+    atomic_fetch_add(&bucket->messages, 1);
+    atomic_fetch_add(&bucket->consumed, bucket_cost);
+    return true;
+}
+
+static void esp_rmaker_mqtt_bucket_refund(esp_rmaker_mqtt_bucket_t *bucket, uint32_t cost)
+{
+    int32_t bucket_cost = esp_rmaker_mqtt_bucket_cost(bucket, cost);
+    esp_rmaker_mqtt_bucket_add(bucket, bucket_cost);
+    atomic_fetch_sub(&bucket->messages, 1);
+    atomic_fetch_sub(&bucket->consumed, bucket_cost);
+}
+
+uint32_t esp_rmaker_mqtt_budget_get_cost(size_t data_len)
+{
+#if BUDGET_BYTES_PER_UNIT > 0
+    return data_len ? ((data_len + BUDGET_BYTES_PER_UNIT - 1) / BUDGET_BYTES_PER_UNIT) : 1;
+#else
+    return 1;
+#endif
+}
+
+bool esp_rmaker_mqtt_budget_class_available(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+    if (!atomic_load(&mqtt_budget_initialised)) {
         return true;
     }
-    if (xSemaphoreTake(mqtt_budget_lock, SEMAPHORE_DELAY_MSEC/portTICK_PERIOD_MS) != pdTRUE) {
-        ESP_LOGW(TAG, "Could not acquire MQTT budget lock. Allowing publish.");
+    esp_rmaker_mqtt_bucket_t *class_bucket = esp_rmaker_mqtt_class_bucket(prio);
+    if (class_bucket && !esp_rmaker_mqtt_bucket_available(class_bucket, cost)) {
+        return false;
+    }
+    return esp_rmaker_mqtt_bucket_available(GLOBAL_BUCKET, cost);
+}
+
+bool esp_rmaker_mqtt_budget_class_try_consume(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+    if (!atomic_load(&mqtt_budget_initialised)) {
         return true;
     }
-    int16_t budget = mqtt_budget;
-    xSemaphoreGive(mqtt_budget_lock);
-    return budget ? true : false;
+    esp_rmaker_mqtt_bucket_t *class_bucket = esp_rmaker_mqtt_class_bucket(prio);
+    if (class_bucket && !esp_rmaker_mqtt_bucket_try_consume(class_bucket, cost)) {
+        return false;
+    }
+    if (!esp_rmaker_mqtt_bucket_try_consume(GLOBAL_BUCKET, cost)) {
+        if (class_bucket) {
+            esp_rmaker_mqtt_bucket_refund(class_bucket, cost);
+        }
+        return false;
+    }
+    return true;
+}
+
+void esp_rmaker_mqtt_budget_class_refund(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+    if (!atomic_load(&mqtt_budget_initialised)) {
+        return;
+    }
+    esp_rmaker_mqtt_bucket_t *class_bucket = esp_rmaker_mqtt_class_bucket(prio);
+    if (class_bucket) {
+        esp_rmaker_mqtt_bucket_refund(class_bucket, cost);
+    }
+    esp_rmaker_mqtt_bucket_refund(GLOBAL_BUCKET, cost);
+}
+
+bool esp_rmaker_mqtt_budget_try_consume(uint8_t budget)
+{
+    return esp_rmaker_mqtt_budget_class_try_consume(RMAKER_MQTT_PRIO_MAX, budget);
+}
+
+uint32_t esp_rmaker_mqtt_budget_get_revive_delay(void)
+{
+    int64_t next = (int64_t)(esp_rmaker_mqtt_budget_get_period() + 1) * BUDGET_REVIVE_PERIOD_US;
+    return (next - esp_timer_get_time()) / 1000 + 1;
+}
+
+bool esp_rmaker_mqtt_is_budget_available(void)
+{
+    if (!atomic_load(&mqtt_budget_initialised)) {
+        ESP_LOGW(TAG, "MQTT budgeting not started yet. Allowing publish.");
+        return true;
+    }
+    return esp_rmaker_mqtt_bucket_available(GLOBAL_BUCKET, 1);
 }
 
 esp_err_t esp_rmaker_mqtt_increase_budget(uint8_t budget)
 {
-    if (mqtt_budget_lock == NULL) {
+    if (!atomic_load(&mqtt_budget_initialised)) {
         ESP_LOGW(TAG, "MQTT budgeting not started. Not increasing the budget.");
         return ESP_FAIL;
     }
-    if (xSemaphoreTake(mqtt_budget_lock, SEMAPHORE_DELAY_MSEC/portTICK_PERIOD_MS) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to increase MQTT budget.");
-        return ESP_FAIL;
-    }
-    mqtt_budget += budget;
-    if (mqtt_budget > MAX_BUDGET) {
-        mqtt_budget = MAX_BUDGET;
-    }
-    xSemaphoreGive(mqtt_budget_lock);
-    ESP_LOGD(TAG, "MQTT budget increased to %d", mqtt_budget);
+    esp_rmaker_mqtt_bucket_add(GLOBAL_BUCKET, budget);
+    ESP_LOGD(TAG, "MQTT budget increased to %d", (int)atomic_load(&GLOBAL_BUCKET->budget));
     return ESP_OK;
 }
 
 esp_err_t esp_rmaker_mqtt_decrease_budget(uint8_t budget)
 {
-    if (mqtt_budget_lock == NULL) {
+    if (!atomic_load(&mqtt_budget_initialised)) {
         ESP_LOGW(TAG, "MQTT budgeting not started. Not decreasing the budget.");
         return ESP_FAIL;
     }
-    if (xSemaphoreTake(mqtt_budget_lock, SEMAPHORE_DELAY_MSEC/portTICK_PERIOD_MS) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to decrease MQTT budget.");
-        return ESP_FAIL;
-    }
-    mqtt_budget -= budget;
-    if (mqtt_budget < 0) {
-        mqtt_budget = 0;
+    esp_rmaker_mqtt_bucket_add(GLOBAL_BUCKET, -(int32_t)budget);
+    ESP_LOGD(TAG, "MQTT budget decreased to %d.", (int)atomic_load(&GLOBAL_BUCKET->budget));
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_mqtt_set_class_budget(esp_rmaker_mqtt_prio_t prio, uint16_t max_budget, uint16_t revive_count)
+{
+    if ((prio >= RMAKER_MQTT_PRIO_MAX) || (max_budget && !revive_count)) {
+        return ESP_ERR_INVALID_ARG;
     }
-    xSemaphoreGive(mqtt_budget_lock);
-    ESP_LOGD(TAG, "MQTT budget decreased to %d.", mqtt_budget);
+    esp_rmaker_mqtt_bucket_t *bucket = &mqtt_buckets[1 + prio];
+    /* Disable the bucket while it is being changed */
+    atomic_store(&bucket->max_budget, 0);
+    atomic_store(&bucket->revive_count, revive_count);
+    atomic_store(&bucket->period, esp_rmaker_mqtt_budget_get_period());
+    atomic_store(&bucket->budget, max_budget);
+    atomic_store(&bucket->max_budget, max_budget);
     return ESP_OK;
 }
 
-static void esp_rmaker_mqtt_revive_budget(TimerHandle_t handle)
+esp_err_t esp_rmaker_mqtt_get_budget_stats(esp_rmaker_mqtt_budget_stats_t *stats)
 {
-    esp_rmaker_mqtt_increase_budget(BUDGET_REVIVE_COUNT);
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(stats, 0, sizeof(esp_rmaker_mqtt_budget_stats_t));
+    for (int i = 0; i < 1 + RMAKER_MQTT_PRIO_MAX; i++) {
+        esp_rmaker_mqtt_bucket_t *bucket = &mqtt_buckets[i];
+        esp_rmaker_mqtt_bucket_stats_t *bucket_stats = i ? &stats->prio[i - 1] : &stats->total;
+        esp_rmaker_mqtt_bucket_refill(bucket);
+        bucket_stats->max_budget = atomic_load(&bucket->max_budget);
+        bucket_stats->budget = bucket_stats->max_budget ? atomic_load(&bucket->budget) : 0;
+        bucket_stats->messages = atomic_load(&bucket->messages);
+        bucket_stats->consumed = atomic_load(&bucket->consumed);
+        bucket_stats->rejected = atomic_load(&bucket->rejected);
+    }
+    stats->bytes_per_unit = BUDGET_BYTES_PER_UNIT;
+    return ESP_OK;
 }
 
 esp_err_t esp_rmaker_mqtt_budgeting_start(void)
 {
-    if (mqtt_budget_timer) {
-        xTimerStart(mqtt_budget_timer, 0);
-        return ESP_OK;
+    if (!atomic_load(&mqtt_budget_initialised)) {
+        return ESP_FAIL;
     }
-    return ESP_FAIL;
+    /* The budget does not revive for the time during which budgeting was stopped */
+    if (!atomic_exchange(&mqtt_budget_running, true)) {
+        uint32_t period = esp_rmaker_mqtt_budget_get_period();
+        for (int i = 0; i < 1 + RMAKER_MQTT_PRIO_MAX; i++) {
+            atomic_store(&mqtt_buckets[i].period, period);
+        }
+    }
+    return ESP_OK;
 }
 
 esp_err_t esp_rmaker_mqtt_budgeting_stop(void)
 {
-    if (mqtt_budget_timer) {
-        xTimerStop(mqtt_budget_timer, 100);
-        return ESP_OK;
+    if (!atomic_load(&mqtt_budget_initialised)) {
+        return ESP_FAIL;
     }
-    return ESP_FAIL;
+    for (int i = 0; i < 1 + RMAKER_MQTT_PRIO_MAX; i++) {
+        esp_rmaker_mqtt_bucket_refill(&mqtt_buckets[i]);
+    }
+    atomic_store(&mqtt_budget_running, false);
+    return ESP_OK;
 }
 
 esp_err_t esp_rmaker_mqtt_budgeting_deinit(void)
 {
-    if (mqtt_budget_timer) {
+    if (atomic_load(&mqtt_budget_initialised)) {
         esp_rmaker_mqtt_budgeting_stop();
-        xTimerDelete(mqtt_budget_timer, 100);
-        mqtt_budget_timer = NULL;
-    }
-    if (mqtt_budget_lock) {
-        vSemaphoreDelete(mqtt_budget_lock);
-        mqtt_budget_lock = NULL;
+        atomic_store(&mqtt_budget_initialised, false);
     }
     return ESP_OK;
 }
 
 esp_err_t esp_rmaker_mqtt_budgeting_init(void)
 {
-    if (mqtt_budget_timer) {
+    if (atomic_load(&mqtt_budget_initialised)) {
         ESP_LOGI(TAG, "MQTT budgeting already initialised.");
         return ESP_OK;
     }
-
-    mqtt_budget_lock = xSemaphoreCreateMutex();
-    if (!mqtt_budget_lock) {
-        return ESP_FAIL;
-    }
-
-    mqtt_budget_timer = xTimerCreate("mqtt_budget_tm", (BUDGET_REVIVE_PERIOD * 1000) / portTICK_PERIOD_MS,
-                            pdTRUE, NULL, esp_rmaker_mqtt_revive_budget);
-    if (mqtt_budget_timer) {
-        ESP_LOGI(TAG, "MQTT Budgeting initialised. Default: %d, Max: %d, Revive count: %d, Revive period: %d",
-                DEFAULT_BUDGET, MAX_BUDGET, BUDGET_REVIVE_COUNT, BUDGET_REVIVE_PERIOD);
-        return ESP_OK;
-    }
-    return ESP_FAIL;
+    atomic_store(&GLOBAL_BUCKET->budget, DEFAULT_BUDGET);
+    atomic_store(&GLOBAL_BUCKET->max_budget, MAX_BUDGET);
+    atomic_store(&GLOBAL_BUCKET->revive_count, BUDGET_REVIVE_COUNT);
+    atomic_store(&mqtt_budget_initialised, true);
+    ESP_LOGI(TAG, "MQTT Budgeting initialised. Default: %d, Max: %d, Revive count: %d, Revive period: %d",
+            DEFAULT_BUDGET, MAX_BUDGET, BUDGET_REVIVE_COUNT, BUDGET_REVIVE_PERIOD);
+    return ESP_OK;
 }
 
 #else /* ! CONFIG_ESP_RMAKER_MQTT_ENABLE_BUDGETING */
@@ -179,4 +355,43 @@ bool esp_rmaker_mqtt_is_budget_available(void)
     return true;
 }
 
+bool esp_rmaker_mqtt_budget_try_consume(uint8_t budget)
+{
+    return true;
+}
+
+uint32_t esp_rmaker_mqtt_budget_get_cost(size_t data_len)
+{
+    return 1;
+}
+
+bool esp_rmaker_mqtt_budget_class_available(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+    return true;
+}
+
+bool esp_rmaker_mqtt_budget_class_try_consume(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+    return true;
+}
+
+void esp_rmaker_mqtt_budget_class_refund(esp_rmaker_mqtt_prio_t prio, uint32_t cost)
+{
+}
+
+esp_err_t esp_rmaker_mqtt_set_class_budget(esp_rmaker_mqtt_prio_t prio, uint16_t max_budget, uint16_t revive_count)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_rmaker_mqtt_get_budget_stats(esp_rmaker_mqtt_budget_stats_t *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+uint32_t esp_rmaker_mqtt_budget_get_revive_delay(void)
+{
+    return 0;
+}
+
 #endif /* ! CONFIG_ESP_RMAKER_MQTT_ENABLE_BUDGETING */
@@ -7,7 +7,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_err.h>
+#include <esp_rmaker_mqtt.h>
 
 esp_err_t esp_rmaker_mqtt_budgeting_init(void);
 esp_err_t esp_rmaker_mqtt_budgeting_deinit(void);
@@ -16,3 +18,15 @@ esp_err_t esp_rmaker_mqtt_budgeting_start(void);
 esp_err_t esp_rmaker_mqtt_increase_budget(uint8_t budget);
 esp_err_t esp_rmaker_mqtt_decrease_budget(uint8_t budget);
 bool esp_rmaker_mqtt_is_budget_available(void);
+/* Checks and decreases the budget atomically. Returns false, without decreasing it, if not available. */
+bool esp_rmaker_mqtt_budget_try_consume(uint8_t budget);
+/* Time (in milliseconds) after which the budget would revive next */
+uint32_t esp_rmaker_mqtt_budget_get_revive_delay(void);
+/* Cost of publishing data_len bytes, as per CONFIG_ESP_RMAKER_MQTT_BUDGET_BYTES_PER_UNIT */
+uint32_t esp_rmaker_mqtt_budget_get_cost(size_t data_len);
+/* Same as the above, but for both the overall budget and that of the class, if limited.
+ * RMAKER_MQTT_PRIO_MAX can be used as prio for messages without a class.
+ */
+bool esp_rmaker_mqtt_budget_class_available(esp_rmaker_mqtt_prio_t prio, uint32_t cost);
+bool esp_rmaker_mqtt_budget_class_try_consume(esp_rmaker_mqtt_prio_t prio, uint32_t cost);
+void esp_rmaker_mqtt_budget_class_refund(esp_rmaker_mqtt_prio_t prio, uint32_t cost);
@@ -0,0 +1,303 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <string.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_rmaker_core.h>
+#include <esp_rmaker_mqtt.h>
+#include "esp_rmaker_mqtt_topics.h"
+
+static const char *TAG = "esp_rmaker_mqtt_dispatch";
+
+#define NODE_TOPIC_PREFIX       "node/"
+#define NODE_WILDCARD_SUFFIX    "#"
+
+/* A level of the topic filters registered under node/<node_id>/. Nodes are never freed, since the
+ * number of topics is small, and this allows handlers to unsubscribe from within the callbacks.
+ */
+typedef struct esp_rmaker_mqtt_trie_node {
+    char *level;
+    struct esp_rmaker_mqtt_trie_node *children;
+    struct esp_rmaker_mqtt_trie_node *next;
+    /* Full topic suffix, allocated when a handler is first registered for this node */
+    char *topic_suffix;
+    esp_rmaker_mqtt_subscribe_cb_t cb;
+    void *priv_data;
+    esp_rmaker_mqtt_handler_stats_t stats;
+} esp_rmaker_mqtt_trie_node_t;
+
+static esp_rmaker_mqtt_trie_node_t s_root;
+static SemaphoreHandle_t s_dispatch_lock;
+static uint32_t s_unmatched;
+#ifdef CONFIG_ESP_RMAKER_MQTT_NODE_WILDCARD_SUBSCRIBE
+static bool s_wildcard_subscribed;
+#endif
+
+static esp_err_t esp_rmaker_mqtt_dispatch_init(void)
+{
+    if (s_dispatch_lock) {
+        return ESP_OK;
+    }
+    /* Recursive, so that the handlers can (un)subscribe */
+    SemaphoreHandle_t lock = xSemaphoreCreateRecursiveMutex();
+    if (!lock) {
+        ESP_LOGE(TAG, "Failed to create dispatch lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    s_dispatch_lock = lock;
+    return ESP_OK;
+}
+
+static const char *esp_rmaker_mqtt_level_end(const char *level)
+{
+    const char *end = strchr(level, '/');
+    return end ? end : level + strlen(level);
+}
+
+static esp_rmaker_mqtt_trie_node_t *esp_rmaker_mqtt_trie_find(esp_rmaker_mqtt_trie_node_t *parent,
+        const char *level, size_t len)
+{
+    for (esp_rmaker_mqtt_trie_node_t *node = parent->children; node; node = node->next) {
+        if ((strncmp(node->level, level, len) == 0) && (node->level[len] == '\0')) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the node of the topic suffix, adding the missing levels if create is true */
+static esp_rmaker_mqtt_trie_node_t *esp_rmaker_mqtt_trie_get(const char *topic_suffix, bool create)
+{
+    esp_rmaker_mqtt_trie_node_t *node = &s_root;
+    const char *level = topic_suffix;
+    while (node) {
+        const char *end = esp_rmaker_mqtt_level_end(level);
+        esp_rmaker_mqtt_trie_node_t *child = esp_rmaker_mqtt_trie_find(node, level, end - level);
+        if (!child && create) {
+            child = calloc(1, sizeof(esp_rmaker_mqtt_trie_node_t));
+            if (!child) {
+                return NULL;
+            }
+            child->level = strndup(level, end - level);
+            if (!child->level) {
+                free(child);
+                return NULL;
+            }
+            child->next = node->children;
+            node->children = child;
+        }
+        node = child;
+        if (*end == '\0') {
+            break;
+        }
+        level = end + 1;
+    }
+    return node;
+}
+
+static void esp_rmaker_mqtt_trie_call(esp_rmaker_mqtt_trie_node_t *node, const char *topic, void *payload,
+        size_t payload_len, int *matched)
+{
+    if (!node || !node->cb) {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    node->cb(topic, payload, payload_len, node->priv_data);
+    uint32_t latency = esp_timer_get_time() - start;
+    esp_rmaker_mqtt_handler_stats_t *stats = &node->stats;
+    stats->total_us += latency;
+    stats->messages++;
+    if (latency > stats->max_us) {
+        stats->max_us = latency;
+    }
+    (*matched)++;
+}
+
+/* Calls the handlers of all the filters matching the levels, as per the MQTT wildcard rules */
+static void esp_rmaker_mqtt_trie_dispatch(esp_rmaker_mqtt_trie_node_t *parent, const char *level,
+        const char *topic, void *payload, size_t payload_len, int *matched)
+{
+    const char *end = esp_rmaker_mqtt_level_end(level);
+    size_t len = end - level;
+    esp_rmaker_mqtt_trie_call(esp_rmaker_mqtt_trie_find(parent, "#", 1), topic, payload, payload_len, matched);
+    esp_rmaker_mqtt_trie_node_t *children[2] = {
+        esp_rmaker_mqtt_trie_find(parent, level, len),
+        esp_rmaker_mqtt_trie_find(parent, "+", 1)
+    };
+    for (int i = 0; i < 2; i++) {
+        /* A level which itself is "+" has been matched once already */
+        if (!children[i] || ((i == 1) && (children[0] == children[1]))) {
+            continue;
+        }
+        if (*end == '\0') {
+            esp_rmaker_mqtt_trie_call(children[i], topic, payload, payload_len, matched);
+            /* "a/#" matches "a" as well */
+            esp_rmaker_mqtt_trie_call(esp_rmaker_mqtt_trie_find(children[i], "#", 1), topic, payload,
+                    payload_len, matched);
+        } else {
+            esp_rmaker_mqtt_trie_dispatch(children[i], end + 1, topic, payload, payload_len, matched);
+        }
+    }
+}
+
+static void esp_rmaker_mqtt_dispatch_callback(const char *topic, void *payload, size_t payload_len, void *priv_data)
+{
+    const char *node_id = esp_rmaker_get_node_id();
+    size_t prefix_len = strlen(NODE_TOPIC_PREFIX);
+    size_t node_id_len = node_id ? strlen(node_id) : 0;
+    if (!topic || !node_id || (strncmp(topic, NODE_TOPIC_PREFIX, prefix_len) != 0) ||
+            (strncmp(topic + prefix_len, node_id, node_id_len) != 0) ||
+            (topic[prefix_len + node_id_len] != '/')) {
+        ESP_LOGW(TAG, "Received message on unexpected topic %s", topic ? topic : "(null)");
+        return;
+    }
+    int matched = 0;
+    xSemaphoreTakeRecursive(s_dispatch_lock, portMAX_DELAY);
+    esp_rmaker_mqtt_trie_dispatch(&s_root, topic + prefix_len + node_id_len + 1, topic, payload,
+            payload_len, &matched);
+    if (!matched) {
+        s_unmatched++;
+    }
+    xSemaphoreGiveRecursive(s_dispatch_lock);
+    if (!matched) {
+        ESP_LOGW(TAG, "No handler for %s", topic);
+    }
+}
+
+static esp_err_t esp_rmaker_mqtt_node_topic(char *buf, size_t buf_size, const char *topic_suffix)
+{
+    const char *node_id = esp_rmaker_get_node_id();
+    if (!node_id) {
+        ESP_LOGE(TAG, "Node ID not available.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (snprintf(buf, buf_size, NODE_TOPIC_PREFIX "%s/%s", node_id, topic_suffix) >= buf_size) {
+        ESP_LOGE(TAG, "Topic too long for %s", topic_suffix);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+/* Subscribes to the topic on the broker, or to node/<node_id>/# if the wildcard subscription is enabled */
+static esp_err_t esp_rmaker_mqtt_dispatch_subscribe(const char *topic_suffix, uint8_t qos)
+{
+    char topic[MQTT_TOPIC_BUFFER_SIZE];
+#ifdef CONFIG_ESP_RMAKER_MQTT_NODE_WILDCARD_SUBSCRIBE
+    if (s_wildcard_subscribed) {
+        return ESP_OK;
+    }
+    /* The callbacks can be of any QoS. So, subscribing with the highest used by RainMaker. */
+    topic_suffix = NODE_WILDCARD_SUFFIX;
+    qos = RMAKER_MQTT_QOS1;
+#endif
+    esp_err_t err = esp_rmaker_mqtt_node_topic(topic, sizeof(topic), topic_suffix);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_rmaker_mqtt_subscribe(topic, esp_rmaker_mqtt_dispatch_callback, qos, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to subscribe to %s. Error %d", topic, err);
+        return err;
+    }
+#ifdef CONFIG_ESP_RMAKER_MQTT_NODE_WILDCARD_SUBSCRIBE
+    s_wildcard_subscribed = true;
+#endif
+    ESP_LOGD(TAG, "Subscribed to %s", topic);
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_mqtt_node_subscribe(const char *topic_suffix, esp_rmaker_mqtt_subscribe_cb_t cb,
+        uint8_t qos, void *priv_data)
+{
+    if (!topic_suffix || !cb || (topic_suffix[0] == '\0') || (topic_suffix[0] == '/')) {
+        ESP_LOGE(TAG, "Invalid topic suffix or callback.");
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_rmaker_mqtt_dispatch_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    xSemaphoreTakeRecursive(s_dispatch_lock, portMAX_DELAY);
+    esp_rmaker_mqtt_trie_node_t *node = esp_rmaker_mqtt_trie_get(topic_suffix, true);
+    if (node && !node->topic_suffix) {
+        node->topic_suffix = strdup(topic_suffix);
+    }
+    if (!node || !node->topic_suffix) {
+        xSemaphoreGiveRecursive(s_dispatch_lock);
+        ESP_LOGE(TAG, "Failed to allocate memory for %s", topic_suffix);
+        return ESP_ERR_NO_MEM;
+    }
+    bool registered = (node->cb != NULL);
+    node->cb = cb;
+    node->priv_data = priv_data;
+    /* The broker subscription is retained across the callback changes */
+    if (!registered) {
+        err = esp_rmaker_mqtt_dispatch_subscribe(topic_suffix, qos);
+        if (err != ESP_OK) {
+            node->cb = NULL;
+        }
+    }
+    xSemaphoreGiveRecursive(s_dispatch_lock);
+    return err;
+}
+
+esp_err_t esp_rmaker_mqtt_node_unsubscribe(const char *topic_suffix)
+{
+    if (!topic_suffix || !s_dispatch_lock) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(s_dispatch_lock, portMAX_DELAY);
+    esp_rmaker_mqtt_trie_node_t *node = esp_rmaker_mqtt_trie_get(topic_suffix, false);
+    if (!node || !node->cb) {
+        xSemaphoreGiveRecursive(s_dispatch_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    node->cb = NULL;
+    node->priv_data = NULL;
+    xSemaphoreGiveRecursive(s_dispatch_lock);
+    esp_err_t err = ESP_OK;
+#ifndef CONFIG_ESP_RMAKER_MQTT_NODE_WILDCARD_SUBSCRIBE
+    char topic[MQTT_TOPIC_BUFFER_SIZE];
+    err = esp_rmaker_mqtt_node_topic(topic, sizeof(topic), topic_suffix);
+    if (err == ESP_OK) {
+        err = esp_rmaker_mqtt_unsubscribe(topic);
+    }
+#endif
+    return err;
+}
+
+static void esp_rmaker_mqtt_trie_foreach(esp_rmaker_mqtt_trie_node_t *parent,
+        esp_rmaker_mqtt_handler_stats_cb_t cb, void *priv_data)
+{
+    for (esp_rmaker_mqtt_trie_node_t *node = parent->children; node; node = node->next) {
+        if (node->topic_suffix) {
+            cb(node->topic_suffix, &node->stats, priv_data);
+        }
+        esp_rmaker_mqtt_trie_foreach(node, cb, priv_data);
+    }
+}
+
+esp_err_t esp_rmaker_mqtt_get_handler_stats(esp_rmaker_mqtt_handler_stats_cb_t cb, void *priv_data,
+        uint32_t *unmatched)
+{
+    if (!cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_dispatch_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTakeRecursive(s_dispatch_lock, portMAX_DELAY);
+    esp_rmaker_mqtt_trie_foreach(&s_root, cb, priv_data);
+    if (unmatched) {
+        *unmatched = s_unmatched;
+    }
+    xSemaphoreGiveRecursive(s_dispatch_lock);
+    return ESP_OK;
+}
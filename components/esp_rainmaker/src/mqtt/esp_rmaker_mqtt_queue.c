@@ -0,0 +1,384 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include <esp_rmaker_mqtt.h>
+#include "esp_rmaker_mqtt_queue.h"
+
+#ifdef CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE
+
+#include <esp_event.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_rmaker_common_events.h>
+#include "esp_rmaker_mqtt_budget.h"
+#include "esp_rmaker_metrics_internal.h"
+
+static const char *TAG = "esp_rmaker_mqtt_queue";
+
+/* Backoff for retrying a publish which failed for reasons other than the budget, while connected */
+#define MQTT_QUEUE_RETRY_MIN_MS     1000
+#define MQTT_QUEUE_RETRY_MAX_MS     60000
+
+typedef struct esp_rmaker_mqtt_queue_entry {
+    struct esp_rmaker_mqtt_queue_entry *next;
+    int64_t queued_at;
+    size_t data_len;
+    uint8_t qos;
+    esp_rmaker_mqtt_prio_t prio;
+    esp_rmaker_mqtt_queue_drop_cb_t drop_cb;
+    void *drop_priv;
+    /* Points to the NULL terminated topic, stored after the data */
+    char *topic;
+    uint8_t data[];
+} esp_rmaker_mqtt_queue_entry_t;
+
+typedef struct {
+    esp_rmaker_mqtt_queue_entry_t *head;
+    esp_rmaker_mqtt_queue_entry_t *tail;
+    /* For the average latency */
+    uint64_t total_latency_us;
+} esp_rmaker_mqtt_queue_t;
+
+static esp_rmaker_mqtt_queue_t s_queues[RMAKER_MQTT_PRIO_MAX];
+static esp_rmaker_mqtt_queue_stats_t s_queue_stats;
+static SemaphoreHandle_t s_queue_lock;
+/* To drain the queue once the budget revives */
+static TimerHandle_t s_queue_timer;
+static bool s_mqtt_connected;
+static bool s_drain_queued;
+static uint32_t s_retry_delay_ms;
+
+static size_t esp_rmaker_mqtt_queue_entry_size(size_t topic_len, size_t data_len)
+{
+    return sizeof(esp_rmaker_mqtt_queue_entry_t) + data_len + topic_len + 1;
+}
+
+static void esp_rmaker_mqtt_queue_push(esp_rmaker_mqtt_queue_entry_t *entry, bool at_head)
+{
+    esp_rmaker_mqtt_queue_t *queue = &s_queues[entry->prio];
+    esp_rmaker_mqtt_prio_stats_t *stats = &s_queue_stats.prio[entry->prio];
+    if (at_head) {
+        entry->next = queue->head;
+        queue->head = entry;
+        if (!queue->tail) {
+            queue->tail = entry;
+        }
+    } else {
+        entry->next = NULL;
+        if (queue->tail) {
+            queue->tail->next = entry;
+        } else {
+            queue->head = entry;
+        }
+        queue->tail = entry;
+    }
+    stats->depth++;
+    if (stats->depth > stats->max_depth) {
+        stats->max_depth = stats->depth;
+    }
+    s_queue_stats.queued_bytes += esp_rmaker_mqtt_queue_entry_size(strlen(entry->topic), entry->data_len);
+}
+
+static esp_rmaker_mqtt_queue_entry_t *esp_rmaker_mqtt_queue_pop(esp_rmaker_mqtt_prio_t prio)
+{
+    esp_rmaker_mqtt_queue_t *queue = &s_queues[prio];
+    esp_rmaker_mqtt_queue_entry_t *entry = queue->head;
+    if (entry) {
+        queue->head = entry->next;
+        if (!queue->head) {
+            queue->tail = NULL;
+        }
+        s_queue_stats.prio[prio].depth--;
+        s_queue_stats.queued_bytes -= esp_rmaker_mqtt_queue_entry_size(strlen(entry->topic), entry->data_len);
+    }
+    return entry;
+}
+
+/* Returns true if any message of the given or higher priority is waiting */
+static bool esp_rmaker_mqtt_queue_has_pending(esp_rmaker_mqtt_prio_t prio)
+{
+    for (int i = 0; i <= prio; i++) {
+        if (s_queues[i].head) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Drops the oldest messages of the lowest priority, not higher than the given one, till the required
+ * number of bytes are available. Returns false if that is not possible, without dropping anything.
+ * The dropped messages are returned in the dropped list, for their drop callbacks to be called
+ * after releasing the lock.
+ */
+static bool esp_rmaker_mqtt_queue_make_room(esp_rmaker_mqtt_prio_t prio, size_t size,
+        esp_rmaker_mqtt_queue_entry_t **dropped)
+{
+    if (size > CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE_SIZE) {
+        return false;
+    }
+    size_t available = CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE_SIZE - s_queue_stats.queued_bytes;
+    for (int i = RMAKER_MQTT_PRIO_MAX - 1; (i >= (int)prio) && (available < size); i--) {
+        for (esp_rmaker_mqtt_queue_entry_t *entry = s_queues[i].head; entry && (available < size); entry = entry->next) {
+            available += esp_rmaker_mqtt_queue_entry_size(strlen(entry->topic), entry->data_len);
+        }
+    }
+    if (available < size) {
+        return false;
+    }
+    for (int i = RMAKER_MQTT_PRIO_MAX - 1; i >= (int)prio; i--) {
+        while ((s_queue_stats.queued_bytes + size > CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE_SIZE) && s_queues[i].head) {
+            esp_rmaker_mqtt_queue_entry_t *entry = esp_rmaker_mqtt_queue_pop(i);
+            entry->next = *dropped;
+            *dropped = entry;
+            s_queue_stats.prio[i].dropped++;
+            ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_MQTT_BUDGET_DROPS, 1);
+        }
+    }
+    return true;
+}
+
+static void esp_rmaker_mqtt_queue_free_dropped(esp_rmaker_mqtt_queue_entry_t *dropped)
+{
+    while (dropped) {
+        esp_rmaker_mqtt_queue_entry_t *next = dropped->next;
+        if (dropped->drop_cb) {
+            dropped->drop_cb(dropped->drop_priv);
+        }
+        free(dropped);
+        dropped = next;
+    }
+}
+
+static void esp_rmaker_mqtt_queue_drain(void *priv_data)
+{
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    s_drain_queued = false;
+    while (s_mqtt_connected) {
+        /* The highest priority message, whose class has the budget, so that a class which has exhausted
+         * its budget does not hold up the others.
+         */
+        esp_rmaker_mqtt_queue_entry_t *entry = NULL;
+        for (int i = 0; (i < RMAKER_MQTT_PRIO_MAX) && !entry; i++) {
+            if (s_queues[i].head && esp_rmaker_mqtt_budget_class_available(i,
+                        esp_rmaker_mqtt_budget_get_cost(s_queues[i].head->data_len))) {
+                entry = esp_rmaker_mqtt_queue_pop(i);
+            }
+        }
+        if (!entry) {
+            if (esp_rmaker_mqtt_queue_has_pending(RMAKER_MQTT_PRIO_MAX - 1)) {
+                TickType_t ticks = pdMS_TO_TICKS(esp_rmaker_mqtt_budget_get_revive_delay());
+                xTimerChangePeriod(s_queue_timer, ticks ? ticks : 1, 0);
+            }
+            break;
+        }
+        /* Not holding the lock while publishing, since that can take time */
+        xSemaphoreGive(s_queue_lock);
+        esp_err_t err = esp_rmaker_mqtt_publish_class(entry->topic, entry->data, entry->data_len, entry->qos, NULL,
+                entry->prio);
+        xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+        if (err != ESP_OK) {
+            /* Retried when MQTT reconnects, or else after a backoff, since the budget was available */
+            esp_rmaker_mqtt_queue_push(entry, true);
+            if (s_mqtt_connected) {
+                s_retry_delay_ms = s_retry_delay_ms ? s_retry_delay_ms * 2 : MQTT_QUEUE_RETRY_MIN_MS;
+                if (s_retry_delay_ms > MQTT_QUEUE_RETRY_MAX_MS) {
+                    s_retry_delay_ms = MQTT_QUEUE_RETRY_MAX_MS;
+                }
+                xTimerChangePeriod(s_queue_timer, pdMS_TO_TICKS(s_retry_delay_ms), 0);
+            }
+            break;
+        }
+        s_retry_delay_ms = 0;
+        esp_rmaker_mqtt_prio_stats_t *stats = &s_queue_stats.prio[entry->prio];
+        int64_t latency = esp_timer_get_time() - entry->queued_at;
+        stats->published++;
+        s_queues[entry->prio].total_latency_us += latency;
+        if ((latency / 1000) > stats->max_latency_ms) {
+            stats->max_latency_ms = latency / 1000;
+        }
+        free(entry);
+    }
+    xSemaphoreGive(s_queue_lock);
+}
+
+void esp_rmaker_mqtt_queue_kick(void)
+{
+    if (!s_queue_lock) {
+        return;
+    }
+    bool queue_drain = false;
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    if (!s_drain_queued && esp_rmaker_mqtt_queue_has_pending(RMAKER_MQTT_PRIO_MAX - 1)) {
+        s_drain_queued = queue_drain = true;
+    }
+    xSemaphoreGive(s_queue_lock);
+    if (queue_drain && (esp_rmaker_work_queue_add_task(esp_rmaker_mqtt_queue_drain, NULL) != ESP_OK)) {
+        s_drain_queued = false;
+    }
+}
+
+static void esp_rmaker_mqtt_queue_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_mqtt_queue_kick();
+}
+
+static void esp_rmaker_mqtt_queue_event_handler(void* arg, esp_event_base_t event_base,
+                          int32_t event_id, void* event_data)
+{
+    if (event_id == RMAKER_MQTT_EVENT_CONNECTED) {
+        s_mqtt_connected = true;
+        s_retry_delay_ms = 0;
+        esp_rmaker_mqtt_queue_kick();
+    } else if (event_id == RMAKER_MQTT_EVENT_DISCONNECTED) {
+        s_mqtt_connected = false;
+    }
+}
+
+esp_err_t esp_rmaker_mqtt_queue_init(void)
+{
+    if (s_queue_lock) {
+        return ESP_OK;
+    }
+    s_queue_lock = xSemaphoreCreateMutex();
+    if (!s_queue_lock) {
+        ESP_LOGE(TAG, "Failed to create MQTT publish queue lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    /* Period is set as per the time left for the budget to revive, when started */
+    s_queue_timer = xTimerCreate("mqtt_queue_tm", 1, pdFALSE, NULL, esp_rmaker_mqtt_queue_timer_cb);
+    if (!s_queue_timer) {
+        ESP_LOGE(TAG, "Failed to create MQTT publish queue timer.");
+        vSemaphoreDelete(s_queue_lock);
+        s_queue_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_CONNECTED,
+            &esp_rmaker_mqtt_queue_event_handler, NULL);
+    esp_event_handler_register(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_DISCONNECTED,
+            &esp_rmaker_mqtt_queue_event_handler, NULL);
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_mqtt_publish_with_prio_cb(const char *topic, void *data, size_t data_len, uint8_t qos,
+        esp_rmaker_mqtt_prio_t prio, esp_rmaker_mqtt_queue_drop_cb_t drop_cb, void *drop_priv)
+{
+    if (!topic || (prio >= RMAKER_MQTT_PRIO_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_queue_lock) {
+        return esp_rmaker_mqtt_publish_class(topic, data, data_len, qos, NULL, prio);
+    }
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    bool publish_now = !s_mqtt_connected ||
+            (esp_rmaker_mqtt_budget_class_available(prio, esp_rmaker_mqtt_budget_get_cost(data_len)) &&
+            !esp_rmaker_mqtt_queue_has_pending(prio));
+    xSemaphoreGive(s_queue_lock);
+    if (publish_now) {
+        esp_err_t err = esp_rmaker_mqtt_publish_class(topic, data, data_len, qos, NULL, prio);
+        if (err == ESP_OK) {
+            xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+            s_queue_stats.prio[prio].published++;
+            xSemaphoreGive(s_queue_lock);
+        }
+        return err;
+    }
+    size_t topic_len = strlen(topic);
+    size_t size = esp_rmaker_mqtt_queue_entry_size(topic_len, data_len);
+    esp_rmaker_mqtt_queue_entry_t *entry = NULL;
+    esp_rmaker_mqtt_queue_entry_t *dropped = NULL;
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    s_queue_stats.prio[prio].deferred++;
+    if (esp_rmaker_mqtt_queue_make_room(prio, size, &dropped)) {
+        entry = malloc(size);
+    }
+    if (!entry) {
+        s_queue_stats.prio[prio].dropped++;
+        ESP_RMAKER_METRIC_ADD(RMAKER_METRIC_MQTT_BUDGET_DROPS, 1);
+        xSemaphoreGive(s_queue_lock);
+        esp_rmaker_mqtt_queue_free_dropped(dropped);
+        ESP_LOGE(TAG, "MQTT publish queue full. Dropping publish message.");
+        return ESP_ERR_NO_MEM;
+    }
+    entry->queued_at = esp_timer_get_time();
+    entry->data_len = data_len;
+    entry->qos = qos;
+    entry->prio = prio;
+    entry->drop_cb = drop_cb;
+    entry->drop_priv = drop_priv;
+    memcpy(entry->data, data, data_len);
+    entry->topic = (char *)entry->data + data_len;
+    memcpy(entry->topic, topic, topic_len + 1);
+    esp_rmaker_mqtt_queue_push(entry, false);
+    xSemaphoreGive(s_queue_lock);
+    if (dropped) {
+        ESP_LOGW(TAG, "MQTT publish queue full. Dropped older messages.");
+        esp_rmaker_mqtt_queue_free_dropped(dropped);
+    }
+    ESP_LOGD(TAG, "Out of MQTT Budget. Queued publish message.");
+    esp_rmaker_mqtt_queue_kick();
+    return ESP_ERR_NOT_FINISHED;
+}
+
+esp_err_t esp_rmaker_mqtt_get_queue_stats(esp_rmaker_mqtt_queue_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_queue_lock) {
+        memset(stats, 0, sizeof(esp_rmaker_mqtt_queue_stats_t));
+        return ESP_OK;
+    }
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    *stats = s_queue_stats;
+    for (int i = 0; i < RMAKER_MQTT_PRIO_MAX; i++) {
+        /* Only the messages published from the queue count for the latency */
+        uint32_t dequeued = stats->prio[i].deferred - stats->prio[i].depth - stats->prio[i].dropped;
+        stats->prio[i].avg_latency_ms = dequeued ? (s_queues[i].total_latency_us / dequeued / 1000) : 0;
+    }
+    xSemaphoreGive(s_queue_lock);
+    return ESP_OK;
+}
+
+#else /* !CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE */
+
+esp_err_t esp_rmaker_mqtt_queue_init(void)
+{
+    return ESP_OK;
+}
+
+void esp_rmaker_mqtt_queue_kick(void)
+{
+}
+
+esp_err_t esp_rmaker_mqtt_publish_with_prio_cb(const char *topic, void *data, size_t data_len, uint8_t qos,
+        esp_rmaker_mqtt_prio_t prio, esp_rmaker_mqtt_queue_drop_cb_t drop_cb, void *drop_priv)
+{
+    if (prio >= RMAKER_MQTT_PRIO_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_rmaker_mqtt_publish_class(topic, data, data_len, qos, NULL, prio);
+}
+
+esp_err_t esp_rmaker_mqtt_get_queue_stats(esp_rmaker_mqtt_queue_stats_t *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* !CONFIG_ESP_RMAKER_MQTT_PUBLISH_QUEUE */
+
+esp_err_t esp_rmaker_mqtt_publish_with_prio(const char *topic, void *data, size_t data_len, uint8_t qos,
+        esp_rmaker_mqtt_prio_t prio)
+{
+    return esp_rmaker_mqtt_publish_with_prio_cb(topic, data, data_len, qos, prio, NULL, NULL);
+}
@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <esp_err.h>
+#include <esp_rmaker_mqtt.h>
+
+esp_err_t esp_rmaker_mqtt_queue_init(void);
+/* Publishes the queued messages, as far as the budget allows, from the RainMaker work queue */
+void esp_rmaker_mqtt_queue_kick(void);
+/* Called if a queued message gets dropped to make room for others, so that the data can be reported later */
+typedef void (*esp_rmaker_mqtt_queue_drop_cb_t)(void *priv);
+/* Same as esp_rmaker_mqtt_publish_with_prio(), with drop_cb being called with drop_priv if the message was
+ * queued (ie. ESP_ERR_NOT_FINISHED was returned) and then dropped. It is not called with any lock held.
+ */
+esp_err_t esp_rmaker_mqtt_publish_with_prio_cb(const char *topic, void *data, size_t data_len, uint8_t qos,
+        esp_rmaker_mqtt_prio_t prio, esp_rmaker_mqtt_queue_drop_cb_t drop_cb, void *drop_priv);
+/* Same as esp_rmaker_mqtt_publish(), with the budget of the given class also being consumed */
+esp_err_t esp_rmaker_mqtt_publish_class(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id,
+        esp_rmaker_mqtt_prio_t prio);
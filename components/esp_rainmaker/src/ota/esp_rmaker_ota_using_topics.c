@@ -74,12 +74,12 @@ esp_err_t esp_rmaker_ota_report_status_using_topics(esp_rmaker_ota_handle_t ota_
     json_gen_end_object(&jstr);
     json_gen_str_end(&jstr);
 
-    char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-    esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), OTASTATUS_TOPIC_SUFFIX, OTASTATUS_TOPIC_RULE);
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_OTASTATUS);
     ESP_LOGI(TAG, "%s",publish_payload);
-    esp_err_t err = esp_rmaker_mqtt_publish(publish_topic, publish_payload, strlen(publish_payload),
-                        RMAKER_MQTT_QOS1, NULL);
-    if (err != ESP_OK) {
+    esp_err_t err = esp_rmaker_mqtt_publish_with_prio(publish_topic, publish_payload, strlen(publish_payload),
+                        RMAKER_MQTT_QOS1, RMAKER_MQTT_PRIO_OTA);
+    /* A queued status gets published as the budget revives */
+    if ((err != ESP_OK) && (err != ESP_ERR_NOT_FINISHED)) {
         ESP_LOGE(TAG, "esp_rmaker_mqtt_publish_data returned error %d",err);
         return ESP_FAIL;
     }
@@ -251,11 +251,13 @@ esp_err_t esp_rmaker_ota_fetch(void)
     json_gen_obj_set_string(&jstr, "fw_version", info->fw_version);
     json_gen_end_object(&jstr);
     json_gen_str_end(&jstr);
-    char publish_topic[MQTT_TOPIC_BUFFER_SIZE];
-    esp_rmaker_create_mqtt_topic(publish_topic, sizeof(publish_topic), OTAFETCH_TOPIC_SUFFIX, OTAFETCH_TOPIC_RULE);
-    esp_err_t err = esp_rmaker_mqtt_publish(publish_topic, publish_payload, strlen(publish_payload),
-                        RMAKER_MQTT_QOS1, NULL);
-    if (err != ESP_OK) {
+    const char *publish_topic = esp_rmaker_get_mqtt_topic(RMAKER_TOPIC_OTAFETCH);
+    esp_err_t err = esp_rmaker_mqtt_publish_with_prio(publish_topic, publish_payload, strlen(publish_payload),
+                        RMAKER_MQTT_QOS1, RMAKER_MQTT_PRIO_OTA);
+    if (err == ESP_ERR_NOT_FINISHED) {
+        /* Queued, to be published as the budget revives */
+        err = ESP_OK;
+    } else if (err != ESP_OK) {
         ESP_LOGE(TAG, "OTA Fetch Publish Error %d", err);
     }
     return err;
@@ -268,14 +270,9 @@ void esp_rmaker_ota_autofetch_timer_cb(void *priv)
 
 static esp_err_t esp_rmaker_ota_subscribe(void *priv_data)
 {
-    char subscribe_topic[MQTT_TOPIC_BUFFER_SIZE];
-
-    snprintf(subscribe_topic, sizeof(subscribe_topic),"node/%s/%s", esp_rmaker_get_node_id(), OTAURL_TOPIC_SUFFIX);
-
-    ESP_LOGI(TAG, "Subscribing to: %s", subscribe_topic);
-    /* First unsubscribe, in case there is a stale subscription */
-    esp_rmaker_mqtt_unsubscribe(subscribe_topic);
-    esp_err_t err = esp_rmaker_mqtt_subscribe(subscribe_topic, ota_url_handler, RMAKER_MQTT_QOS1, priv_data);
+    ESP_LOGI(TAG, "Subscribing to: %s", OTAURL_TOPIC_SUFFIX);
+    /* Registering again just replaces the callback, in case there is a stale subscription */
+    esp_err_t err = esp_rmaker_mqtt_node_subscribe(OTAURL_TOPIC_SUFFIX, ota_url_handler, RMAKER_MQTT_QOS1, priv_data);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "OTA URL Subscription Error %d", err);
     }